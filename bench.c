@@ -0,0 +1,526 @@
+#include "common.h"
+#include "cli.h"
+#include "indexer.h"
+#include "mole_index.h"
+#include "persister.h"
+#include "signature.h"
+#include "snapshot.h"
+#include "walker.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define BENCH_DIR_DEFAULT "/tmp/mole-bench"
+#define BENCH_CACHE_DEFAULT "/tmp/mole-bench.cache"
+#define BENCH_TYPE_MIX_DEFAULT "j:10,p:10,g:5,z:5,P:5,o:3,x:2,E:2,-:58"
+#define BENCH_NAME_PART_QUERIES 8
+
+// Parameters of synthetic tree and of benchmarks.
+typedef struct bench_config
+{
+    char* path_d;                           // Root of generated tree
+    char* path_f;                           // Cache file used by benchmarks
+    int depth;                              // Number of directory levels below root
+    int fanout;                             // Number of subdirectories of every directory
+    int files;                              // Number of files in every directory
+    int name_min;                           // Minimal length of generated names
+    int name_max;                           // Maximal length of generated names
+    uint64_t size_max;                      // Maximal size of generated files
+    uint64_t seed;                          // Seed of random generator
+    int threads;                            // Number of threads traversing the tree
+    int index_runs;                         // Number of runs of every indexing benchmark
+    int query_runs;                         // Number of runs of every query benchmark
+    uint32_t weights[FILE_TYPE_COUNT];      // Relative frequency of every file type
+    uint32_t weight_total;                  // Sum of above weights
+} bench_config_t;
+
+// Totals of generated tree.
+typedef struct bench_tree
+{
+    uint64_t dirs;                          // Number of directories (including root)
+    uint64_t files;                         // Number of files
+    uint64_t bytes;                         // Sum of sizes of files
+} bench_tree_t;
+
+// Results of benchmarks are printed here, as stdout is redirected to /dev/null
+// to silence commands being measured.
+static FILE* out;
+
+void bench_usage(char* name)
+{
+    fprintf(stderr, "Usage: %s [options]\n", name);
+    fprintf(stderr, "Generates synthetic directory tree and measures indexing, cache and query performance.\n");
+    fprintf(stderr, "Results are printed one per line as space separated key=value pairs.\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -d <path>   \tGenerate tree in <path> (default %s). Existing directory\n", BENCH_DIR_DEFAULT);
+    fprintf(stderr, "              \tis used as it is, without generating anything.\n");
+    fprintf(stderr, "  -f <file>   \tUse <file> as cache file (default %s).\n", BENCH_CACHE_DEFAULT);
+    fprintf(stderr, "  -D <arg>    \tNumber of directory levels below root (default 4).\n");
+    fprintf(stderr, "  -F <arg>    \tNumber of subdirectories of every directory (default 6).\n");
+    fprintf(stderr, "  -n <arg>    \tNumber of files in every directory (default 40).\n");
+    fprintf(stderr, "  -m <mix>    \tMix of file types as comma separated letter:weight pairs,\n");
+    fprintf(stderr, "              \tusing letters shown in listings ('-' for unrecognized files)\n");
+    fprintf(stderr, "              \t(default %s).\n", BENCH_TYPE_MIX_DEFAULT);
+    fprintf(stderr, "  -l <min-max>\tLengths of names are uniformly distributed in [min, max] (default 4-24).\n");
+    fprintf(stderr, "  -S <arg>    \tMaximal size of files in bytes, sizes are log-uniform (default 1048576).\n");
+    fprintf(stderr, "  -s <arg>    \tSeed of random generator (default 1).\n");
+    fprintf(stderr, "  -j <arg>    \tUse <arg> threads for traversing directory tree.\n");
+    fprintf(stderr, "  -r <arg>    \tNumber of runs of every indexing and cache benchmark (default 3).\n");
+    fprintf(stderr, "  -q <arg>    \tNumber of runs of every query benchmark (default 100).\n");
+    exit(EXIT_FAILURE);
+}
+
+// Parses mix of file types like "j:10,p:5,-:85" into `config->weights`.
+void bench_parse_mix(bench_config_t* config, char* mix, char* name)
+{
+    memset(config->weights, 0, sizeof(config->weights));
+    config->weight_total = 0;
+
+    for(char* item = strtok(mix, ","); NULL != item; item = strtok(NULL, ","))
+    {
+        if(strlen(item) < 3 || item[1] != ':') bench_usage(name);
+
+        int type = Unrecognized;
+        if(item[0] != '-')
+        {
+            for(type = Directory + 1; type < Removed; ++type)
+                if(cli_get_type_letter(type) == item[0]) break;
+            if(type == Removed) bench_usage(name);
+        }
+
+        int weight = atoi(item + 2);
+        if(weight < 0) bench_usage(name);
+        config->weights[type] += weight;
+        config->weight_total += weight;
+    }
+
+    if(config->weight_total == 0) bench_usage(name);
+}
+
+void bench_parseargs(int argc, char** argv, bench_config_t* config)
+{
+    int opt;
+
+    static char mix[] = BENCH_TYPE_MIX_DEFAULT;
+    config->path_d = BENCH_DIR_DEFAULT;
+    config->path_f = BENCH_CACHE_DEFAULT;
+    config->depth = 4;
+    config->fanout = 6;
+    config->files = 40;
+    config->name_min = 4;
+    config->name_max = 24;
+    config->size_max = 1 << 20;
+    config->seed = 1;
+    config->threads = -1;
+    config->index_runs = 3;
+    config->query_runs = 100;
+    bench_parse_mix(config, mix, argv[0]);
+
+    opterr = 0;
+    while((opt = getopt(argc, argv, "hd:f:D:F:n:m:l:S:s:j:r:q:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'd':
+                config->path_d = optarg;
+            break;
+            case 'f':
+                config->path_f = optarg;
+            break;
+            case 'D':
+                config->depth = atoi(optarg);
+                if(config->depth < 0 || config->depth > 16) bench_usage(argv[0]);
+            break;
+            case 'F':
+                config->fanout = atoi(optarg);
+                if(config->fanout < 0) bench_usage(argv[0]);
+            break;
+            case 'n':
+                config->files = atoi(optarg);
+                if(config->files < 0) bench_usage(argv[0]);
+            break;
+            case 'm':
+                bench_parse_mix(config, optarg, argv[0]);
+            break;
+            case 'l':
+                if(sscanf(optarg, "%d-%d", &config->name_min, &config->name_max) != 2
+                   || config->name_min < 1 || config->name_max < config->name_min || config->name_max > 200)
+                    bench_usage(argv[0]);
+            break;
+            case 'S':
+                config->size_max = strtoull(optarg, NULL, 10);
+                if(config->size_max == 0 || config->size_max > (1ULL << 40)) bench_usage(argv[0]);
+            break;
+            case 's':
+                config->seed = strtoull(optarg, NULL, 10);
+            break;
+            case 'j':
+                config->threads = atoi(optarg);
+                if(config->threads < 1 || config->threads > WALKER_THREADS_MAX) bench_usage(argv[0]);
+            break;
+            case 'r':
+                config->index_runs = atoi(optarg);
+                if(config->index_runs < 1) bench_usage(argv[0]);
+            break;
+            case 'q':
+                config->query_runs = atoi(optarg);
+                if(config->query_runs < 1) bench_usage(argv[0]);
+            break;
+            default:
+                bench_usage(argv[0]);
+            break;
+        }
+    }
+
+    if(argc > optind) bench_usage(argv[0]);
+
+    if(config->threads < 0)
+    {
+        long processors = sysconf(_SC_NPROCESSORS_ONLN);
+        config->threads = processors < 1 ? 1 : processors > WALKER_THREADS_MAX ? WALKER_THREADS_MAX : processors;
+    }
+}
+
+// Returns next number of xorshift64* sequence. The tree depends only on the seed.
+uint64_t bench_random(uint64_t* state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545f4914f6cdd1dULL;
+}
+
+// Stores random name with length from [`name_min`, `name_max`] in `name`.
+void bench_random_name(const bench_config_t* config, uint64_t* state, char* name)
+{
+    int length = config->name_min + bench_random(state) % (config->name_max - config->name_min + 1);
+    for(int i = 0; i < length; ++i)
+        name[i] = 'a' + bench_random(state) % 26;
+    name[length] = '\0';
+}
+
+// Stores beginning of file of type `file_type` in `header`. Returns its length.
+size_t bench_fill_header(file_type_t file_type, unsigned char* header)
+{
+    size_t length = 0;
+    memset(header, 0, MOLE_HEADER_WINDOW);
+
+#define X(type, offset, bytes, second_offset, second_bytes) \
+    if(file_type == type && length == 0) \
+    { \
+        memcpy(header + offset, bytes, sizeof(bytes) - 1); \
+        memcpy(header + second_offset, second_bytes, sizeof(second_bytes) - 1); \
+        size_t end = offset + sizeof(bytes) - 1, second_end = second_offset + sizeof(second_bytes) - 1; \
+        length = end > second_end ? end : second_end; \
+    }
+    MOLE_SIGNATURES(X)
+#undef X
+
+    if(length == 0)
+    {
+        const char text[] = "mole benchmark data\n";
+        memcpy(header, text, sizeof(text) - 1);
+        length = sizeof(text) - 1;
+    }
+
+    return length;
+}
+
+void bench_generate_file(const bench_config_t* config, int dir_fd, uint64_t* state, bench_tree_t* tree)
+{
+    uint32_t pick = bench_random(state) % config->weight_total;
+    file_type_t file_type = Unrecognized;
+    for(int type = 0; type < FILE_TYPE_COUNT; ++type)
+    {
+        if(pick < config->weights[type])
+        {
+            file_type = type;
+            break;
+        }
+        pick -= config->weights[type];
+    }
+
+    // Sizes are log-uniform, so that there are many small files and few big ones.
+    unsigned char header[MOLE_HEADER_WINDOW];
+    size_t length = bench_fill_header(file_type, header);
+    int bits = 64 - __builtin_clzll(config->size_max);
+    uint64_t size = bench_random(state) % (1ULL << (bench_random(state) % bits + 1));
+    if(size > config->size_max) size = config->size_max;
+    if(size < length) size = length;
+
+    char name[STR_MAX];
+    int fd;
+    do
+    {
+        bench_random_name(config, state, name);
+        fd = openat(dir_fd, name, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    }
+    while(fd < 0 && errno == EEXIST);
+    if(fd < 0) ERROR("openat");
+
+    // Only the header is written, the rest of the file is a hole.
+    if(bulk_write(fd, header, length) < 0) ERROR("write");
+    if(ftruncate(fd, size)) ERROR("ftruncate");
+    if(close(fd)) ERROR("close");
+
+    tree->files++;
+    tree->bytes += size;
+}
+
+void bench_generate_dir(const bench_config_t* config, int dir_fd, int depth, uint64_t* state, bench_tree_t* tree)
+{
+    tree->dirs++;
+    for(int i = 0; i < config->files; ++i)
+        bench_generate_file(config, dir_fd, state, tree);
+
+    if(depth == config->depth) return;
+
+    for(int i = 0; i < config->fanout; ++i)
+    {
+        char name[STR_MAX];
+        int result;
+        do
+        {
+            bench_random_name(config, state, name);
+            result = mkdirat(dir_fd, name, 0755);
+        }
+        while(result && errno == EEXIST);
+        if(result) ERROR("mkdirat");
+
+        int child_fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY);
+        if(child_fd < 0) ERROR("openat");
+        bench_generate_dir(config, child_fd, depth + 1, state, tree);
+        if(close(child_fd)) ERROR("close");
+    }
+}
+
+double bench_now()
+{
+    struct timespec now;
+    if(clock_gettime(CLOCK_MONOTONIC, &now)) ERROR("clock_gettime");
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int bench_compare_times(const void* a, const void* b)
+{
+    double x = *(const double*) a, y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+// Sorts `times` and returns their `percentile`.
+double bench_percentile(double* times, int count, int percentile)
+{
+    qsort(times, count, sizeof(double), bench_compare_times);
+    return times[(count - 1) * percentile / 100];
+}
+
+// Runs indexing the same way `index` command does and waits until the cache is written.
+// Returns time of indexing itself (writing cache happens in background).
+double bench_index_once(mole_context_t* context)
+{
+    persister_t persister;
+    persister_start(&persister, context);
+    context->persister = &persister;
+    context->indexing_pending = true;
+
+    double start = bench_now();
+    indexer_worker(context);
+    double elapsed = bench_now() - start;
+
+    persister_stop(&persister);
+    context->persister = NULL;
+
+    return elapsed;
+}
+
+// Measures indexing. Full traversal is measured both without and with type cache
+// of previous traversal, then incremental traversal is measured.
+void bench_index(const bench_config_t* config, mole_context_t* context)
+{
+    const char* names[] = { "index_full", "index_full_cached", "index_incremental" };
+    double* times = malloc(config->index_runs * sizeof(double));
+    if(NULL == times) ERROR("malloc");
+
+    for(int mode = 0; mode < 3; ++mode)
+    {
+        context->incremental = mode == 2;
+        for(int run = 0; run < config->index_runs; ++run)
+        {
+            if(mode == 0)
+            {
+                mole_index_t empty;
+                index_init(&empty);
+                snapshot_release(snapshot_publish(context, &empty, true));
+            }
+            times[run] = bench_index_once(context);
+        }
+
+        mole_snapshot_t* snapshot = snapshot_acquire(context);
+        uint64_t entries = snapshot->index.size;
+        snapshot_release(snapshot);
+
+        double p50 = bench_percentile(times, config->index_runs, 50);
+        fprintf(out, "bench=%s runs=%d threads=%d entries=%lu p50_s=%.6f min_s=%.6f entries_per_s=%.0f\n",
+                names[mode], config->index_runs, config->threads, entries, p50, times[0], entries / p50);
+    }
+    context->incremental = false;
+
+    free(times);
+}
+
+// Measures writing and mapping cache file.
+void bench_cache(const bench_config_t* config, mole_context_t* context)
+{
+    double* save_times = malloc(config->index_runs * sizeof(double));
+    double* read_times = malloc(config->index_runs * sizeof(double));
+    if(NULL == save_times || NULL == read_times) ERROR("malloc");
+
+    mole_snapshot_t* snapshot = snapshot_acquire(context);
+    for(int run = 0; run < config->index_runs; ++run)
+    {
+        double start = bench_now();
+        index_save(&snapshot->index, config->path_f);
+        save_times[run] = bench_now() - start;
+    }
+    uint64_t entries = snapshot->index.size;
+    snapshot_release(snapshot);
+
+    struct stat cache_stat;
+    if(stat(config->path_f, &cache_stat)) ERROR("stat");
+
+    for(int run = 0; run < config->index_runs; ++run)
+    {
+        mole_index_t index;
+        index_init(&index);
+        double start = bench_now();
+        if(!index_read(&index, config->path_f)) ERROR("index_read");
+        read_times[run] = bench_now() - start;
+        index_free(&index);
+    }
+
+    double save_p50 = bench_percentile(save_times, config->index_runs, 50);
+    double read_p50 = bench_percentile(read_times, config->index_runs, 50);
+    fprintf(out, "bench=index_save runs=%d entries=%lu bytes=%ld p50_ms=%.3f p99_ms=%.3f mb_per_s=%.1f\n",
+            config->index_runs, entries, cache_stat.st_size, save_p50 * 1e3,
+            bench_percentile(save_times, config->index_runs, 99) * 1e3, cache_stat.st_size / save_p50 / 1e6);
+    fprintf(out, "bench=index_read runs=%d entries=%lu bytes=%ld p50_ms=%.3f p99_ms=%.3f mb_per_s=%.1f\n",
+            config->index_runs, entries, cache_stat.st_size, read_p50 * 1e3,
+            bench_percentile(read_times, config->index_runs, 99) * 1e3, cache_stat.st_size / read_p50 / 1e6);
+
+    free(read_times);
+    free(save_times);
+}
+
+// Measures latency of queries, including printing results (into /dev/null).
+void bench_queries(const bench_config_t* config, mole_context_t* context)
+{
+    mole_roots_t roots = { .count = 1, .contexts = context };
+    const char* names[] = { "count", "largerthan", "namepart", "owner" };
+    double* times = malloc(config->query_runs * sizeof(double));
+    if(NULL == times) ERROR("malloc");
+
+    // Patterns are random, but the same for every run of the benchmark.
+    uint64_t state = config->seed ^ 0x9e3779b97f4a7c15ULL;
+    char patterns[BENCH_NAME_PART_QUERIES][4];
+    for(int i = 0; i < BENCH_NAME_PART_QUERIES; ++i)
+    {
+        for(int j = 0; j < 3; ++j)
+            patterns[i][j] = 'a' + bench_random(&state) % 26;
+        patterns[i][3] = '\0';
+    }
+
+    for(int query = 0; query < 4; ++query)
+    {
+        for(int run = 0; run < config->query_runs; ++run)
+        {
+            double start = bench_now();
+            switch(query)
+            {
+                case 0: cli_count(&roots, NULL); break;
+                case 1: cli_largerthan(&roots, config->size_max / 2, NULL, NULL); break;
+                case 2: cli_namepart(&roots, patterns[run % BENCH_NAME_PART_QUERIES], NULL, NULL); break;
+                case 3: cli_owner(&roots, getuid(), NULL, NULL); break;
+            }
+            fflush(stdout);
+            times[run] = bench_now() - start;
+        }
+
+        double p50 = bench_percentile(times, config->query_runs, 50);
+        double p99 = bench_percentile(times, config->query_runs, 99);
+        fprintf(out, "bench=query_%s runs=%d p50_us=%.1f p99_us=%.1f max_us=%.1f\n",
+                names[query], config->query_runs, p50 * 1e6, p99 * 1e6, times[config->query_runs - 1] * 1e6);
+    }
+
+    free(times);
+}
+
+int main(int argc, char** argv)
+{
+    bench_config_t config;
+    bench_parseargs(argc, argv, &config);
+
+    out = fdopen(dup(STDOUT_FILENO), "w");
+    if(NULL == out) ERROR("fdopen");
+    if(NULL == freopen("/dev/null", "w", stdout)) ERROR("freopen");
+    unsetenv(PAGER_VAR);
+
+    fprintf(out, "bench=config depth=%d fanout=%d files_per_dir=%d names=%d-%d size_max=%lu seed=%lu threads=%d\n",
+            config.depth, config.fanout, config.files, config.name_min, config.name_max,
+            config.size_max, config.seed, config.threads);
+
+    if(mkdir(config.path_d, 0755) == 0)
+    {
+        int root_fd = open(config.path_d, O_RDONLY | O_DIRECTORY);
+        if(root_fd < 0) ERROR("open");
+
+        bench_tree_t tree = {0};
+        uint64_t state = config.seed * 0x9e3779b97f4a7c15ULL + 1;
+        double start = bench_now();
+        bench_generate_dir(&config, root_fd, 0, &state, &tree);
+        double elapsed = bench_now() - start;
+        if(close(root_fd)) ERROR("close");
+
+        fprintf(out, "bench=generate dirs=%lu files=%lu bytes=%lu seconds=%.3f\n", tree.dirs, tree.files, tree.bytes, elapsed);
+    }
+    else if(errno != EEXIST) ERROR("mkdir");
+    else fprintf(out, "bench=generate reused=%s\n", config.path_d);
+    fflush(out);
+
+    pthread_mutex_t publish_mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t indexing_done = PTHREAD_COND_INITIALIZER;
+    pthread_mutex_t indexing_mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_t force_exit_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+    mole_context_t context;
+    context.path_d = config.path_d;
+    context.path_f = config.path_f;
+    context.path_s = NULL;
+    context.time = -1;
+    context.threads = config.threads;
+    context.incremental = false;
+    context.watch = false;
+    context.memory_limit = 0;
+    context.publish_mutex = &publish_mutex;
+    context.persister = NULL;
+    context.indexing_pending = false;
+    context.indexing_done = &indexing_done;
+    context.indexing_mutex = &indexing_mutex;
+    context.force_exit = false;
+    context.force_exit_mutex = &force_exit_mutex;
+
+    mole_index_t index;
+    index_init(&index);
+    snapshot_init(&context, &index);
+
+    bench_index(&config, &context);
+    fflush(out);
+    bench_cache(&config, &context);
+    fflush(out);
+    bench_queries(&config, &context);
+
+    snapshot_destroy(&context);
+    fclose(out);
+
+    return EXIT_SUCCESS;
+}
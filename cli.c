@@ -1,9 +1,11 @@
 #include <pthread.h>
+#include <sys/stat.h>
 
 #include "cli.h"
 #include "indexer.h"
+#include "stats.h"
 
-void cli_start(mole_context_t* context)
+void cli_start(mole_roots_t* roots)
 {
     char command[COMMAND_MAX];
     char argument[STR_MAX];
@@ -13,53 +15,122 @@ void cli_start(mole_context_t* context)
         cli_prompt(command, argument);
 
         // printf("CMD: %s\t ARG: %s\n", command, arg);
+        cli_page_t page;
+        cli_parse_page(argument, &page);
+        const char* scope = cli_parse_scope(argument);
         bool arg_present = strlen(argument) > 0;
 
+        // Latency of queries is recorded (see `cli_stats()`), other commands are not measured.
+        int histogram = -1;
+        uint64_t start = stats_now();
+
         switch(cli_hash(command))
         {
             case HELP:
                 cli_help();
                 break;
             case EXIT_FORCE:
-                pthread_mutex_lock(context->force_exit_mutex);
-                context->force_exit = true;
-                pthread_mutex_unlock(context->force_exit_mutex);
+                for(size_t i = 0; i < roots->count; ++i)
+                {
+                    mole_context_t* context = &roots->contexts[i];
+                    pthread_mutex_lock(context->force_exit_mutex);
+                    context->force_exit = true;
+                    pthread_mutex_unlock(context->force_exit_mutex);
+                }
             case EXIT:
                 printf("Exiting...\n");
-                pthread_mutex_lock(context->indexing_mutex);
-                while(context->indexing_pending)
-                    pthread_cond_wait(context->indexing_done, context->indexing_mutex);
-                pthread_mutex_unlock(context->indexing_mutex);
+                for(size_t i = 0; i < roots->count; ++i)
+                {
+                    mole_context_t* context = &roots->contexts[i];
+                    pthread_mutex_lock(context->indexing_mutex);
+                    while(context->indexing_pending)
+                        pthread_cond_wait(context->indexing_done, context->indexing_mutex);
+                    pthread_mutex_unlock(context->indexing_mutex);
+                }
                 printf("Goodbye!\n");
                 return;
             case INDEX:
-                cli_index(context);
+                cli_index(roots);
                 break;
             case COUNT:
-                cli_count(context);
+                cli_count(roots, scope);
+                histogram = Stat_Count_Time;
                 break;
             case LARGER_THAN:
                 if(!arg_present)
                     cli_missing_param(command);
                 else
-                    cli_largerthan(context, atoll(argument));
+                    cli_largerthan(roots, atoll(argument), scope, &page);
+                histogram = Stat_Larger_Time;
+                break;
+            case SMALLER_THAN:
+                if(!arg_present)
+                    cli_missing_param(command);
+                else
+                    cli_smallerthan(roots, atoll(argument), scope, &page);
+                histogram = Stat_Smaller_Time;
                 break;
+            case BETWEEN:
+            {
+                unsigned long long min_size, max_size;
+                if(sscanf(argument, "%llu %llu", &min_size, &max_size) != 2)
+                    cli_missing_param(command);
+                else
+                    cli_between(roots, min_size, max_size, scope, &page);
+                histogram = Stat_Between_Time;
+                break;
+            }
             case NAME_PART:
                 if(!arg_present)
                     cli_missing_param(command);
                 else
-                    cli_namepart(context, argument);
+                    cli_namepart(roots, argument, scope, &page);
+                histogram = Stat_Namepart_Time;
                 break;
             case OWNER:
                 if(!arg_present)
                     cli_missing_param(command);
                 else
-                    cli_owner(context, atoi(argument));
+                    cli_owner(roots, atoi(argument), scope, &page);
+                histogram = Stat_Owner_Time;
+                break;
+            case USAGE:
+                cli_usage(roots, !arg_present, atoi(argument), scope);
+                histogram = Stat_Usage_Time;
+                break;
+            case STATS:
+                cli_stats();
+                break;
+            case FIND:
+                if(!arg_present)
+                    cli_missing_param(command);
+                else
+                    cli_find(roots, argument, scope, &page);
+                histogram = Stat_Find_Time;
+                break;
+            case EXPLAIN:
+                if(!arg_present)
+                    cli_missing_param(command);
+                else
+                    cli_explain(roots, argument, scope);
+                break;
+            case TOP:
+                if(!arg_present)
+                    cli_missing_param(command);
+                else
+                    cli_top(roots, strtoull(argument, NULL, 10), scope);
+                histogram = Stat_Top_Time;
+                break;
+            case DU:
+                cli_du(roots, arg_present ? strtoull(argument, NULL, 10) : CLI_DU_DEFAULT, scope);
+                histogram = Stat_Du_Time;
                 break;
             default:
                 cli_unrecognized_cmd(command);
                 continue;
         }
+
+        if(histogram >= 0) stats_record(histogram, start);
     }
 }
 
@@ -72,10 +143,97 @@ void cli_prompt(char* command, char* arg)
 
     printf("> "); fflush(stdin);
     fgets(line, STR_MAX, stdin);
-    if(sscanf(line, " %15s %255[._-0-9a-zA-Z ]", command, arg) == EOF)
+    if(sscanf(line, " %15s %255[/._-0-9a-zA-Z ()<>=]", command, arg) == EOF)
         ERROR("scanf");
 }
 
+void cli_parse_page(char* argument, cli_page_t* page)
+{
+    page->offset = 0;
+    page->limit = UINT64_MAX;
+
+    for(;;)
+    {
+        // Last two words of the argument are checked.
+        size_t length = strlen(argument);
+        while(length > 0 && argument[length - 1] == ' ') argument[--length] = '\0';
+
+        char* value = strrchr(argument, ' ');
+        if(NULL == value) return;
+        char* option = value;
+        while(option > argument && option[-1] == ' ') option--;
+        while(option > argument && option[-1] != ' ') option--;
+
+        char* end;
+        unsigned long long number = strtoull(value + 1, &end, 10);
+        if(*end != '\0' || end == value + 1) return;
+
+        size_t option_length = value - option;
+        while(option_length > 0 && option[option_length - 1] == ' ') option_length--;
+        if(option_length == 5 && strncmp(option, "limit", 5) == 0)
+            page->limit = number;
+        else if(option_length == 6 && strncmp(option, "offset", 6) == 0)
+            page->offset = number;
+        else
+            return;
+
+        *option = '\0';
+    }
+}
+
+// Returns path following `in` keyword at `keyword`, if it is an existing directory (or NULL).
+static char* cli_scope_path(char* argument, char* keyword)
+{
+    char* path = keyword + (keyword == argument ? 3 : 4);
+    while(*path == ' ') path++;
+
+    struct stat path_stat;
+    if(*path == '\0' || stat(path, &path_stat) || !S_ISDIR(path_stat.st_mode)) return NULL;
+    return path;
+}
+
+const char* cli_parse_scope(char* argument)
+{
+    // The last `in` followed by a directory is taken, so that e.g. `namepart rock in roll`
+    // still searches for the whole string. Argument of commands without other arguments begins with `in`.
+    char* keyword = NULL;
+    char* path = NULL;
+    for(char* found = argument; NULL != (found = strstr(found, " in ")); ++found)
+    {
+        char* found_path = cli_scope_path(argument, found);
+        if(NULL != found_path)
+        {
+            keyword = found;
+            path = found_path;
+        }
+    }
+    if(NULL == keyword && strncmp(argument, "in ", 3) == 0 && NULL != (path = cli_scope_path(argument, argument)))
+        keyword = argument;
+    if(NULL == keyword) return NULL;
+
+    while(keyword > argument && keyword[-1] == ' ') keyword--;
+    *keyword = '\0';
+    return path;
+}
+
+bool cli_query_begin(mole_roots_query_t* query, mole_roots_t* roots, const char* path)
+{
+    if(NULL == path) return roots_query_begin(query, roots, NULL);
+
+    // Paths in the index are absolute and without symbolic links. Path that doesn't exist
+    // anymore may still be in the index, so it is looked up as it is.
+    char real_path[PATH_MAX];
+    if(NULL == realpath(path, real_path))
+    {
+        if(strlen(path) >= PATH_MAX) return false;
+        strcpy(real_path, path);
+    }
+
+    if(roots_query_begin(query, roots, real_path)) return true;
+    fprintf(stderr, "Path `%s` is not in the index.\n", path);
+    return false;
+}
+
 void cli_unrecognized_cmd(const char* command)
 {
     fprintf(stderr, "Unrecognized command: `%s`. Type `help` to see list of available commands.\n", command);
@@ -94,162 +252,481 @@ void cli_help()
     printf("                   \ttasks in progress, waits for them to finish.\n");
     printf("  exit!            \tForces program to quit. Background tasks are interrupted,\n");
     printf("                   \tbut saving the index into a file is guaranteed to complete.\n");
-    printf("  index            \tStarts background indexing of specified directory (if it\n");
-    printf("                   \tis not already being performed).\n");
+    printf("  index            \tStarts background indexing of specified directories (those\n");
+    printf("                   \tthat are not already being indexed).\n");
     printf("  count            \tPrepares summary of how many files of each type are there\n");
     printf("                   \tin the index.\n");
     printf("  largerthan <size>\tPrints all files in the index that are larger than <size> bytes.\n");
+    printf("  smallerthan <size>\tPrints all files in the index that are smaller than <size> bytes.\n");
+    printf("  between <min> <max>\tPrints all files in the index, whose size is at least <min>\n");
+    printf("                   \tand at most <max> bytes.\n");
     printf("  namepart <string>\tPrints all files in the index that contain <string> inside their name.\n");
     printf("  owner <uid>      \tPrints all files in the index whose owner is user with id <uid>.\n");
+    printf("  usage [uid]      \tPrints number and total size of files of each type owned by user\n");
+    printf("                   \twith id <uid> (or by every user, if <uid> is not specified).\n");
+    printf("  stats            \tPrints counters and latency of indexing, saving and queries.\n");
+    printf("  find <query>     \tPrints all files in the index matching <query>, which combines\n");
+    printf("                   \tpredicates `name <string>`, `size <op> <n>[k|M|G|T]` (<op> is\n");
+    printf("                   \tone of < <= > >= =), `owner <uid>`, `type <letter>` and\n");
+    printf("                   \t`path <dir>` with `and`, `or`, `not` and parentheses.\n");
+    printf("  explain <query>  \tPrints how `find <query>` would search every directory.\n");
+    printf("  top <k>          \tPrints <k> largest files in the index (directories excluded).\n");
+    printf("  du [k]           \tPrints %d (or <k>) directories with the largest total size\n", CLI_DU_DEFAULT);
+    printf("                   \tof files inside of them.\n");
+    printf("Commands printing files accept optional `limit <n>` and `offset <n>` at the end,\n");
+    printf("which print at most <n> files or skip the first <n> files found.\n");
+    printf("Queries accept optional `in <path>` (before `limit` and `offset`), which limits\n");
+    printf("them to files inside directory <path>. It is recognized only if <path> is an existing\n");
+    printf("directory, otherwise ` in ` is part of the query (e.g. `namepart rock in roll`).\n");
 }
 
-void cli_index(mole_context_t* context)
+void cli_index(mole_roots_t* roots)
 {
-    pthread_mutex_lock(context->indexing_mutex);
-    if(context->indexing_pending)
+    // Roots, whose indexing is not pending, are indexed again.
+    size_t started = 0;
+    for(size_t i = 0; i < roots->count; ++i)
     {
-        printf("Indexing is already pending!\n");
+        mole_context_t* context = &roots->contexts[i];
+        pthread_mutex_lock(context->indexing_mutex);
+        bool pending = context->indexing_pending;
         pthread_mutex_unlock(context->indexing_mutex);
-        return;
+        if(pending) continue;
+
+        if(started++ == 0) printf("Starting indexing process...\n");
+        indexer_start_worker(context);
     }
-    pthread_mutex_unlock(context->indexing_mutex);
 
-    printf("Starting indexing process...\n");
-    indexer_start_worker(context);
+    if(started == 0) printf("Indexing is already pending!\n");
 }
 
-void cli_count(mole_context_t* context)
+void cli_count(mole_roots_t* roots, const char* scope_path)
 {
     printf("Counting files...\n");
 
-    size_t directories = 0, jpegs = 0, pngs = 0, gzips = 0, zips = 0;
-    pthread_mutex_lock(context->index_mutex);
-    for(size_t i = 0; i < context->index->size; ++i)
-    {
-        switch(context->index->elements[i].file_type)
-        {
-            case Directory: directories++; break;
-            case Image_JPEG: jpegs++; break;
-            case Image_PNG: pngs++; break;
-            case Compressed_GZIP: gzips++; break;
-            case Compressed_ZIP: zips++; break;
-            default: break;
-        }
-    }
-    pthread_mutex_unlock(context->index_mutex);
+    uint64_t counts[FILE_TYPE_COUNT] = {0};
+    mole_roots_query_t query;
+    if(!cli_query_begin(&query, roots, scope_path)) return;
+
+    roots_query_count_types(&query, counts);
+    roots_query_end(&query);
 
     printf("Done!\n");
 
     printf("File Count Summary:\n");
-    printf("  Directories: %ld\n", directories);
-    printf("  JPEG Images: %ld\n", jpegs);
-    printf("  PNG Images: %ld\n", pngs);
-    printf("  GZIP Compressed Files: %ld\n", gzips);
-    printf("  ZIP Compressed Files: %ld\n", zips);
+#define X(type, letter, description, summary_name) printf("  " summary_name ": %ld\n", counts[type]);
+    MOLE_FILE_TYPES(X)
+#undef X
 }
 
-void cli_largerthan(mole_context_t* context, size_t size)
+void cli_largerthan(mole_roots_t* roots, size_t size, const char* scope, const cli_page_t* page)
 {
     printf("Looking for files larger than %ld bytes...\n", size);
 
-    mole_index_t result;
-    index_init(&result);
+    if(size == UINT64_MAX)
+        cli_print_size_range(roots, 1, 0, scope, page);
+    else
+        cli_print_size_range(roots, size + 1, UINT64_MAX, scope, page);
+}
+
+void cli_smallerthan(mole_roots_t* roots, size_t size, const char* scope, const cli_page_t* page)
+{
+    printf("Looking for files smaller than %ld bytes...\n", size);
+
+    if(size == 0)
+        cli_print_size_range(roots, 1, 0, scope, page);
+    else
+        cli_print_size_range(roots, 0, size - 1, scope, page);
+}
+
+void cli_between(mole_roots_t* roots, size_t min_size, size_t max_size, const char* scope, const cli_page_t* page)
+{
+    printf("Looking for files with size between %ld and %ld bytes...\n", min_size, max_size);
+
+    cli_print_size_range(roots, min_size, max_size, scope, page);
+}
+
+void cli_stats()
+{
+    printf("Statistics since the program started:\n");
+    stats_print(stdout);
+}
+
+void cli_find(mole_roots_t* roots, const char* text, const char* scope_path, const cli_page_t* page)
+{
+    printf("Looking for files matching the query...\n");
 
-    pthread_mutex_lock(context->index_mutex);
-    for(size_t i = 0; i < context->index->size; ++i)
+    mole_query_t* expression = malloc(sizeof(mole_query_t));
+    if(NULL == expression) ERROR("malloc");
+
+    mole_roots_query_t query;
+    if(query_parse(expression, text))
     {
-        if(context->index->elements[i].size > size)
-            index_insert(&result, &context->index->elements[i]);
+        if(cli_query_begin(&query, roots, scope_path))
+        {
+            roots_query_find(&query, expression);
+            printf("Done!\n");
+            cli_print_query(&query, page);
+            roots_query_end(&query);
+        }
+        query_free(expression);
     }
-    pthread_mutex_unlock(context->index_mutex);
 
+    free(expression);
+}
+
+void cli_explain(mole_roots_t* roots, const char* text, const char* scope_path)
+{
+    mole_query_t* expression = malloc(sizeof(mole_query_t));
+    if(NULL == expression) ERROR("malloc");
+
+    mole_roots_query_t query;
+    if(query_parse(expression, text))
+    {
+        if(cli_query_begin(&query, roots, scope_path))
+        {
+            roots_query_find(&query, expression);
+            for(size_t i = 0; i < query.count; ++i)
+            {
+                char description[STR_MAX + 64];
+                query_describe(&query.plans[i], description, sizeof(description));
+                printf("%s: %s (about %lu candidates)\n", query.contexts[i]->path_d, description, query.plans[i].cost);
+            }
+            roots_query_end(&query);
+        }
+        query_free(expression);
+    }
+
+    free(expression);
+}
+
+void cli_top(mole_roots_t* roots, size_t k, const char* scope_path)
+{
+    printf("Looking for %lu largest files...\n", k);
+
+    mole_roots_query_t query;
+    if(!cli_query_begin(&query, roots, scope_path)) return;
+
+    size_t count;
+    mole_ranked_t* ranked = roots_query_top(&query, k, &count);
+    printf("Done!\n");
+    cli_print_ranked(ranked, count);
+    free(ranked);
+    roots_query_end(&query);
+}
+
+void cli_du(mole_roots_t* roots, size_t k, const char* scope_path)
+{
+    printf("Looking for %lu largest directories...\n", k);
+
+    mole_roots_query_t query;
+    if(!cli_query_begin(&query, roots, scope_path)) return;
+
+    size_t count;
+    mole_ranked_t* ranked = roots_query_du(&query, k, &count);
     printf("Done!\n");
-    cli_print_index(&result);
+    cli_print_ranked(ranked, count);
+    free(ranked);
+    roots_query_end(&query);
+}
+
+void cli_print_size_range(mole_roots_t* roots, uint64_t min_size, uint64_t max_size,
+                          const char* scope_path, const cli_page_t* page)
+{
+    mole_roots_query_t query;
+    if(!cli_query_begin(&query, roots, scope_path)) return;
 
-    index_free(&result);
+    roots_query_size_range(&query, min_size, max_size);
+    printf("Done!\n");
+    cli_print_query(&query, page);
+    roots_query_end(&query);
 }
 
-void cli_namepart(mole_context_t* context, const char* string)
+void cli_namepart(mole_roots_t* roots, const char* string, const char* scope_path, const cli_page_t* page)
 {
     printf("Looking for files whose names contain \"%s\"...\n", string);
 
-    mole_index_t result;
-    index_init(&result);
+    mole_roots_query_t query;
+    if(!cli_query_begin(&query, roots, scope_path)) return;
+
+    roots_query_name_part(&query, string);
+    printf("Done!\n");
+    cli_print_query(&query, page);
+    roots_query_end(&query);
+}
+
+void cli_owner(mole_roots_t* roots, uid_t uid, const char* scope_path, const cli_page_t* page)
+{
+    printf("Looking for files of user with id %d...\n", uid);
+
+    mole_roots_query_t query;
+    if(!cli_query_begin(&query, roots, scope_path)) return;
+
+    roots_query_owner(&query, uid);
+    printf("Done!\n");
+    cli_print_query(&query, page);
+    roots_query_end(&query);
+}
 
-    pthread_mutex_lock(context->index_mutex);
-    for(size_t i = 0; i < context->index->size; ++i)
+// Number and total size of files of every type for every owner, merged from all roots.
+typedef struct cli_usage_summary
+{
+    size_t owner_count;     // Number of owners
+    size_t capacity;        // Number of owners that fit into arrays
+    uint32_t* uids;         // Ids of owners (sorted)
+    uint64_t* counts;       // Numbers of files (FILE_TYPE_COUNT elements per owner)
+    uint64_t* bytes;        // Total sizes of files (FILE_TYPE_COUNT elements per owner)
+} cli_usage_summary_t;
+
+// Returns position of owner `uid` in the summary, adding it if it is not there yet.
+static size_t cli_usage_slot(cli_usage_summary_t* summary, uint32_t uid)
+{
+    size_t low = 0, high = summary->owner_count;
+    while(low < high)
     {
-        if(strstr(context->index->elements[i].file_name, string) != NULL)
-            index_insert(&result, &context->index->elements[i]);
+        size_t middle = low + (high - low) / 2;
+        if(summary->uids[middle] < uid) low = middle + 1;
+        else high = middle;
     }
-    pthread_mutex_unlock(context->index_mutex);
+    if(low < summary->owner_count && summary->uids[low] == uid) return low;
 
-    printf("Done!\n");
-    cli_print_index(&result);
+    if(summary->owner_count == summary->capacity)
+    {
+        summary->capacity = summary->capacity == 0 ? 16 : 2 * summary->capacity;
+        summary->uids = realloc(summary->uids, summary->capacity * sizeof(uint32_t));
+        summary->counts = realloc(summary->counts, summary->capacity * FILE_TYPE_COUNT * sizeof(uint64_t));
+        summary->bytes = realloc(summary->bytes, summary->capacity * FILE_TYPE_COUNT * sizeof(uint64_t));
+        if(NULL == summary->uids || NULL == summary->counts || NULL == summary->bytes) ERROR("realloc");
+    }
 
-    index_free(&result);
+    size_t moved = summary->owner_count - low;
+    memmove(summary->uids + low + 1, summary->uids + low, moved * sizeof(uint32_t));
+    memmove(summary->counts + (low + 1) * FILE_TYPE_COUNT, summary->counts + low * FILE_TYPE_COUNT,
+            moved * FILE_TYPE_COUNT * sizeof(uint64_t));
+    memmove(summary->bytes + (low + 1) * FILE_TYPE_COUNT, summary->bytes + low * FILE_TYPE_COUNT,
+            moved * FILE_TYPE_COUNT * sizeof(uint64_t));
+    summary->owner_count++;
+
+    summary->uids[low] = uid;
+    memset(summary->counts + low * FILE_TYPE_COUNT, 0, FILE_TYPE_COUNT * sizeof(uint64_t));
+    memset(summary->bytes + low * FILE_TYPE_COUNT, 0, FILE_TYPE_COUNT * sizeof(uint64_t));
+    return low;
 }
 
-void cli_owner(mole_context_t* context, uid_t uid)
+void cli_usage(mole_roots_t* roots, bool all_users, uid_t uid, const char* scope_path)
 {
-    printf("Looking for files of user with id %d...\n", uid);
+    if(all_users)
+        printf("Summarizing files of all users...\n");
+    else
+        printf("Summarizing files of user with id %d...\n", uid);
 
-    mole_index_t result;
-    index_init(&result);
+    mole_roots_query_t query;
+    if(!cli_query_begin(&query, roots, scope_path)) return;
 
-    pthread_mutex_lock(context->index_mutex);
-    for(size_t i = 0; i < context->index->size; ++i)
+    cli_usage_summary_t summary = { .owner_count = 0, .capacity = 0, .uids = NULL, .counts = NULL, .bytes = NULL };
+    for(size_t r = 0; r < query.count; ++r)
     {
-        if(context->index->elements[i].owner_uid == uid)
-            index_insert(&result, &context->index->elements[i]);
+        const mole_index_t* index = &query.snapshots[r]->index;
+        const mole_owners_t* owners = &index->owners;
+        const mole_scope_t* scope = &query.scopes[r];
+
+        // Summaries are precomputed, only entries not covered by them have to be added.
+        // Summaries of a subtree are computed from its entries instead.
+        bool scoped = scope->id != MOLE_NO_ENTRY;
+        uint64_t ranges[2][2] = {
+            { scoped ? scope->begin : owners->indexed, scoped ? scope->end : index->size },
+            { scope->tail > scope->end ? scope->tail : scope->end, index->size }
+        };
+
+        for(size_t k = 0; k < owners->owner_count && !scoped; ++k)
+        {
+            size_t slot = cli_usage_slot(&summary, owners->uids[k]);
+            for(int type = 0; type < FILE_TYPE_COUNT; ++type)
+            {
+                summary.counts[slot * FILE_TYPE_COUNT + type] += owners->counts[k * FILE_TYPE_COUNT + type];
+                summary.bytes[slot * FILE_TYPE_COUNT + type] += owners->bytes[k * FILE_TYPE_COUNT + type];
+            }
+        }
+
+        for(size_t i = 0; i < 2; ++i)
+        {
+            for(size_t id = ranges[i][0]; id < ranges[i][1]; ++id)
+            {
+                uint8_t file_type = index->file_types[id];
+                if(file_type == Removed || (id >= scope->end && !scope_contains(scope, index, id))) continue;
+
+                size_t slot = cli_usage_slot(&summary, index->owner_uids[id]);
+                summary.counts[slot * FILE_TYPE_COUNT + file_type]++;
+                summary.bytes[slot * FILE_TYPE_COUNT + file_type] += index->sizes[id];
+            }
+        }
     }
-    pthread_mutex_unlock(context->index_mutex);
+    roots_query_end(&query);
 
     printf("Done!\n");
-    cli_print_index(&result);
 
-    index_free(&result);
+    printf("UID\tType\t\t\tFiles\t\tBytes\n");
+    for(size_t k = 0; k < summary.owner_count; ++k)
+    {
+        if(!all_users && summary.uids[k] != uid) continue;
+
+        for(int type = Directory; type < Removed; ++type)
+        {
+            uint64_t count = summary.counts[k * FILE_TYPE_COUNT + type];
+            if(count > 0)
+                printf("%u\t%-24s%lu\t\t%lu\n", summary.uids[k], cli_get_type_name(type), count,
+                       summary.bytes[k * FILE_TYPE_COUNT + type]);
+        }
+    }
+
+    free(summary.uids);
+    free(summary.counts);
+    free(summary.bytes);
 }
 
-void cli_print_index(const mole_index_t* index)
+// Lines of results are gathered in a buffer and written in bulk.
+typedef struct cli_writer
 {
-    FILE* stream = stdout;
+    FILE* stream;                           // Stream the lines are written to
+    size_t used;                            // Number of bytes in the buffer
+    char buffer[CLI_WRITE_BUFFER_SIZE];     // Buffered lines
+    mole_path_builder_t paths;              // Paths of printed entries
+} cli_writer_t;
+
+static void cli_writer_flush(cli_writer_t* writer)
+{
+    if(writer->used > 0 && fwrite(writer->buffer, 1, writer->used, writer->stream) != writer->used)
+        ERROR("fwrite");
+    writer->used = 0;
+}
+
+static void cli_writer_write(cli_writer_t* writer, const char* data, size_t length)
+{
+    if(writer->used + length > CLI_WRITE_BUFFER_SIZE) cli_writer_flush(writer);
+    if(length > CLI_WRITE_BUFFER_SIZE)
+    {
+        if(fwrite(data, 1, length, writer->stream) != length) ERROR("fwrite");
+        return;
+    }
+
+    memcpy(writer->buffer + writer->used, data, length);
+    writer->used += length;
+}
 
-    if(index->size > 3)
+// Writes line describing entry `id` of `index`, with size `size`.
+static void cli_writer_entry(cli_writer_t* writer, const mole_index_t* index, uint64_t id, uint64_t size)
+{
+    char prefix[32];
+    int length = snprintf(prefix, sizeof(prefix), "%c\t%ld\t\t", cli_get_type_letter(index->file_types[id]), size);
+    cli_writer_write(writer, prefix, length);
+
+    size_t path_length;
+    const char* path = path_builder_path(&writer->paths, index, &index->elements[id], &path_length);
+    cli_writer_write(writer, path, path_length);
+    cli_writer_write(writer, "\n", 1);
+}
+
+// Prints header of results and prepares writer of their lines. Results are piped into pager
+// if there are `many` of them (more than three).
+static cli_writer_t* cli_writer_open(bool many)
+{
+    FILE* stream = stdout;
+    if(many)
     {
         const char* pager = getenv(PAGER_VAR);
         if(NULL != pager) stream = popen(pager, "w");
         if(NULL == stream) ERROR("popen");
     }
 
-    fprintf(stream, "Types: d - Directory, j - JPEG image, p - PNG image\n");
-    fprintf(stream, "       g - compressed GZIP file, z - compressed ZIP file\n\n");
+    cli_print_type_legend(stream);
     fprintf(stream, "Type\tSize\t\tPath\n");
-    for(size_t i = 0; i < index->size; ++i)
-    {
-        char type_letter = cli_get_type_letter(index->elements[i].file_type);
-        fprintf(stream, "%c\t%ld\t\t%s\n", type_letter, index->elements[i].size, index->elements[i].full_path);
-    }
 
-    fprintf(stream, "\n");
+    cli_writer_t* writer = malloc(sizeof(cli_writer_t));
+    if(NULL == writer) ERROR("malloc");
+    writer->stream = stream;
+    writer->used = 0;
+    path_builder_init(&writer->paths);
+    return writer;
+}
+
+// Ends results with a blank line and frees the writer.
+static void cli_writer_close(cli_writer_t* writer)
+{
+    FILE* stream = writer->stream;
+    cli_writer_write(writer, "\n", 1);
+    cli_writer_flush(writer);
+    free(writer);
 
     if(stdout != stream)
         if(pclose(stream) != 0) ERROR("pclose");
 }
 
+void cli_print_query(mole_roots_query_t* query, const cli_page_t* page)
+{
+    uint64_t offset = NULL == page ? 0 : page->offset;
+    uint64_t limit = NULL == page ? UINT64_MAX : page->limit;
+
+    const mole_index_t* index;
+    uint64_t id;
+    for(uint64_t i = 0; i < offset && roots_query_next(query, &index, &id); ++i);
+
+    // Pager is used for more than three results, so that many are looked up in advance.
+    const mole_index_t* lookahead_indexes[4];
+    uint64_t lookahead[4];
+    size_t lookahead_count = 0;
+    while(lookahead_count < 4 && lookahead_count < limit
+          && roots_query_next(query, &lookahead_indexes[lookahead_count], &lookahead[lookahead_count]))
+        lookahead_count++;
+
+    cli_writer_t* writer = cli_writer_open(lookahead_count > 3);
+    for(size_t i = 0; i < lookahead_count; ++i)
+        cli_writer_entry(writer, lookahead_indexes[i], lookahead[i], lookahead_indexes[i]->sizes[lookahead[i]]);
+    for(uint64_t printed = lookahead_count; printed < limit && roots_query_next(query, &index, &id); ++printed)
+        cli_writer_entry(writer, index, id, index->sizes[id]);
+    cli_writer_close(writer);
+}
+
+void cli_print_ranked(const mole_ranked_t* ranked, size_t count)
+{
+    cli_writer_t* writer = cli_writer_open(count > 3);
+    for(size_t i = 0; i < count; ++i)
+        cli_writer_entry(writer, ranked[i].index, ranked[i].id, ranked[i].size);
+    cli_writer_close(writer);
+}
+
+void cli_print_type_legend(FILE* stream)
+{
+    int printed = 0;
+#define X(type, letter, description, summary_name) \
+    fprintf(stream, printed == 0 ? "Types: " : printed % 3 == 0 ? "\n       " : ", "); \
+    fprintf(stream, "%c - %s", letter, description); \
+    printed++;
+    MOLE_FILE_TYPES(X)
+#undef X
+    fprintf(stream, "\n\n");
+}
+
 char cli_get_type_letter(file_type_t type)
 {
     switch(type)
     {
-        case Directory: return 'd';
-        case Image_JPEG: return 'j';
-        case Image_PNG: return 'p';
-        case Compressed_GZIP: return 'g';
-        case Compressed_ZIP: return 'z';
+#define X(type, letter, description, summary_name) case type: return letter;
+        MOLE_FILE_TYPES(X)
+#undef X
         default: return '-';
     }
 }
 
+const char* cli_get_type_name(file_type_t type)
+{
+    switch(type)
+    {
+#define X(type, letter, description, summary_name) case type: return summary_name;
+        MOLE_FILE_TYPES(X)
+#undef X
+        default: return "Unrecognized Files";
+    }
+}
+
 hash_t cli_hash(const char* string)
 {
     hash_t hash = 0;
@@ -2,9 +2,12 @@
 
 #include "common.h"
 #include "mole_index.h"
+#include "roots.h"
 
 #define COMMAND_MAX 16
 #define PAGER_VAR "PAGER"
+#define CLI_WRITE_BUFFER_SIZE (1 << 16)
+#define CLI_DU_DEFAULT 10
 
 // Precalculated hashes of available commands.
 #define HELP        0x00684d4018ed0681
@@ -13,35 +16,85 @@
 #define INDEX       0x67f07f670b83d132
 #define COUNT       0x620751b5aae871af
 #define LARGER_THAN 0x04ad3909ddf4b578
+#define SMALLER_THAN 0x375b8094025c46b5
+#define BETWEEN     0x47f45d8d55d8f7a8
 #define NAME_PART   0x6bce8a0f0036f21e
 #define OWNER       0x6de3b4974ab7fcf3
+#define USAGE       0x73c9e01521c22ae1
+#define STATS       0x71d226a7c87d40df
+#define FIND        0x00664bc9bdd9a379
+#define EXPLAIN     0xdf94042a6c344997
+#define TOP         0x00000074398e2235
+#define DU          0x0000000000641911
 
 typedef size_t hash_t;
 
+// Part of query results to print: `limit` matches after skipping the first `offset` ones.
+typedef struct cli_page
+{
+    uint64_t offset;            // Number of skipped matches
+    uint64_t limit;             // Maximal number of printed matches (UINT64_MAX if not limited)
+} cli_page_t;
+
 // Starts command line interface. Begins waiting for command input.
-void cli_start(mole_context_t* context);
+void cli_start(mole_roots_t* roots);
 
 // Prints command prompt and parses user input.
 void cli_prompt(char* command, char* arg);
 
+// Removes trailing `limit <n>` and `offset <n>` options from `argument`
+// and stores them in `page`.
+void cli_parse_page(char* argument, cli_page_t* page);
+
+// Removes trailing `in <path>` from `argument` (after `limit` and `offset` were removed),
+// if <path> is an existing directory. Returns the path (part of `argument`) or NULL
+// if query is not limited to a directory.
+const char* cli_parse_scope(char* argument);
+
+// Begins query over roots limited to directory `path` (whole indexes if NULL). Prints error
+// message and returns false if the path is not in any index.
+bool cli_query_begin(mole_roots_query_t* query, mole_roots_t* roots, const char* path);
+
 // These functions print error messages:
 void cli_unrecognized_cmd(const char* command);
 void cli_missing_param(const char* command);
 
-// Handler functions for all CLI commands:
+// Handler functions for all CLI commands (queries are limited to directory `scope`, unless it is NULL):
 void cli_help();
-void cli_index(mole_context_t* context);
-void cli_count(mole_context_t* context);
-void cli_largerthan(mole_context_t* context, size_t size);
-void cli_namepart(mole_context_t* context, const char* string);
-void cli_owner(mole_context_t* context, uid_t uid);
+void cli_index(mole_roots_t* roots);
+void cli_count(mole_roots_t* roots, const char* scope);
+void cli_largerthan(mole_roots_t* roots, size_t size, const char* scope, const cli_page_t* page);
+void cli_smallerthan(mole_roots_t* roots, size_t size, const char* scope, const cli_page_t* page);
+void cli_between(mole_roots_t* roots, size_t min_size, size_t max_size, const char* scope, const cli_page_t* page);
+void cli_namepart(mole_roots_t* roots, const char* string, const char* scope, const cli_page_t* page);
+void cli_owner(mole_roots_t* roots, uid_t uid, const char* scope, const cli_page_t* page);
+void cli_usage(mole_roots_t* roots, bool all_users, uid_t uid, const char* scope);
+void cli_stats();
+void cli_find(mole_roots_t* roots, const char* expression, const char* scope, const cli_page_t* page);
+void cli_explain(mole_roots_t* roots, const char* expression, const char* scope);
+void cli_top(mole_roots_t* roots, size_t k, const char* scope);
+void cli_du(mole_roots_t* roots, size_t k, const char* scope);
 
-// Prints contents of index (full path, size, file type)
-void cli_print_index(const mole_index_t* index);
+// Prints all entries with size from range [`min_size`, `max_size`].
+void cli_print_size_range(mole_roots_t* roots, uint64_t min_size, uint64_t max_size,
+                          const char* scope, const cli_page_t* page);
+
+// Prints entries found by `query` (file type, size, full path), only those on `page`
+// (all if NULL). Results are streamed, so memory used doesn't depend on their number.
+void cli_print_query(mole_roots_query_t* query, const cli_page_t* page);
+
+// Prints ranked entries (file type, size they are ranked by, full path).
+void cli_print_ranked(const mole_ranked_t* ranked, size_t count);
+
+// Prints letters representing file types (three per line) followed by a blank line.
+void cli_print_type_legend(FILE* stream);
 
 // Helper function for getting letter representing file type to print.
 char cli_get_type_letter(file_type_t type);
 
+// Helper function for getting description of file type to print.
+const char* cli_get_type_name(file_type_t type);
+
 // Implementation of sdbm, simple string hashing algorithm.
 // It will do sufficiently for the purpose of matching commands.
 hash_t cli_hash(const char* string);
@@ -0,0 +1,241 @@
+#include "common.h"
+#include "mole_index.h"
+#include "protocol.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Sends a single query to mole running with `-l <socket>` and prints its result
+// in the same format as the command line interface does.
+
+void client_usage(char* name)
+{
+    fprintf(stderr, "Usage: %s -s <socket> <command> [arguments] [in <path>] [limit <n>] [offset <n>]\n", name);
+    fprintf(stderr, "Commands:\n");
+    fprintf(stderr, "  count            \tCounts files of every type.\n");
+    fprintf(stderr, "  largerthan <x>   \tPrints files larger than <x> bytes.\n");
+    fprintf(stderr, "  smallerthan <x>  \tPrints files smaller than <x> bytes.\n");
+    fprintf(stderr, "  between <x> <y>  \tPrints files with size between <x> and <y> bytes.\n");
+    fprintf(stderr, "  namepart <y>     \tPrints files whose names contain <y>.\n");
+    fprintf(stderr, "  owner <uid>      \tPrints files of user with id <uid>.\n");
+    fprintf(stderr, "  index            \tStarts indexing (if it is not pending already).\n");
+    fprintf(stderr, "Queries followed by `in <path>` are limited to files inside directory <path>.\n");
+    exit(EXIT_FAILURE);
+}
+
+int client_connect(const char* path)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "Socket path `%s` is too long.\n", path);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0) ERROR("socket");
+    if(connect(fd, (struct sockaddr*) &address, sizeof(address)))
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    return fd;
+}
+
+void client_read(int fd, void* buffer, size_t count)
+{
+    if(bulk_read(fd, buffer, count) != (ssize_t) count)
+    {
+        fprintf(stderr, "Connection to server was lost.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Builds request from command line. Trailing `limit <n>` and `offset <n>` select the page,
+// `in <path>` limits the query to a directory (its path is stored in `scope`, PATH_MAX bytes).
+void client_parse(int argc, char** argv, protocol_request_t* request, const char** string, char* scope)
+{
+    memset(request, 0, sizeof(*request));
+    request->magic = PROTOCOL_MAGIC;
+    request->limit = UINT64_MAX;
+    *string = "";
+    scope[0] = '\0';
+
+    const char* command = argv[optind];
+    char* arguments[2];
+    int argument_count = 0;
+    for(int i = optind + 1; i < argc; ++i)
+    {
+        bool limit = strcmp(argv[i], "limit") == 0, offset = strcmp(argv[i], "offset") == 0;
+        if((limit || offset) && i + 1 < argc)
+        {
+            *(limit ? &request->limit : &request->offset) = strtoull(argv[++i], NULL, 10);
+            continue;
+        }
+        if(strcmp(argv[i], "in") == 0 && i + 1 < argc)
+        {
+            // Server compares paths without symbolic links, relative path is resolved here.
+            const char* path = argv[++i];
+            if(NULL == realpath(path, scope) && snprintf(scope, PATH_MAX, "%s", path) >= PATH_MAX) client_usage(argv[0]);
+            if(strlen(scope) > PROTOCOL_SCOPE_MAX) client_usage(argv[0]);
+            request->scope_length = strlen(scope);
+            continue;
+        }
+        if(argument_count == 2) client_usage(argv[0]);
+        arguments[argument_count++] = argv[i];
+    }
+
+    // Every command is listed with number of arguments it takes.
+    static const struct { const char* name; protocol_command_t command; int arguments; } commands[] =
+    {
+        { "count", Command_Count, 0 }, { "largerthan", Command_Size_Range, 1 },
+        { "smallerthan", Command_Size_Range, 1 }, { "between", Command_Size_Range, 2 },
+        { "namepart", Command_Name_Part, 1 }, { "owner", Command_Owner, 1 }, { "index", Command_Index, 0 }
+    };
+    size_t k = 0;
+    while(k < sizeof(commands) / sizeof(commands[0]) && strcmp(commands[k].name, command) != 0) k++;
+    if(k == sizeof(commands) / sizeof(commands[0]) || commands[k].arguments != argument_count) client_usage(argv[0]);
+    request->command = commands[k].command;
+
+    uint64_t first = argument_count > 0 ? strtoull(arguments[0], NULL, 10) : 0;
+    if(strcmp(command, "largerthan") == 0)
+    {
+        request->arguments[0] = first == UINT64_MAX ? 1 : first + 1;
+        request->arguments[1] = first == UINT64_MAX ? 0 : UINT64_MAX;
+    }
+    else if(strcmp(command, "smallerthan") == 0)
+    {
+        request->arguments[0] = first == 0 ? 1 : 0;
+        request->arguments[1] = first == 0 ? 0 : first - 1;
+    }
+    else if(strcmp(command, "between") == 0)
+    {
+        request->arguments[0] = first;
+        request->arguments[1] = strtoull(arguments[1], NULL, 10);
+    }
+    else if(strcmp(command, "namepart") == 0)
+    {
+        if(strlen(arguments[0]) == 0 || strlen(arguments[0]) > PROTOCOL_STRING_MAX) client_usage(argv[0]);
+        request->string_length = strlen(arguments[0]);
+        *string = arguments[0];
+    }
+    else
+        request->arguments[0] = first;
+}
+
+char client_get_type_letter(uint8_t type)
+{
+    switch(type)
+    {
+#define X(type, letter, description, summary_name) case type: return letter;
+        MOLE_FILE_TYPES(X)
+#undef X
+        default: return '-';
+    }
+}
+
+void client_print_entries(int fd)
+{
+    char* path = NULL;
+    size_t capacity = 0;
+    printf("Type\tSize\t\tPath\n");
+
+    for(;;)
+    {
+        protocol_entry_t entry;
+        client_read(fd, &entry, sizeof(entry));
+        if(entry.last) break;
+
+        if(entry.path_length > capacity)
+        {
+            capacity = entry.path_length;
+            if(NULL == (path = realloc(path, capacity))) ERROR("realloc");
+        }
+        client_read(fd, path, entry.path_length);
+        printf("%c\t%ld\t\t%.*s\n", client_get_type_letter(entry.file_type), entry.size, (int) entry.path_length, path);
+    }
+
+    printf("\n");
+    free(path);
+}
+
+void client_print_counts(int fd, uint64_t count)
+{
+    uint64_t counts[FILE_TYPE_COUNT] = {0};
+    for(uint64_t i = 0; i < count; ++i)
+    {
+        uint64_t value;
+        client_read(fd, &value, sizeof(value));
+        if(i < FILE_TYPE_COUNT) counts[i] = value;
+    }
+
+    printf("File Count Summary:\n");
+#define X(type, letter, description, summary_name) printf("  " summary_name ": %ld\n", counts[type]);
+    MOLE_FILE_TYPES(X)
+#undef X
+}
+
+int main(int argc, char** argv)
+{
+    const char* path = NULL;
+
+    int opt;
+    opterr = 0;
+    while((opt = getopt(argc, argv, "hs:")) != -1)
+    {
+        switch(opt)
+        {
+            case 's':
+                path = optarg;
+                break;
+            default:
+                client_usage(argv[0]);
+                break;
+        }
+    }
+    if(NULL == path || optind >= argc) client_usage(argv[0]);
+
+    protocol_request_t request;
+    const char* string;
+    char scope[PATH_MAX];
+    client_parse(argc, argv, &request, &string, scope);
+
+    int fd = client_connect(path);
+    if(bulk_write(fd, &request, sizeof(request)) != (ssize_t) sizeof(request)) ERROR("write");
+    if(bulk_write(fd, string, request.string_length) != (ssize_t) request.string_length) ERROR("write");
+    if(bulk_write(fd, scope, request.scope_length) != (ssize_t) request.scope_length) ERROR("write");
+
+    protocol_response_t response;
+    client_read(fd, &response, sizeof(response));
+    if(response.magic != PROTOCOL_MAGIC || response.status == Status_Invalid_Request)
+    {
+        fprintf(stderr, "Server rejected the request.\n");
+        exit(EXIT_FAILURE);
+    }
+    if(response.status == Status_Scope_Not_Found)
+    {
+        fprintf(stderr, "Path `%s` is not in the index.\n", scope);
+        exit(EXIT_FAILURE);
+    }
+
+    switch(request.command)
+    {
+        case Command_Count:
+            client_print_counts(fd, response.count);
+            break;
+        case Command_Index:
+            printf(response.status == Status_Indexing_Pending ? "Indexing is already pending!\n"
+                                                              : "Starting indexing process...\n");
+            break;
+        default:
+            client_print_entries(fd);
+            break;
+    }
+
+    if(close(fd)) ERROR("close");
+    return EXIT_SUCCESS;
+}
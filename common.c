@@ -7,11 +7,60 @@ void usage(char* name)
     fprintf(stderr, "  -h          \tPrint this message.\n");
     fprintf(stderr, "  -d <path>   \tBrowse <path> directory. If not specified uses path\n");
     fprintf(stderr, "              \tin $MOLDE_DIR environment variable (required).\n");
+    fprintf(stderr, "              \tCan be repeated (up to 16 times) to index several directories\n");
+    fprintf(stderr, "              \tconcurrently, queries search all of them. Options -f and -t\n");
+    fprintf(stderr, "              \tapply to directory given by the preceding -d.\n");
     fprintf(stderr, "  -f <file>   \tRead/Write index cache from/into <file>. If not specified\n");
     fprintf(stderr, "              \tuses file in $MOLE_INDEX_PATH. If this is also missing,\n");
-    fprintf(stderr, "              \tdefaults to ~/.mole-index file.\n");
+    fprintf(stderr, "              \tdefaults to ~/.mole-index file. Other directories default\n");
+    fprintf(stderr, "              \tto that file with their number appended (e.g. ~/.mole-index.1).\n");
+    fprintf(stderr, "  -s <file>   \tWrite statistics (see `stats` command) into <file> every minute\n");
+    fprintf(stderr, "              \tand when the program exits.\n");
+    fprintf(stderr, "  -l <socket> \tServe queries sent by mole-client over Unix domain socket <socket>\n");
+    fprintf(stderr, "              \tinstead of reading commands from standard input. Runs until\n");
+    fprintf(stderr, "              \tSIGINT or SIGTERM is received.\n");
     fprintf(stderr, "  -t <arg>    \tSet time between performing periodic indexing to <arg> seconds.\n");
     fprintf(stderr, "              \tValue of <arg> has to be a number from interval [30, 7200].\n");
     fprintf(stderr, "              \tIf not specified, indexing is executed only once.\n");
+    fprintf(stderr, "  -j <arg>    \tUse <arg> threads for traversing directory tree. Value of <arg>\n");
+    fprintf(stderr, "              \thas to be a number from interval [1, 64]. If not specified,\n");
+    fprintf(stderr, "              \tdefaults to number of available processors.\n");
+    fprintf(stderr, "  -i          \tReindex incrementally. Directories that weren't modified since\n");
+    fprintf(stderr, "              \tprevious indexing aren't read again and files that weren't\n");
+    fprintf(stderr, "              \tmodified aren't opened to check their type.\n");
+    fprintf(stderr, "  -w          \tWatch directory tree for changes (using inotify) and keep\n");
+    fprintf(stderr, "              \tthe index up to date without periodic reindexing.\n");
+    fprintf(stderr, "  -m <arg>    \tUse at most <arg> MiB for building name, size and owner indexes\n");
+    fprintf(stderr, "              \tof indexing results. If they don't fit, they are sorted through\n");
+    fprintf(stderr, "              \ttemporary files next to the cache while it is written, and\n");
+    fprintf(stderr, "              \tqueries then read them from the cache file. Entries found while\n");
+    fprintf(stderr, "              \tindexing are still kept in memory, this only limits the rest.\n");
     exit(EXIT_FAILURE);
 }
+
+ssize_t bulk_read(int fd, void* buffer, size_t count)
+{
+    size_t total = 0;
+    while(total < count)
+    {
+        ssize_t result = TEMP_FAILURE_RETRY(read(fd, (char*) buffer + total, count - total));
+        if(result < 0) return -1;
+        if(result == 0) break;
+        total += result;
+    }
+
+    return total;
+}
+
+ssize_t bulk_write(int fd, const void* buffer, size_t count)
+{
+    size_t total = 0;
+    while(total < count)
+    {
+        ssize_t result = TEMP_FAILURE_RETRY(write(fd, (const char*) buffer + total, count - total));
+        if(result < 0) return -1;
+        total += result;
+    }
+
+    return total;
+}
@@ -2,6 +2,7 @@
 
 #define _GNU_SOURCE
 #include <errno.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -16,23 +17,39 @@
 #define PATH_MAX 4096
 
 typedef struct mole_index mole_index_t;
+typedef struct mole_snapshot mole_snapshot_t;
+typedef struct persister persister_t;
 
-// This struct holds all necessary information for the program.
-// Those values are used all over the code, that's why we keep them
-// in a single struct, that we can pass everywhere it is needed.
+// This struct holds all necessary information for indexing a single root
+// directory (see roots.h). Those values are used all over the code, that's
+// why we keep them in a single struct, that we can pass everywhere it is needed.
 typedef struct mole_context
 {
     char* path_d;                           // Path to directory, root of indexing operations
     char* path_f;                           // Path to cache file where indexing results are stored
+    char* path_s;                           // Path to file where statistics are dumped (or NULL)
     int time;                               // Time between periodic indexing
-    mole_index_t* index;                    // Pointer to index
-    pthread_mutex_t* index_mutex;           // Mutex guarding acces to index
+    int threads;                            // Number of threads traversing directory tree
+    bool incremental;                       // Flag telling whether to reuse results of previous indexing
+    bool watch;                             // Flag telling whether to watch for filesystem events
+    size_t memory_limit;                    // Memory for name, size and owner indexes of indexing results (0 if unbounded)
+    _Atomic(mole_snapshot_t*) snapshot;     // Current version of index (see snapshot.h)
+    atomic_size_t snapshot_readers;         // Number of threads that are pinning the snapshot
+    pthread_mutex_t* publish_mutex;         // Mutex serializing publication of new snapshots
+    persister_t* persister;                 // Thread writing snapshots into cache file
     bool indexing_pending;                  // Flag telling wheter there is indexing process pending
     pthread_cond_t* indexing_done;          // Condtion variable that is signaled when indexing is done
     pthread_mutex_t* indexing_mutex;        // Mutex guarding both flag and condition variable
     bool force_exit;                        // Flag that can be set to interrupt indexing process
-    pthread_mutex_t* force_exit_mutex;      // Mutex guarding access to above flag
+    pthread_mutex_t* force_exit_mutex;      // Mutex guarding access to above flag (shared by roots)
 } mole_context_t;
 
 // Prints usage message to stderr and terminates the program.
 void usage(char* name);
+
+// Reads exactly `count` bytes from `fd`, unless end of file is reached first.
+// Returns number of bytes read or -1 on error.
+ssize_t bulk_read(int fd, void* buffer, size_t count);
+
+// Writes exactly `count` bytes into `fd`. Returns number of bytes written or -1 on error.
+ssize_t bulk_write(int fd, const void* buffer, size_t count);
@@ -0,0 +1,203 @@
+#include "cursor.h"
+#include "scan.h"
+
+static void cursor_init(mole_cursor_t* cursor, cursor_kind_t kind, const mole_index_t* index, const mole_scope_t* scope)
+{
+    memset(cursor, 0, offsetof(mole_cursor_t, buffer));
+    cursor->kind = kind;
+    cursor->index = index;
+    cursor->buffer_size = cursor->buffer_position = 0;
+
+    if(NULL == scope)
+        scope_whole(&cursor->scope, index);
+    else
+        cursor->scope = *scope;
+}
+
+// Starts scanning entries of the scope from `begin` on (entries before it were already checked).
+static void cursor_start_scan(mole_cursor_t* cursor, uint64_t begin)
+{
+    const mole_scope_t* scope = &cursor->scope;
+    cursor->stage = 1;
+    cursor->position = begin < scope->begin ? scope->begin : begin > scope->end ? scope->end : begin;
+    cursor->end = scope->end;
+    cursor->next = scope->tail > scope->end ? scope->tail : scope->end;
+}
+
+// Returns first position in sorted array of ids, where id is not smaller than `id`.
+static size_t cursor_lower_bound(const uint32_t* ids, size_t count, uint64_t id)
+{
+    size_t low = 0, high = count;
+    while(low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if(ids[middle] < id) low = middle + 1;
+        else high = middle;
+    }
+
+    return low;
+}
+
+void cursor_size_range(mole_cursor_t* cursor, const mole_index_t* index, const mole_scope_t* scope,
+                       uint64_t min_size, uint64_t max_size)
+{
+    cursor_init(cursor, Cursor_Size_Range, index, scope);
+    cursor->min_size = min_size;
+    cursor->max_size = max_size;
+
+    // Entries covered by size order are found by binary search, subtree is scanned instead.
+    if(min_size > max_size)
+        cursor->stage = 2;
+    else if(cursor->scope.id != MOLE_NO_ENTRY)
+        cursor_start_scan(cursor, 0);
+    else
+    {
+        cursor->position = size_order_lower_bound(&index->size_order, index, min_size);
+        cursor->end = index->size_order.indexed;
+    }
+}
+
+void cursor_name_part(mole_cursor_t* cursor, const mole_index_t* index, const mole_scope_t* scope, const char* string)
+{
+    cursor_init(cursor, Cursor_Name_Part, index, scope);
+    cursor->string = string;
+
+    // Without trigram candidates every entry has to be checked.
+    size_t candidate_count;
+    if(trigrams_candidates(&index->trigrams, string, &cursor->candidates, &candidate_count))
+    {
+        cursor->position = cursor_lower_bound(cursor->candidates, candidate_count, cursor->scope.begin);
+        cursor->end = cursor_lower_bound(cursor->candidates, candidate_count, cursor->scope.end);
+    }
+    else
+        cursor_start_scan(cursor, 0);
+}
+
+void cursor_owner(mole_cursor_t* cursor, const mole_index_t* index, const mole_scope_t* scope, uid_t uid)
+{
+    cursor_init(cursor, Cursor_Owner, index, scope);
+    cursor->uid = uid;
+
+    // Entries covered by owners index are taken from owner's posting list, subtree is scanned instead.
+    const mole_owners_t* owners = &index->owners;
+    size_t k = owners_find(owners, uid);
+    if(cursor->scope.id != MOLE_NO_ENTRY)
+        cursor_start_scan(cursor, 0);
+    else if(k < owners->owner_count)
+    {
+        cursor->position = owners->offsets[k];
+        cursor->end = owners->offsets[k + 1];
+    }
+}
+
+void cursor_free(mole_cursor_t* cursor)
+{
+    free(cursor->candidates);
+    cursor->candidates = NULL;
+}
+
+static bool cursor_name_matches(const mole_cursor_t* cursor, uint64_t id)
+{
+    const mole_index_t* index = cursor->index;
+    return strstr(index_entry_name(index, &index->elements[id]), cursor->string) != NULL;
+}
+
+// Takes matches from auxiliary structure of the query.
+static void cursor_fill_indexed(mole_cursor_t* cursor)
+{
+    const mole_index_t* index = cursor->index;
+    while(cursor->position < cursor->end && cursor->buffer_size < CURSOR_CHUNK)
+    {
+        uint64_t id;
+        switch(cursor->kind)
+        {
+            case Cursor_Size_Range:
+                id = index->size_order.ids[cursor->position++];
+                if(index->sizes[id] > cursor->max_size)
+                {
+                    cursor->position = cursor->end;
+                    continue;
+                }
+                break;
+            case Cursor_Name_Part:
+                id = cursor->candidates[cursor->position++];
+                if(!cursor_name_matches(cursor, id)) continue;
+                break;
+            case Cursor_Owner:
+            default:
+                id = index->owners.ids[cursor->position++];
+                break;
+        }
+
+        if(index->file_types[id] != Removed)
+            cursor->buffer[cursor->buffer_size++] = id;
+    }
+
+    if(cursor->position == cursor->end)
+        cursor_start_scan(cursor, cursor->kind == Cursor_Size_Range ? index->size_order.indexed
+                                : cursor->kind == Cursor_Name_Part ? index->trigrams.indexed
+                                : index->owners.indexed);
+}
+
+// Scans entries not covered by auxiliary structure, at most a chunk at a time.
+static void cursor_fill_scanned(mole_cursor_t* cursor)
+{
+    const mole_index_t* index = cursor->index;
+    uint64_t begin = cursor->position;
+    uint64_t end = begin + (CURSOR_CHUNK - cursor->buffer_size);
+    if(end > cursor->end) end = cursor->end;
+
+    uint64_t* ids = cursor->buffer + cursor->buffer_size;
+    size_t count = 0;
+    switch(cursor->kind)
+    {
+        case Cursor_Size_Range:
+            count = scan_size_range(index->sizes, begin, end, cursor->min_size, cursor->max_size, ids);
+            break;
+        case Cursor_Name_Part:
+            for(uint64_t id = begin; id < end; ++id)
+                if(cursor_name_matches(cursor, id))
+                    ids[count++] = id;
+            break;
+        case Cursor_Owner:
+            count = scan_owner(index->owner_uids, begin, end, cursor->uid, ids);
+            break;
+    }
+
+    // Entries after range of the scope belong to it only if one of their ancestors does.
+    const mole_scope_t* scope = &cursor->scope;
+    for(size_t i = 0; i < count; ++i)
+        if(index->file_types[ids[i]] != Removed && (ids[i] < scope->end || scope_contains(scope, index, ids[i])))
+            cursor->buffer[cursor->buffer_size++] = ids[i];
+
+    cursor->position = end;
+    if(cursor->position < cursor->end) return;
+
+    if(cursor->next < index->size)
+    {
+        cursor->position = cursor->next;
+        cursor->end = cursor->next = index->size;
+    }
+    else
+        cursor->stage = 2;
+}
+
+bool cursor_next(mole_cursor_t* cursor, uint64_t* id)
+{
+    if(cursor->buffer_position == cursor->buffer_size)
+    {
+        cursor->buffer_size = cursor->buffer_position = 0;
+        while(cursor->buffer_size == 0 && cursor->stage < 2)
+        {
+            if(cursor->stage == 0)
+                cursor_fill_indexed(cursor);
+            else
+                cursor_fill_scanned(cursor);
+        }
+
+        if(cursor->buffer_size == 0) return false;
+    }
+
+    *id = cursor->buffer[cursor->buffer_position++];
+    return true;
+}
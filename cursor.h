@@ -0,0 +1,64 @@
+#pragma once
+
+#include "common.h"
+#include "mole_index.h"
+
+#include <stdint.h>
+
+#define CURSOR_CHUNK 1024
+
+typedef enum cursor_kind
+{
+    Cursor_Size_Range,          // Entries with size in range [`min_size`, `max_size`]
+    Cursor_Name_Part,           // Entries whose names contain `string`
+    Cursor_Owner                // Entries owned by user `uid`
+} cursor_kind_t;
+
+// Query yielding ids of matching entries one by one, instead of collecting them.
+// Matches are found a chunk at a time: entries covered by auxiliary structure of the
+// query (size order, trigrams, owners) are taken from it first, then the remaining ones
+// (added by watcher) are scanned. Removed entries are skipped. Apart from trigram
+// candidates, memory used by cursor doesn't depend on number of matches.
+//
+// Query limited to a subtree (see `mole_scope_t`) scans range of the subtree instead of
+// using size order or owners, trigram candidates are narrowed down to the range. Entries
+// not covered by subtree ranges are scanned at the end, checking their ancestors.
+//
+// Cursor doesn't pin the index, the caller has to keep its snapshot for as long as
+// cursor is used.
+typedef struct mole_cursor
+{
+    cursor_kind_t kind;                 // Kind of query
+    const mole_index_t* index;          // Searched index
+    uint64_t min_size;                  // Parameters of the query (depending on kind)
+    uint64_t max_size;
+    const char* string;
+    uid_t uid;
+    mole_scope_t scope;                 // Part of the index searched by the query
+    int stage;                          // 0 while auxiliary structure is used, 1 while scanning, 2 when done
+    uint64_t position;                  // Position inside current stage
+    uint64_t end;                       // End of current stage
+    uint64_t next;                      // Beginning of entries scanned after the current range
+    uint32_t* candidates;               // Candidates found by trigram index (or NULL)
+    uint64_t buffer[CURSOR_CHUNK];      // Ids of matches found, but not yet returned
+    size_t buffer_size;                 // Number of ids in the buffer
+    size_t buffer_position;             // Number of ids already returned from the buffer
+} mole_cursor_t;
+
+// Initializes cursor over entries of `index` with size in range [`min_size`, `max_size`].
+// Cursors search only entries in `scope` (whole index if NULL or if it is the whole index).
+void cursor_size_range(mole_cursor_t* cursor, const mole_index_t* index, const mole_scope_t* scope,
+                       uint64_t min_size, uint64_t max_size);
+
+// Initializes cursor over entries of `index`, whose names contain `string`
+// (which has to stay valid until cursor is freed).
+void cursor_name_part(mole_cursor_t* cursor, const mole_index_t* index, const mole_scope_t* scope, const char* string);
+
+// Initializes cursor over entries of `index` owned by user `uid`.
+void cursor_owner(mole_cursor_t* cursor, const mole_index_t* index, const mole_scope_t* scope, uid_t uid);
+
+// Stores id of next match in `id`. Returns false if there are no more matches.
+bool cursor_next(mole_cursor_t* cursor, uint64_t* id);
+
+// Frees memory used by the cursor.
+void cursor_free(mole_cursor_t* cursor);
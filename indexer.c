@@ -1,21 +1,47 @@
 #include "indexer.h"
+#include "persister.h"
+#include "signature.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "walker.h"
 
 #include <fcntl.h>
-#include <fts.h>
-#include <sys/stat.h>
 
-file_type_t get_file_type(uint64_t signature)
+file_type_t get_file_type(const unsigned char* header, size_t length)
 {
-    if((signature & 0xffffff) == 0xffd8ff)  // JPEG signature: FF D8 FF (...)
-        return Image_JPEG;
-    if(signature == 0x0a1a0a0d474e5089)     // PNG signature: 89 50 4E 47 0D 0A 1A 0A (.PNG....)
-        return Image_PNG;
-    if((signature & 0xffff) == 0x8b1f)      // GZIP signature: 1F 8B (..)
-        return Compressed_GZIP;
-    if((signature & 0xffff) == 0x4b50)      // ZIP signature: 50 4B (PK)
-        return Compressed_ZIP;
-    else
-        return Unrecognized;
+    return signature_match(header, length);
+}
+
+file_type_t get_file_type_at(int dir_fd, const char* name)
+{
+    uint64_t start = stats_now();
+    int fd = openat(dir_fd, name, O_RDONLY);
+    if(fd < 0) ERROR("open");
+    stats_record(Stat_Open_Time, start);
+
+    start = stats_now();
+    unsigned char header[MOLE_HEADER_WINDOW];
+    ssize_t length = read(fd, header, sizeof(header));
+    if(length < 0) ERROR("read");
+    stats_record(Stat_Read_Time, start);
+
+    if(close(fd)) ERROR("close");
+
+    return get_file_type(header, length);
+}
+
+bool try_get_file_type_at(int dir_fd, const char* name, file_type_t* file_type)
+{
+    int fd = openat(dir_fd, name, O_RDONLY);
+    if(fd < 0) return false;
+
+    unsigned char header[MOLE_HEADER_WINDOW];
+    ssize_t length = read(fd, header, sizeof(header));
+    if(close(fd)) ERROR("close");
+    if(length < 0) return false;
+
+    *file_type = get_file_type(header, length);
+    return true;
 }
 
 void indexer_start_worker(mole_context_t* context)
@@ -44,80 +70,47 @@ void* indexer_worker(void* args)
 {
     mole_context_t* context = (mole_context_t*) args;
 
+    uint64_t start = stats_now();
+    // Previous snapshot stays pinned (and unchanged) for the whole traversal.
+    // New index will likely have about as many entries, so they are made usable up front.
+    mole_snapshot_t* previous = snapshot_acquire(context);
     mole_index_t new_index;
-    index_init(&new_index);
-
-    char* paths[] = {context->path_d, NULL};
-    FTS* fts = fts_open(paths, FTS_LOGICAL | FTS_NOCHDIR, NULL);
-    if(fts == NULL) ERROR("fts_open");
-
-    FTSENT* entry;
-    errno = 0;
-    while((entry = fts_read(fts)) != NULL)
+    index_init_reserved(&new_index, previous->index.size, MOLE_MAX_ENTRIES);
+    bool finished = walker_run(context, context->path_d, context->incremental ? &previous->index : NULL,
+                               &previous->index.type_cache, &new_index);
+    snapshot_release(previous);
+    if(!finished)
     {
-        switch(entry->fts_info)
-        {
-            case FTS_D:
-            {
-                char* file_name = entry->fts_name;
-                char* full_path = entry->fts_accpath;
-                size_t size = entry->fts_statp->st_size;
-                uid_t owner_uid = entry->fts_statp->st_uid;
-                file_type_t type = Directory;
-
-                index_emplace(&new_index, file_name, full_path, size, owner_uid, type);
-            }
-            break;
-            case FTS_F:
-            {
-                int fd = open(entry->fts_accpath, O_RDONLY);
-                if(fd < 0) ERROR("open");
-
-                size_t signature;
-                if(read(fd, &signature, sizeof(size_t)) < 0)  ERROR("read");
-
-                if(close(fd)) ERROR("close");
-
-                char* file_name = entry->fts_name;
-                char* full_path = entry->fts_accpath;
-                size_t size = entry->fts_statp->st_size;
-                uid_t owner_uid = entry->fts_statp->st_uid;
-                file_type_t type = get_file_type(signature);
-
-                if(type != Unrecognized)
-                    index_emplace(&new_index, file_name, full_path, size, owner_uid, type);
-            }
-            break;
-            default:
-                continue;
-        }
-        errno = 0;
-
-        pthread_mutex_lock(context->force_exit_mutex);
-        if(context->force_exit)
-        {
-            if(fts_close(fts)) ERROR("fts_close");
-            pthread_mutex_lock(context->indexing_mutex);
-            context->indexing_pending = false;
-            pthread_mutex_unlock(context->indexing_mutex);
-            pthread_cond_broadcast(context->indexing_done);
-            return NULL;
-        }
-        pthread_mutex_unlock(context->force_exit_mutex);
+        index_free(&new_index);
+        pthread_mutex_lock(context->indexing_mutex);
+        context->indexing_pending = false;
+        pthread_mutex_unlock(context->indexing_mutex);
+        pthread_cond_broadcast(context->indexing_done);
+        return NULL;
     }
 
-    if(errno != 0) ERROR("fts_read");
-
-    if(fts_close(fts)) ERROR("fts_close");
-
-    pthread_mutex_lock(context->index_mutex);
-
-    index_free(context->index);
-    *context->index = new_index;
-
-    index_save(context->index, context->path_f);
-
-    pthread_mutex_unlock(context->index_mutex);
+    index_order_preorder(&new_index);
+    bool mapped = false;
+    if(context->memory_limit > 0 && index_prepare_memory(&new_index) > context->memory_limit)
+    {
+        // Sorted structures don't fit into the limit, so they are built while saving, sorted through
+        // temporary files. Queries then use the index mapped from the cache file, so the walk's
+        // columns can be freed. Entries and columns themselves stay in memory until then.
+        subtrees_build(&new_index.subtrees, &new_index);
+        rollups_build(&new_index.rollups, &new_index);
+        mapped = persister_save_spilled(context->persister, &new_index, context->memory_limit);
+    }
+    if(!mapped) index_prepare(&new_index);
+    stats_add(Stat_Indexings, 1);
+    stats_record(Stat_Index_Time, start);
+
+    // Queries started from now on see the new index, while the ones in progress
+    // finish using the old one. Saving (by persister) doesn't hold up either of them.
+    start = stats_now();
+    mole_snapshot_t* snapshot = snapshot_publish(context, &new_index, true);
+    stats_record(Stat_Publish_Time, start);
+    if(mapped) snapshot_release(snapshot);
+    else persister_request(context->persister, snapshot);
 
     printf("\b\bBackground indexing finished!\n> ");
     fflush(stdout);
@@ -6,9 +6,17 @@
 #include "common.h"
 #include "mole_index.h"
 
-// Compares provided `signature` (first 64 bits of a file) and
-// returns what file type it is.
-file_type_t get_file_type(uint64_t signature);
+// Compares provided `header` (first `length` bytes of a file, at most MOLE_HEADER_WINDOW)
+// with known signatures and returns what file type it is.
+file_type_t get_file_type(const unsigned char* header, size_t length);
+
+// Reads beginning of regular file `name` inside directory `dir_fd`
+// (AT_FDCWD for current directory) and returns what file type it is.
+file_type_t get_file_type_at(int dir_fd, const char* name);
+
+// Like `get_file_type_at()`, but returns false instead of failing if the file can't be
+// opened or read (it might have been removed or made unreadable in the meantime).
+bool try_get_file_type_at(int dir_fd, const char* name, file_type_t* file_type);
 
 // Checks whether there is already a worker running.
 // If not, launches one in a seperate thread.
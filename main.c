@@ -9,40 +9,111 @@
 
 #include "common.h"
 #include "mole_index.h"
+#include "persister.h"
+#include "roots.h"
+#include "server.h"
+#include "snapshot.h"
+#include "stats.h"
 #include "indexer.h"
 #include "cli.h"
+#include "walker.h"
+#include "watcher.h"
 
 #define TIME_MIN 30
 #define TIME_MAX 7200
+#define ROOTS_MAX 16
+#define MEMORY_LIMIT_MAX (1 << 20)
+
+// Directory given with `-d` together with options that apply only to it.
+typedef struct root_args
+{
+    char* path_d;               // Path to the directory
+    char* path_f;               // Path to its cache file
+    int time;                   // Time between its periodic indexing (-1 if not specified)
+} root_args_t;
+
+// Threads of a single root and synchronization objects its context points to.
+typedef struct root_state
+{
+    pthread_mutex_t publish_mutex;
+    pthread_cond_t indexing_done;
+    pthread_mutex_t indexing_mutex;
+    persister_t persister;
+    watcher_t watcher;
+    pthread_t pi_tid;
+} root_state_t;
 
 // Parses command arguments and checks if provided values are correct.
 // Uses default values if necessary (e.g. environment variables).
-void parseargs(int argc, char** argv, char** path_d, char** path_f, int* time)
+// Options `-f` and `-t` apply to the root given by preceding `-d` (or to the first one).
+void parseargs(int argc, char** argv, root_args_t* roots, size_t* root_count, char** path_s, char** path_l,
+               int* threads, bool* incremental, bool* watch, size_t* memory_limit)
 {
     int opt;
 
-    *path_d = NULL;
-    *path_f = NULL;
-    *time = -1;
+    for(size_t i = 0; i < ROOTS_MAX; ++i)
+    {
+        roots[i].path_d = NULL;
+        roots[i].path_f = NULL;
+        roots[i].time = -1;
+    }
+    *root_count = 1;
+    *path_s = NULL;
+    *path_l = NULL;
+    *threads = -1;
+    *incremental = false;
+    *watch = false;
+    *memory_limit = 0;
 
     opterr = 0;
-    while((opt = getopt(argc, argv, "hd:f:t:")) != -1)
+    while((opt = getopt(argc, argv, "hd:f:s:l:t:j:iwm:")) != -1)
     {
+        root_args_t* root = &roots[*root_count - 1];
         switch(opt)
         {
             case 'h':
                 usage(argv[0]);
             break;
             case 'd':
-                *path_d = optarg;
+                if(NULL != root->path_d)
+                {
+                    if(*root_count == ROOTS_MAX) usage(argv[0]);
+                    root = &roots[(*root_count)++];
+                }
+                root->path_d = optarg;
             break;
             case 'f':
-                *path_f = optarg;
+                root->path_f = optarg;
+            break;
+            case 's':
+                *path_s = optarg;
+            break;
+            case 'l':
+                *path_l = optarg;
             break;
             case 't':
-                *time = atoi(optarg);
-                if(*time < TIME_MIN || *time > TIME_MAX)
+                root->time = atoi(optarg);
+                if(root->time < TIME_MIN || root->time > TIME_MAX)
+                    usage(argv[0]);
+            break;
+            case 'j':
+                *threads = atoi(optarg);
+                if(*threads < 1 || *threads > WALKER_THREADS_MAX)
+                    usage(argv[0]);
+            break;
+            case 'i':
+                *incremental = true;
+            break;
+            case 'w':
+                *watch = true;
+            break;
+            case 'm':
+            {
+                int megabytes = atoi(optarg);
+                if(megabytes < 1 || megabytes > MEMORY_LIMIT_MAX)
                     usage(argv[0]);
+                *memory_limit = (size_t) megabytes << 20;
+            }
             break;
             case '?':
                 usage(argv[0]);
@@ -55,71 +126,199 @@ void parseargs(int argc, char** argv, char** path_d, char** path_f, int* time)
 
     if(argc > optind) usage(argv[0]);
 
-    if(NULL == *path_d)
+    if(NULL == roots[0].path_d)
     {
-        if(!(*path_d = getenv(MOLE_DIR_VAR))) usage(argv[0]);
+        if(!(roots[0].path_d = getenv(MOLE_DIR_VAR))) usage(argv[0]);
     }
 
-    if(NULL == *path_f)
+    if(*threads < 0)
     {
-        if(!(*path_f = getenv(MOLE_INDEX_PATH_VAR)))
+        long processors = sysconf(_SC_NPROCESSORS_ONLN);
+        *threads = processors < 1 ? 1 : processors > WALKER_THREADS_MAX ? WALKER_THREADS_MAX : processors;
+    }
+
+    if(NULL == roots[0].path_f)
+    {
+        if(!(roots[0].path_f = getenv(MOLE_INDEX_PATH_VAR)))
         {
             static char home[PATH_MAX];
             strcpy(home, getenv("HOME"));
             strcat(home, MOLE_INDEX_NAME_DEFAULT);
 
-            *path_f = home;
+            roots[0].path_f = home;
+        }
+    }
+
+    // Other roots default to cache file of the first one with their number appended.
+    static char names[ROOTS_MAX][PATH_MAX];
+    for(size_t i = 1; i < *root_count; ++i)
+    {
+        if(NULL != roots[i].path_f) continue;
+
+        if(snprintf(names[i], PATH_MAX, "%s.%lu", roots[0].path_f, i) >= PATH_MAX) usage(argv[0]);
+        roots[i].path_f = names[i];
+    }
+
+    for(size_t i = 0; i < *root_count; ++i)
+    {
+        for(size_t j = 0; j < i; ++j)
+        {
+            if(strcmp(roots[i].path_f, roots[j].path_f) == 0)
+            {
+                fprintf(stderr, "Directories `%s` and `%s` can't share cache file `%s`.\n",
+                        roots[j].path_d, roots[i].path_d, roots[i].path_f);
+                exit(EXIT_FAILURE);
+            }
         }
     }
 }
 
 int main(int argc, char** argv)
 {
-    char* path_d;
-    char* path_f;
-    int time;
-    parseargs(argc, argv, &path_d, &path_f, &time);
-
-    pthread_mutex_t index_mutex = PTHREAD_MUTEX_INITIALIZER;
-    pthread_cond_t indexing_done = PTHREAD_COND_INITIALIZER;
-    pthread_mutex_t indexing_mutex = PTHREAD_MUTEX_INITIALIZER;
+    root_args_t root_args[ROOTS_MAX];
+    size_t root_count;
+    char* path_s;
+    char* path_l;
+    int threads;
+    bool incremental;
+    bool watch;
+    size_t memory_limit;
+    parseargs(argc, argv, root_args, &root_count, &path_s, &path_l, &threads, &incremental, &watch, &memory_limit);
+
+    // Daemon waits for termination signals with `sigwait()`, so every thread has to block them.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    if(NULL != path_l)
+    {
+        if(pthread_sigmask(SIG_BLOCK, &signals, NULL)) ERROR("pthread_sigmask");
+    }
+
     pthread_mutex_t force_exit_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-    mole_index_t index;
-    index_init(&index);
-
-    mole_context_t context;
-    context.path_d = path_d;
-    context.path_f = path_f;
-    context.time = time;
-    context.index = &index;
-    context.index_mutex = &index_mutex;
-    context.indexing_pending = false;
-    context.indexing_done = &indexing_done;
-    context.indexing_mutex = &indexing_mutex;
-    context.force_exit = false;
-    context.force_exit_mutex = &force_exit_mutex;
-
-    if(!index_read(&index, path_f))
+    mole_roots_t roots;
+    roots.count = root_count;
+    roots.contexts = malloc(root_count * sizeof(mole_context_t));
+    root_state_t* states = malloc(root_count * sizeof(root_state_t));
+    if(NULL == roots.contexts || NULL == states) ERROR("malloc");
+
+    for(size_t i = 0; i < root_count; ++i)
+    {
+        mole_context_t* context = &roots.contexts[i];
+        root_state_t* state = &states[i];
+        if(pthread_mutex_init(&state->publish_mutex, NULL)) ERROR("pthread_mutex_init");
+        if(pthread_cond_init(&state->indexing_done, NULL)) ERROR("pthread_cond_init");
+        if(pthread_mutex_init(&state->indexing_mutex, NULL)) ERROR("pthread_mutex_init");
+
+        context->path_d = root_args[i].path_d;
+        context->path_f = root_args[i].path_f;
+        context->path_s = path_s;
+        context->time = root_args[i].time;
+        context->threads = threads;
+        context->incremental = incremental;
+        context->watch = watch;
+        context->memory_limit = memory_limit;
+        context->publish_mutex = &state->publish_mutex;
+        context->indexing_pending = false;
+        context->indexing_done = &state->indexing_done;
+        context->indexing_mutex = &state->indexing_mutex;
+        context->force_exit = false;
+        context->force_exit_mutex = &force_exit_mutex;
+
+        mole_index_t index;
+        index_init(&index);
+
+        // Changes made while program wasn't running have to be found before they can be watched.
+        bool index_loaded = index_read(&index, context->path_f);
+        if(index_loaded && (index.trigrams.indexed != index.size || index.size_order.indexed != index.size
+                             || index.owners.indexed != index.size || index.subtrees.indexed != index.size
+                             || index.rollups.indexed != index.size))
+        {
+            // Cache without subtree ranges might have been written before entries were numbered in pre-order.
+            if(index.subtrees.indexed != index.size) index_order_preorder(&index);
+            index_prepare(&index);
+        }
+        snapshot_init(context, &index);
+
+        persister_start(&state->persister, context);
+        context->persister = &state->persister;
+
+        // Roots are indexed concurrently, every one by its own worker.
+        if(!index_loaded || watch)
+        {
+            indexer_start_worker(context);
+        }
+
+        if(watch) watcher_start(&state->watcher, context);
+
+        if(context->time > 0)
+        {
+            if(pthread_create(&state->pi_tid, NULL, periodic_indexer_worker, context)) ERROR("pthread_create");
+        }
+    }
+
+    // Statistics are shared by all roots.
+    pthread_t stats_tid;
+    if(NULL != path_s)
     {
-        indexer_start_worker(&context);
+        if(pthread_create(&stats_tid, NULL, stats_dump_worker, &roots.contexts[0])) ERROR("pthread_create");
     }
 
-    pthread_t pi_tid;
-    if(time > 0)
+    if(NULL != path_l)
     {
-        if(pthread_create(&pi_tid, NULL, periodic_indexer_worker, &context)) ERROR("pthread_create");
+        server_t server;
+        server_start(&server, &roots, path_l);
+        printf("Listening on %s\n", path_l);
+
+        int signal;
+        if(sigwait(&signals, &signal)) ERROR("sigwait");
+        server_stop(&server);
+
+        printf("Exiting...\n");
+        for(size_t i = 0; i < root_count; ++i)
+        {
+            mole_context_t* context = &roots.contexts[i];
+            pthread_mutex_lock(context->indexing_mutex);
+            while(context->indexing_pending)
+                pthread_cond_wait(context->indexing_done, context->indexing_mutex);
+            pthread_mutex_unlock(context->indexing_mutex);
+        }
+        printf("Goodbye!\n");
     }
+    else
+        cli_start(&roots);
 
-    cli_start(&context);
+    for(size_t i = 0; i < root_count; ++i)
+    {
+        mole_context_t* context = &roots.contexts[i];
+        root_state_t* state = &states[i];
+        if(context->time > 0)
+        {
+            pthread_cancel(state->pi_tid);
+            pthread_join(state->pi_tid, NULL);
+        }
 
-    if(time > 0)
+        if(watch) watcher_stop(&state->watcher);
+        persister_stop(&state->persister);
+    }
+
+    if(NULL != path_s)
     {
-        pthread_cancel(pi_tid);
-        pthread_join(pi_tid, NULL);
+        pthread_cancel(stats_tid);
+        pthread_join(stats_tid, NULL);
+        stats_dump(path_s);
     }
 
-    index_free(&index);
+    for(size_t i = 0; i < root_count; ++i)
+    {
+        snapshot_destroy(&roots.contexts[i]);
+        pthread_mutex_destroy(&states[i].publish_mutex);
+        pthread_cond_destroy(&states[i].indexing_done);
+        pthread_mutex_destroy(&states[i].indexing_mutex);
+    }
+    free(roots.contexts);
+    free(states);
 
     return EXIT_SUCCESS;
 }
@@ -1,15 +1,190 @@
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 
 #include "mole_index.h"
+#include "pack.h"
+#include "spill.h"
+#include "stats.h"
 
-void index_init_capacity(mole_index_t* index, size_t capacity)
+// Entries are saved and mapped as they are, so their layout must not change unnoticed.
+_Static_assert(sizeof(mole_index_entry_t) == 56, "Layout of index entry changed, update MOLE_INDEX_VERSION");
+_Static_assert(sizeof(mole_index_header_t) == 40, "Layout of cache header changed, update MOLE_INDEX_VERSION");
+
+void arena_init(mole_string_arena_t* arena, size_t capacity)
+{
+    arena->size = 0;
+    arena->capacity = capacity;
+    arena->data = malloc(arena->capacity);
+    if(NULL == arena->data) ERROR("malloc");
+}
+
+void arena_free(mole_string_arena_t* arena)
+{
+    arena->size = 0;
+    arena->capacity = 0;
+    free(arena->data);
+    arena->data = NULL;
+}
+
+void arena_extend(mole_string_arena_t* arena, size_t new_capacity)
+{
+    if(new_capacity <= arena->capacity) return;
+
+    char* new_data = realloc(arena->data, new_capacity);
+    if(NULL == new_data) ERROR("realloc");
+
+    arena->capacity = new_capacity;
+    arena->data = new_data;
+}
+
+uint64_t arena_append(mole_string_arena_t* arena, const char* string, size_t length)
+{
+    size_t new_capacity = arena->capacity;
+    while(arena->size + length + 1 > new_capacity)
+        new_capacity *= 2;
+    arena_extend(arena, new_capacity);
+
+    uint64_t offset = arena->size;
+    memcpy(arena->data + offset, string, length);
+    arena->data[offset + length] = '\0';
+    arena->size += length + 1;
+
+    return offset;
+}
+
+// Widths of the array of entries and of the columns, in order they are placed in the reservation.
+static const size_t index_column_widths[] = {
+    sizeof(mole_index_entry_t), sizeof(uint64_t), sizeof(uint32_t), sizeof(uint8_t)
+};
+#define INDEX_COLUMN_COUNT (sizeof(index_column_widths) / sizeof(index_column_widths[0]))
+
+// Reciprocal of the part of limited address space a single index may reserve. Walk with
+// the most threads reserves for each of them and for its result, which takes about a half.
+#define INDEX_ADDRESS_SHARE 128
+
+// Returns number of entries rounded up to whole segments.
+static size_t index_round_segments(size_t entries)
+{
+    if(entries == 0) entries = 1;
+    return (entries + MOLE_SEGMENT_ENTRIES - 1) / MOLE_SEGMENT_ENTRIES * MOLE_SEGMENT_ENTRIES;
+}
+
+static size_t index_reserved_size(size_t reserved)
+{
+    size_t size = 0;
+    for(size_t k = 0; k < INDEX_COLUMN_COUNT; ++k)
+        size += reserved * index_column_widths[k];
+
+    return size;
+}
+
+// Reserves address space for `entries` entries and columns of the index (rounded up
+// to whole segments), none of it usable yet. Returns false if it can't be reserved.
+// Pages of anonymous mapping are zeroed when they are first used, so they are never cleared.
+static bool index_try_reserve(mole_index_t* index, size_t entries)
+{
+    size_t reserved = index_round_segments(entries < MOLE_MAX_ENTRIES ? entries : MOLE_MAX_ENTRIES);
+    char* columns = mmap(NULL, index_reserved_size(reserved), PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(MAP_FAILED == columns) return false;
+
+    index->columns = columns;
+    index->reserved = reserved;
+    index->capacity = 0;
+    index->elements = (mole_index_entry_t*) columns;
+    index->sizes = (uint64_t*) (columns += reserved * sizeof(mole_index_entry_t));
+    index->owner_uids = (uint32_t*) (columns += reserved * sizeof(uint64_t));
+    index->file_types = (uint8_t*) (columns += reserved * sizeof(uint32_t));
+    return true;
+}
+
+// Reserves address space for `reserve` entries, or for as many of them as address space allows
+// (halving the request until it succeeds), but at least for `entries` entries.
+// If address space is limited, an index takes at most its 1/INDEX_ADDRESS_SHARE, so that
+// all indexes of a walk leave enough of it to the rest of the program.
+static void index_reserve(mole_index_t* index, size_t entries, size_t reserve)
+{
+    if(reserve > MOLE_MAX_ENTRIES) reserve = MOLE_MAX_ENTRIES;
+    struct rlimit limit;
+    if(getrlimit(RLIMIT_AS, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY
+       && reserve > limit.rlim_cur / INDEX_ADDRESS_SHARE / index_reserved_size(1))
+        reserve = limit.rlim_cur / INDEX_ADDRESS_SHARE / index_reserved_size(1);
+    while(reserve > entries && !index_try_reserve(index, reserve))
+        reserve /= 2;
+    if(reserve <= entries && !index_try_reserve(index, entries)) ERROR("mmap");
+}
+
+// Copies entries and columns of `source` into reserved space of the index (of the same size).
+static void index_copy_columns(mole_index_t* index, const mole_index_t* source)
+{
+    memcpy(index->elements, source->elements, source->size * sizeof(mole_index_entry_t));
+    memcpy(index->sizes, source->sizes, source->size * sizeof(uint64_t));
+    memcpy(index->owner_uids, source->owner_uids, source->size * sizeof(uint32_t));
+    memcpy(index->file_types, source->file_types, source->size * sizeof(uint8_t));
+}
+
+static void index_commit(mole_index_t* index, size_t new_capacity);
+
+// Moves entries and columns into a new reservation for at least `new_capacity` entries.
+// Only happens if the index outgrows the reservation it was given (see `index_init_reserved()`).
+static void index_relocate(mole_index_t* index, size_t new_capacity)
+{
+    mole_index_t old = *index;
+    index_reserve(index, new_capacity, 2 * new_capacity);
+    index_commit(index, old.size);
+    index_copy_columns(index, &old);
+
+    if(munmap(old.columns, index_reserved_size(old.reserved))) ERROR("munmap");
+}
+
+// Makes segments of the reservation usable, until `new_capacity` entries fit into them.
+// Index is moved into a larger reservation, if the current one is too small.
+static void index_commit(mole_index_t* index, size_t new_capacity)
+{
+    if(new_capacity <= index->capacity) return;
+    if(new_capacity > MOLE_MAX_ENTRIES)
+    {
+        errno = ENOMEM;
+        ERROR("index_commit");
+    }
+    if(new_capacity > index->reserved) index_relocate(index, new_capacity);
+
+    new_capacity = index_round_segments(new_capacity);
+    if(new_capacity > index->reserved) new_capacity = index->reserved;
+
+    char* columns[] = { (char*) index->elements, (char*) index->sizes, (char*) index->owner_uids, (char*) index->file_types };
+    for(size_t k = 0; k < INDEX_COLUMN_COUNT; ++k)
+    {
+        size_t width = index_column_widths[k];
+        if(mprotect(columns[k] + index->capacity * width, (new_capacity - index->capacity) * width, PROT_READ | PROT_WRITE))
+            ERROR("mprotect");
+    }
+
+    index->capacity = new_capacity;
+}
+
+void index_init_reserved(mole_index_t* index, size_t capacity, size_t reserve)
 {
     index->size = 0;
-    index->capacity = capacity;
-    index->elements = malloc(index->capacity * sizeof(mole_index_entry_t));
-    if(NULL == index->elements) ERROR("malloc");
+    index_reserve(index, capacity, reserve);
+    index_commit(index, capacity);
+
+    arena_init(&index->strings, MOLE_ARENA_DEFAULT_CAPACITY);
+    trigrams_init(&index->trigrams);
+    type_cache_init(&index->type_cache);
+    size_order_init(&index->size_order);
+    owners_init(&index->owners);
+    subtrees_init(&index->subtrees);
+    rollups_init(&index->rollups);
 
-    memset(index->elements, 0, index->capacity * sizeof(mole_index_entry_t));
+    index->mapping = NULL;
+    index->mapping_size = 0;
+}
+
+void index_init_capacity(mole_index_t* index, size_t capacity)
+{
+    index_init_reserved(index, capacity, 2 * capacity);
 }
 
 void index_init(mole_index_t* index)
@@ -19,51 +194,704 @@ void index_init(mole_index_t* index)
 
 void index_free(mole_index_t* index)
 {
+    trigrams_free(&index->trigrams);
+    type_cache_free(&index->type_cache);
+    size_order_free(&index->size_order);
+    owners_free(&index->owners);
+    subtrees_free(&index->subtrees);
+    rollups_free(&index->rollups);
+
+    if(NULL != index->mapping)
+    {
+        if(munmap(index->mapping, index->mapping_size)) ERROR("munmap");
+        index->mapping = NULL;
+        index->mapping_size = 0;
+    }
+    if(NULL != index->columns)
+    {
+        if(munmap(index->columns, index_reserved_size(index->reserved))) ERROR("munmap");
+        index->columns = NULL;
+    }
+
     index->size = 0;
     index->capacity = 0;
-    free(index->elements);
+    index->reserved = 0;
     index->elements = NULL;
+    index->sizes = NULL;
+    index->owner_uids = NULL;
+    index->file_types = NULL;
+
+    arena_free(&index->strings);
 }
 
-void index_extend(mole_index_t* index, size_t new_capacity)
+void index_prepare(mole_index_t* index)
 {
-    if(new_capacity <= index->capacity) return;
+    trigrams_build(&index->trigrams, index);
+    size_order_build(&index->size_order, index);
+    owners_build(&index->owners, index);
+    subtrees_build(&index->subtrees, index);
+    rollups_build(&index->rollups, index);
+}
 
-    mole_index_entry_t* new_elements = malloc(new_capacity * sizeof(mole_index_entry_t));
-    if(NULL == new_elements) ERROR("malloc");
+size_t index_prepare_memory(const mole_index_t* index)
+{
+    // Every name of length `n` has at most `n - 2` distinct trigrams.
+    size_t postings = 0;
+    for(size_t i = 0; i < index->size; ++i)
+        if(index->elements[i].name_length > 2)
+            postings += index->elements[i].name_length - 2;
 
-    memcpy(new_elements, index->elements, index->size * sizeof(mole_index_entry_t));
-    free(index->elements);
-    index->capacity = new_capacity;
-    index->elements = new_elements;
+    // Trigram table, posting lists with their keys and offsets, size order and owners' lists.
+    return TRIGRAM_KEYS * sizeof(uint32_t) + postings * (sizeof(uint32_t) + sizeof(uint32_t) + sizeof(uint64_t))
+         + index->size * 4 * sizeof(uint32_t);
+}
+
+void index_detach(mole_index_t* index)
+{
+    if(NULL == index->mapping) return;
+
+    trigrams_detach(&index->trigrams);
+    type_cache_detach(&index->type_cache);
+    size_order_detach(&index->size_order);
+    owners_detach(&index->owners);
+    subtrees_detach(&index->subtrees);
+    rollups_detach(&index->rollups);
+
+    mole_index_t mapped = *index;
+    index_reserve(index, index->size + 1, 2 * (index->size + 1));
+    index_commit(index, index->size + 1);
+    index_copy_columns(index, &mapped);
+
+    if(munmap(index->mapping, index->mapping_size)) ERROR("munmap");
+    index->mapping = NULL;
+    index->mapping_size = 0;
+}
+
+// Allocates `capacity` bytes and copies `length` bytes of `data` into them.
+static void* index_copy_block(const void* data, size_t length, size_t capacity)
+{
+    void* copy = malloc(capacity);
+    if(NULL == copy) ERROR("malloc");
+    memcpy(copy, data, length);
+
+    return copy;
 }
 
-void index_insert(mole_index_t* index, mole_index_entry_t* entry)
+void index_copy(mole_index_t* copy, const mole_index_t* index)
 {
-    if(index->size >= index->capacity) index_extend(index, index->capacity * 2);
+    *copy = *index;
+    copy->mapping = NULL;
+    copy->mapping_size = 0;
+
+    index_reserve(copy, index->size + 1, 2 * (index->size + 1));
+    index_commit(copy, index->size + 1);
+    index_copy_columns(copy, index);
+    copy->strings.capacity = index->strings.size + 1;
+    copy->strings.data = index_copy_block(index->strings.data, index->strings.size, copy->strings.capacity);
+
+    // Auxiliary structures are copied the same way mapped ones are detached.
+    if(NULL != copy->trigrams.offsets)
+    {
+        copy->trigrams.owned = false;
+        trigrams_detach(&copy->trigrams);
+    }
+    if(NULL != copy->type_cache.slots)
+    {
+        copy->type_cache.owned = false;
+        type_cache_detach(&copy->type_cache);
+    }
+    if(NULL != copy->size_order.ids)
+    {
+        copy->size_order.owned = false;
+        size_order_detach(&copy->size_order);
+    }
+    if(NULL != copy->owners.offsets)
+    {
+        copy->owners.owned = false;
+        owners_detach(&copy->owners);
+    }
+    if(NULL != copy->subtrees.ends)
+    {
+        copy->subtrees.owned = false;
+        subtrees_detach(&copy->subtrees);
+    }
+    if(NULL != copy->rollups.totals)
+    {
+        copy->rollups.owned = false;
+        rollups_detach(&copy->rollups);
+    }
+}
+
+void index_extend(mole_index_t* index, size_t new_capacity)
+{
+    index_detach(index);
+    index_commit(index, new_capacity);
+}
+
+// Appends entry, whose strings are already stored in index's arena.
+static void index_push(mole_index_t* index, const mole_index_entry_t* entry,
+                       uint64_t size, uint32_t owner_uid, file_type_t file_type)
+{
+    if(index->size >= index->capacity) index_extend(index, index->size + 1);
 
     size_t i = index->size;
     index->elements[i] = *entry;
+    index->sizes[i] = size;
+    index->owner_uids[i] = owner_uid;
+    index->file_types[i] = file_type;
     index->size++;
 }
 
-void index_emplace(mole_index_t* index, const char* filename, const char* full_path,
-                   size_t size, uid_t owner_uid, file_type_t file_type)
+void index_insert(mole_index_t* index, const mole_index_t* source, uint64_t id)
 {
+    index_detach(index);
+
+    const mole_index_entry_t* entry = &source->elements[id];
+    mole_index_entry_t copy = *entry;
+    if(entry->path_offset != MOLE_NO_ENTRY)
+        copy.path_offset = arena_append(&index->strings, source->strings.data + entry->path_offset, entry->path_length);
+    copy.name_offset = arena_append(&index->strings, index_entry_name(source, entry), entry->name_length);
+
+    index_push(index, &copy, source->sizes[id], source->owner_uids[id], source->file_types[id]);
+}
+
+void index_merge(mole_index_t* index, const mole_index_t* source)
+{
+    index_detach(index);
+
+    index_extend(index, index->size + source->size);
+
+    size_t new_strings_capacity = index->strings.capacity;
+    while(index->strings.size + source->strings.size > new_strings_capacity)
+        new_strings_capacity *= 2;
+    arena_extend(&index->strings, new_strings_capacity);
+
+    uint64_t strings_base = index->strings.size;
+    memcpy(index->strings.data + strings_base, source->strings.data, source->strings.size);
+    index->strings.size += source->strings.size;
+
+    for(size_t i = 0; i < source->size; ++i)
+    {
+        mole_index_entry_t* entry = &index->elements[index->size + i];
+        *entry = source->elements[i];
+        entry->name_offset += strings_base;
+        if(entry->path_offset != MOLE_NO_ENTRY) entry->path_offset += strings_base;
+    }
+    memcpy(index->sizes + index->size, source->sizes, source->size * sizeof(uint64_t));
+    memcpy(index->owner_uids + index->size, source->owner_uids, source->size * sizeof(uint32_t));
+    memcpy(index->file_types + index->size, source->file_types, source->size * sizeof(uint8_t));
+    index->size += source->size;
+}
+
+uint64_t index_emplace(mole_index_t* index, const char* filename, const char* full_path,
+                       uint64_t parent, const char* parent_path, const struct stat* stat, file_type_t file_type)
+{
+    index_detach(index);
+
     mole_index_entry_t entry;
-    strncpy(entry.file_name, filename, STR_MAX);
-    if(realpath(full_path, entry.full_path) == NULL) ERROR("realpath");
-    entry.size = size;
-    entry.owner_uid = owner_uid;
-    entry.file_type = file_type;
+    entry.name_length = strnlen(filename, STR_MAX - 1);
+    entry.path_length = strlen(full_path);
+
+    // Path is rebuilt from the parent's one if it is the parent's path followed by the name.
+    // Root is "/" or ends without '/', so there is exactly one separator in between.
+    size_t parent_length = NULL == parent_path ? 0 : strlen(parent_path);
+    size_t separator = parent_length > 0 && parent_path[parent_length - 1] == '/' ? 0 : 1;
+    if(NULL != parent_path && parent != MOLE_NO_ENTRY
+       && parent_length + separator + entry.name_length == entry.path_length
+       && strncmp(full_path, parent_path, parent_length) == 0
+       && (separator == 0 || full_path[parent_length] == '/')
+       && strncmp(full_path + parent_length + separator, filename, entry.name_length) == 0)
+    {
+        entry.path_offset = MOLE_NO_ENTRY;
+        entry.name_offset = arena_append(&index->strings, filename, entry.name_length);
+    }
+    else
+    {
+        entry.path_offset = arena_append(&index->strings, full_path, entry.path_length);
+
+        // Usually file name is the last component of its path, so it doesn't have to be stored twice.
+        // It is not the case e.g. for symbolic links, that are resolved by `realpath()`.
+        const char* path_tail = full_path + entry.path_length - entry.name_length;
+        if(entry.name_length < entry.path_length && path_tail[-1] == '/'
+           && strncmp(path_tail, filename, entry.name_length) == 0)
+            entry.name_offset = entry.path_offset + entry.path_length - entry.name_length;
+        else
+            entry.name_offset = arena_append(&index->strings, filename, entry.name_length);
+    }
+
+    entry.parent = parent;
+    entry.device = stat->st_dev;
+    entry.inode = stat->st_ino;
+    entry.modification_time = stat->st_mtim.tv_sec * 1000000000LL + stat->st_mtim.tv_nsec;
+
+    index_push(index, &entry, stat->st_size, stat->st_uid, file_type);
+
+    return index->size - 1;
+}
+
+bool index_entry_unchanged(const mole_index_t* index, uint64_t id, const struct stat* stat)
+{
+    const mole_index_entry_t* entry = &index->elements[id];
+    return entry->device == (uint64_t) stat->st_dev
+        && entry->inode == (uint64_t) stat->st_ino
+        && entry->modification_time == stat->st_mtim.tv_sec * 1000000000LL + stat->st_mtim.tv_nsec
+        && (index->file_types[id] == Directory || index->sizes[id] == (uint64_t) stat->st_size);
+}
 
-    index_insert(index, &entry);
+void index_remove(mole_index_t* index, uint64_t id)
+{
+    owners_forget(&index->owners, index, id);
+    rollups_forget(&index->rollups, index, id);
+    index->file_types[id] = Removed;
+}
+
+void index_update(mole_index_t* index, uint64_t id, const struct stat* stat)
+{
+    size_order_update(&index->size_order, index, id, stat->st_size);
+    owners_update(&index->owners, index, id, stat->st_uid, stat->st_size);
+    rollups_update(&index->rollups, index, id, stat->st_size);
+
+    index->elements[id].modification_time = stat->st_mtim.tv_sec * 1000000000LL + stat->st_mtim.tv_nsec;
+    index->sizes[id] = stat->st_size;
+    index->owner_uids[id] = stat->st_uid;
+}
+
+void index_remove_subtree(mole_index_t* index, uint64_t id)
+{
+    // Parent may have higher id than its children, so the whole index is checked.
+    for(size_t i = 0; i < index->size; ++i)
+    {
+        uint64_t ancestor = i;
+        while(ancestor != MOLE_NO_ENTRY && ancestor != id)
+            ancestor = index->elements[ancestor].parent;
+
+        if(ancestor == id && i != id)
+            index_remove(index, i);
+    }
+
+    index_remove(index, id);
+}
+
+void index_compact(mole_index_t* index)
+{
+    uint64_t* new_ids = malloc(index->size * sizeof(uint64_t));
+    if(NULL == new_ids) ERROR("malloc");
+
+    mole_index_t compacted;
+    index_init_capacity(&compacted, index->capacity);
+    for(size_t i = 0; i < index->size; ++i)
+    {
+        new_ids[i] = MOLE_NO_ENTRY;
+        if(index->file_types[i] == Removed) continue;
+
+        new_ids[i] = compacted.size;
+        index_insert(&compacted, index, i);
+    }
+
+    for(size_t i = 0, j = 0; i < index->size; ++i)
+    {
+        if(new_ids[i] == MOLE_NO_ENTRY) continue;
+
+        mole_index_entry_t* entry = &compacted.elements[j++];
+        if(entry->parent != MOLE_NO_ENTRY)
+            entry->parent = new_ids[entry->parent];
+
+        // Entry that outlived its parent needs its path stored, as it can't be rebuilt anymore.
+        if(entry->parent == MOLE_NO_ENTRY && entry->path_offset == MOLE_NO_ENTRY)
+        {
+            char path[PATH_MAX];
+            index_entry_path(index, &index->elements[i], path);
+            entry->path_offset = arena_append(&compacted.strings, path, entry->path_length);
+        }
+    }
+
+    free(new_ids);
+    // Type cache doesn't refer to entries, so it is kept as it is.
+    compacted.type_cache = index->type_cache;
+    type_cache_init(&index->type_cache);
+
+    index_free(index);
+    *index = compacted;
+}
+
+void index_order_preorder(mole_index_t* index)
+{
+    index_detach(index);
+    trigrams_free(&index->trigrams);
+    size_order_free(&index->size_order);
+    owners_free(&index->owners);
+    subtrees_free(&index->subtrees);
+    rollups_free(&index->rollups);
+
+    mole_children_t children;
+    children_build(&children, index);
+
+    uint64_t* order = malloc((index->size + 1) * sizeof(uint64_t));
+    uint64_t* new_ids = malloc((index->size + 1) * sizeof(uint64_t));
+    uint64_t* stack = malloc((index->size + 1) * sizeof(uint64_t));
+    if(NULL == order || NULL == new_ids || NULL == stack) ERROR("malloc");
+    for(size_t i = 0; i < index->size; ++i)
+        new_ids[i] = MOLE_NO_ENTRY;
+
+    // Children are pushed in reverse, so that they are visited in order of their ids.
+    size_t count = 0;
+    for(size_t root = 0; root < index->size; ++root)
+    {
+        if(index->elements[root].parent != MOLE_NO_ENTRY) continue;
+
+        size_t depth = 0;
+        stack[depth++] = root;
+        while(depth > 0)
+        {
+            uint64_t id = stack[--depth];
+            new_ids[id] = count;
+            order[count++] = id;
+            for(uint64_t k = children.offsets[id + 1]; k > children.offsets[id]; --k)
+                stack[depth++] = children.ids[k - 1];
+        }
+    }
+    for(size_t i = 0; i < index->size; ++i)
+    {
+        if(new_ids[i] != MOLE_NO_ENTRY) continue;
+        new_ids[i] = count;
+        order[count++] = i;
+    }
+    free(stack);
+    children_free(&children);
+
+    // Entries are permuted into a new reservation, the old one is then released at once.
+    mole_index_t ordered = *index;
+    index_reserve(&ordered, index->capacity, index->reserved);
+    index_commit(&ordered, index->capacity);
+    for(size_t i = 0; i < index->size; ++i)
+    {
+        uint64_t id = order[i];
+        ordered.elements[i] = index->elements[id];
+        if(ordered.elements[i].parent != MOLE_NO_ENTRY)
+            ordered.elements[i].parent = new_ids[ordered.elements[i].parent];
+        ordered.sizes[i] = index->sizes[id];
+        ordered.owner_uids[i] = index->owner_uids[id];
+        ordered.file_types[i] = index->file_types[id];
+    }
+    free(order);
+    free(new_ids);
+
+    if(munmap(index->columns, index_reserved_size(index->reserved))) ERROR("munmap");
+    *index = ordered;
 }
 
 void index_clear(mole_index_t* index)
 {
+    index_detach(index);
+    trigrams_free(&index->trigrams);
+    size_order_free(&index->size_order);
+    owners_free(&index->owners);
+    subtrees_free(&index->subtrees);
+    rollups_free(&index->rollups);
+
+    // Pages are dropped instead of being cleared one by one, they are zeroed again on first use.
     index->size = 0;
-    memset(index->elements, 0, index->capacity * sizeof(mole_index_entry_t));
+    char* columns[] = { (char*) index->elements, (char*) index->sizes, (char*) index->owner_uids, (char*) index->file_types };
+    for(size_t k = 0; k < INDEX_COLUMN_COUNT; ++k)
+        if(madvise(columns[k], index->capacity * index_column_widths[k], MADV_DONTNEED)) ERROR("madvise");
+
+    index->strings.size = 0;
+}
+
+const char* index_entry_name(const mole_index_t* index, const mole_index_entry_t* entry)
+{
+    return index->strings.data + entry->name_offset;
+}
+
+size_t index_entry_path(const mole_index_t* index, const mole_index_entry_t* entry, char* buffer)
+{
+    size_t length = entry->path_length;
+    buffer[length] = '\0';
+
+    // Path is written from its end: names of ancestors are placed before the separator
+    // in front of their child, until an ancestor with stored path is reached.
+    while(entry->path_offset == MOLE_NO_ENTRY)
+    {
+        size_t name_position = entry->path_length - entry->name_length;
+        memcpy(buffer + name_position, index->strings.data + entry->name_offset, entry->name_length);
+        buffer[name_position - 1] = '/';
+        entry = &index->elements[entry->parent];
+    }
+    memcpy(buffer, index->strings.data + entry->path_offset, entry->path_length);
+
+    return length;
+}
+
+void path_builder_init(mole_path_builder_t* builder)
+{
+    builder->index = NULL;
+    builder->parent = MOLE_NO_ENTRY;
+}
+
+const char* path_builder_path(mole_path_builder_t* builder, const mole_index_t* index,
+                              const mole_index_entry_t* entry, size_t* length)
+{
+    *length = entry->path_length;
+    if(entry->path_offset == MOLE_NO_ENTRY && entry->parent == builder->parent && index == builder->index)
+    {
+        // Sibling differs only by its name, which follows the same prefix.
+        memcpy(builder->path + entry->path_length - entry->name_length,
+               index->strings.data + entry->name_offset, entry->name_length + 1);
+        return builder->path;
+    }
+
+    index_entry_path(index, entry, builder->path);
+    builder->index = index;
+    builder->parent = entry->path_offset == MOLE_NO_ENTRY ? entry->parent : MOLE_NO_ENTRY;
+    return builder->path;
+}
+
+// Implementation of FNV-1a, used for hashing paths.
+static uint64_t path_hash(const char* path)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    while(*path)
+    {
+        hash ^= (unsigned char) *path++;
+        hash *= 0x100000001b3;
+    }
+
+    return hash;
+}
+
+// Places entry `id` in the first free slot, without growing the table.
+static void path_table_place(mole_path_table_t* table, const mole_index_t* index, uint64_t id)
+{
+    char path[PATH_MAX];
+    index_entry_path(index, &index->elements[id], path);
+    size_t slot = path_hash(path) & (table->capacity - 1);
+    while(table->slots[slot] != 0)
+        slot = (slot + 1) & (table->capacity - 1);
+    table->slots[slot] = id + 1;
+    table->size++;
+}
+
+void path_table_build(mole_path_table_t* table, const mole_index_t* index)
+{
+    table->size = 0;
+    table->capacity = 16;
+    while(table->capacity < 2 * index->size)
+        table->capacity *= 2;
+
+    table->slots = calloc(table->capacity, sizeof(uint64_t));
+    if(NULL == table->slots) ERROR("calloc");
+
+    for(size_t i = 0; i < index->size; ++i)
+        if(index->file_types[i] != Removed)
+            path_table_place(table, index, i);
+}
+
+void path_table_insert(mole_path_table_t* table, const mole_index_t* index, uint64_t id)
+{
+    if(2 * (table->size + 1) > table->capacity)
+    {
+        uint64_t* old_slots = table->slots;
+        size_t old_capacity = table->capacity;
+
+        table->size = 0;
+        table->capacity *= 2;
+        table->slots = calloc(table->capacity, sizeof(uint64_t));
+        if(NULL == table->slots) ERROR("calloc");
+
+        for(size_t i = 0; i < old_capacity; ++i)
+            if(old_slots[i] != 0)
+                path_table_place(table, index, old_slots[i] - 1);
+        free(old_slots);
+    }
+
+    path_table_place(table, index, id);
+}
+
+void path_table_free(mole_path_table_t* table)
+{
+    table->size = 0;
+    table->capacity = 0;
+    free(table->slots);
+    table->slots = NULL;
+}
+
+uint64_t path_table_find(const mole_path_table_t* table, const mole_index_t* index, const char* path)
+{
+    size_t length = strlen(path);
+    size_t slot = path_hash(path) & (table->capacity - 1);
+    for(; table->slots[slot] != 0; slot = (slot + 1) & (table->capacity - 1))
+    {
+        // Path of a candidate is rebuilt only if its length and name match.
+        uint64_t id = table->slots[slot] - 1;
+        const mole_index_entry_t* entry = &index->elements[id];
+        if(index->file_types[id] == Removed || entry->path_length != length) continue;
+        if(entry->path_offset == MOLE_NO_ENTRY
+           && memcmp(index_entry_name(index, entry), path + length - entry->name_length, entry->name_length) != 0)
+            continue;
+
+        char candidate[PATH_MAX];
+        index_entry_path(index, entry, candidate);
+        if(strcmp(candidate, path) == 0) return id;
+    }
+
+    return MOLE_NO_ENTRY;
+}
+
+void children_build(mole_children_t* children, const mole_index_t* index)
+{
+    children->offsets = calloc(index->size + 1, sizeof(uint64_t));
+    children->ids = malloc((index->size + 1) * sizeof(uint64_t));
+    if(NULL == children->offsets || NULL == children->ids) ERROR("malloc");
+
+    // Counting sort: count children of every directory, then place them.
+    for(size_t i = 0; i < index->size; ++i)
+        if(index->elements[i].parent != MOLE_NO_ENTRY && index->file_types[i] != Removed)
+            children->offsets[index->elements[i].parent + 1]++;
+    for(size_t i = 0; i < index->size; ++i)
+        children->offsets[i + 1] += children->offsets[i];
+
+    uint64_t* next = malloc((index->size + 1) * sizeof(uint64_t));
+    if(NULL == next) ERROR("malloc");
+    memcpy(next, children->offsets, (index->size + 1) * sizeof(uint64_t));
+
+    for(size_t i = 0; i < index->size; ++i)
+        if(index->elements[i].parent != MOLE_NO_ENTRY && index->file_types[i] != Removed)
+            children->ids[next[index->elements[i].parent]++] = i;
+
+    free(next);
+}
+
+void children_free(mole_children_t* children)
+{
+    free(children->offsets);
+    free(children->ids);
+    children->offsets = NULL;
+    children->ids = NULL;
+}
+
+// Implementation of FNV-1a over a memory block, used for checksum of cache header.
+static uint64_t block_hash(uint64_t hash, const void* data, size_t length)
+{
+    const unsigned char* bytes = data;
+    for(size_t i = 0; i < length; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3;
+    }
+
+    return hash;
+}
+
+static uint64_t header_checksum(const mole_index_header_t* header, const mole_section_t* sections)
+{
+    mole_index_header_t copy = *header;
+    copy.checksum = 0;
+
+    uint64_t hash = block_hash(0xcbf29ce484222325, &copy, sizeof(copy));
+    return block_hash(hash, sections, header->section_count * sizeof(mole_section_t));
+}
+
+// Checks header of mapped cache file and returns its section table, or NULL if file is invalid.
+static const mole_section_t* index_check_header(const void* mapping, size_t mapping_size)
+{
+    const mole_index_header_t* header = mapping;
+    if(mapping_size < sizeof(mole_index_header_t)) return NULL;
+    if(memcmp(header->magic, MOLE_INDEX_MAGIC, sizeof(header->magic)) != 0) return NULL;
+    if(header->version != MOLE_INDEX_VERSION || header->endianness != MOLE_INDEX_ENDIANNESS) return NULL;
+    if(header->section_count > MOLE_SECTIONS_MAX) return NULL;
+
+    const mole_section_t* sections = (const mole_section_t*) (header + 1);
+    if(mapping_size < sizeof(mole_index_header_t) + header->section_count * sizeof(mole_section_t)) return NULL;
+    if(header_checksum(header, sections) != header->checksum) return NULL;
+
+    // Truncated file is detected here, as some section would end after end of file.
+    for(uint32_t i = 0; i < header->section_count; ++i)
+    {
+        if(sections[i].offset % MOLE_SECTION_ALIGNMENT != 0) return NULL;
+        if(sections[i].offset > mapping_size || sections[i].length > mapping_size - sections[i].offset) return NULL;
+    }
+
+    return sections;
+}
+
+// Returns section with given id, or NULL if there is none.
+static const mole_section_t* index_find_section(const mole_index_header_t* header, const mole_section_t* sections,
+                                                mole_section_id_t id)
+{
+    for(uint32_t i = 0; i < header->section_count; ++i)
+        if(sections[i].id == id) return &sections[i];
+
+    return NULL;
+}
+
+// Checks that strings of all entries lie inside the arena and that paths can be rebuilt.
+// Every derived path is longer than its parent's one, so rebuilding it always ends.
+static bool index_check_entries(const mole_index_entry_t* elements, size_t size, const mole_string_arena_t* arena)
+{
+    if(arena->size > 0 && arena->data[arena->size - 1] != '\0') return false;
+
+    for(size_t i = 0; i < size; ++i)
+    {
+        const mole_index_entry_t* entry = &elements[i];
+        if(entry->path_length >= PATH_MAX || entry->name_offset >= arena->size || entry->name_length > arena->size - entry->name_offset - 1)
+            return false;
+
+        if(entry->path_offset != MOLE_NO_ENTRY)
+        {
+            if(entry->path_offset >= arena->size || entry->path_length > arena->size - entry->path_offset - 1)
+                return false;
+        }
+        else
+        {
+            // Parent's path is followed by separator, unless it is "/".
+            if(entry->parent >= size || entry->name_length >= entry->path_length) return false;
+            size_t prefix = entry->path_length - entry->name_length;
+
+            size_t parent_length = elements[entry->parent].path_length;
+            if(parent_length >= entry->path_length || (parent_length != prefix - 1 && parent_length != prefix))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+// Checks that all `count` ids are ids of entries of index with `size` entries. Checksum
+// covers only header and section table, so ids used to address entries are checked once here.
+static bool index_check_ids(const uint32_t* ids, size_t count, size_t size)
+{
+    for(size_t i = 0; i < count; ++i)
+        if(ids[i] >= size) return false;
+
+    return true;
+}
+
+// Checks that all `count` types are known ones, as they are used to index arrays of per-type counts.
+static bool index_check_types(const uint8_t* file_types, size_t count)
+{
+    for(size_t i = 0; i < count; ++i)
+        if(file_types[i] >= FILE_TYPE_COUNT) return false;
+
+    return true;
+}
+
+// Checks that all types of occupied slots of the type cache are known ones (they are copied into index).
+static bool index_check_type_records(const mole_type_record_t* records, size_t count)
+{
+    for(size_t i = 0; i < count; ++i)
+        if(records[i].occupied && records[i].file_type >= FILE_TYPE_COUNT) return false;
+
+    return true;
+}
+
+// Checks that `count + 1` offsets of posting lists start at 0, never decrease and end at `total`.
+static bool index_check_offsets(const uint64_t* offsets, size_t count, uint64_t total)
+{
+    if(offsets[0] != 0 || offsets[count] != total) return false;
+    for(size_t i = 0; i < count; ++i)
+        if(offsets[i] > offsets[i + 1]) return false;
+
+    return true;
 }
 
 bool index_read(mole_index_t* index, char* index_path)
@@ -75,29 +903,604 @@ bool index_read(mole_index_t* index, char* index_path)
         else ERROR("open");
     }
 
-    uint64_t index_size;
-    if(read(fd, &index_size, sizeof(index_size)) < 0)  ERROR("read");
+    struct stat file_stat;
+    if(fstat(fd, &file_stat)) ERROR("fstat");
 
-    index_extend(index, index_size);
+    size_t mapping_size = file_stat.st_size;
+    void* mapping = mapping_size == 0 ? MAP_FAILED
+                  : mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(MAP_FAILED == mapping)
+    {
+        fprintf(stderr, "Index cache `%s` is empty or can't be mapped, ignoring it.\n", index_path);
+        return false;
+    }
+
+    const mole_index_header_t* header = mapping;
+    const mole_section_t* sections = index_check_header(mapping, mapping_size);
+    const mole_section_t* entries = NULL;
+    const mole_section_t* sizes = NULL;
+    const mole_section_t* owner_uids = NULL;
+    const mole_section_t* file_types = NULL;
+    const mole_section_t* strings = NULL;
+    if(NULL != sections)
+    {
+        entries = index_find_section(header, sections, Section_Entries);
+        sizes = index_find_section(header, sections, Section_Sizes);
+        owner_uids = index_find_section(header, sections, Section_Owner_Uid_Column);
+        file_types = index_find_section(header, sections, Section_File_Types);
+        strings = index_find_section(header, sections, Section_Strings);
+    }
+
+    // String arena is the only section decoded into memory, it is checked together with entries.
+    mole_string_arena_t arena = { .size = 0, .capacity = 0, .data = NULL };
+    bool valid = NULL != entries && NULL != sizes && NULL != owner_uids && NULL != file_types && NULL != strings
+              && entries->length == header->entry_count * sizeof(mole_index_entry_t)
+              && sizes->length == header->entry_count * sizeof(uint64_t)
+              && owner_uids->length == header->entry_count * sizeof(uint32_t)
+              && file_types->length == header->entry_count * sizeof(uint8_t);
+    if(valid)
+    {
+        const char* packed = (char*) mapping + strings->offset;
+        arena.size = pack_unpacked_length(packed, strings->length);
+        valid = arena.size < SIZE_MAX && (arena.data = malloc(arena.size + 1)) != NULL
+             && unpack_strings(packed, strings->length, arena.data)
+             && index_check_entries((mole_index_entry_t*) ((char*) mapping + entries->offset), header->entry_count, &arena)
+             && index_check_types((const uint8_t*) ((char*) mapping + file_types->offset), header->entry_count);
+        arena.capacity = arena.size + 1;
+    }
+    if(!valid)
+    {
+        fprintf(stderr, "Index cache `%s` is invalid or was written by different version, ignoring it.\n", index_path);
+        free(arena.data);
+        munmap(mapping, mapping_size);
+        return false;
+    }
 
-    if(read(fd, index->elements, index_size * sizeof(mole_index_entry_t)) < 0) ERROR("read");
+    index_free(index);
+    index->mapping = mapping;
+    index->mapping_size = mapping_size;
+    index->size = header->entry_count;
+    index->capacity = header->entry_count;
+    index->elements = (mole_index_entry_t*) ((char*) mapping + entries->offset);
+    index->sizes = (uint64_t*) ((char*) mapping + sizes->offset);
+    index->owner_uids = (uint32_t*) ((char*) mapping + owner_uids->offset);
+    index->file_types = (uint8_t*) ((char*) mapping + file_types->offset);
+    index->strings = arena;
 
-    index->size = index_size;
+    // Trigram index is optional, it is built after loading if it is missing.
+    const mole_section_t* keys = index_find_section(header, sections, Section_Trigram_Keys);
+    const mole_section_t* offsets = index_find_section(header, sections, Section_Trigram_Offsets);
+    const mole_section_t* postings = index_find_section(header, sections, Section_Trigram_Postings);
+    if(NULL != keys && NULL != offsets && NULL != postings
+       && offsets->length == keys->length / sizeof(uint32_t) * sizeof(uint64_t) + sizeof(uint64_t))
+    {
+        mole_trigrams_t* trigrams = &index->trigrams;
+        trigrams->key_count = keys->length / sizeof(uint32_t);
+        trigrams->keys = (uint32_t*) ((char*) mapping + keys->offset);
+        trigrams->offsets = (uint64_t*) ((char*) mapping + offsets->offset);
+        trigrams->postings = (uint32_t*) ((char*) mapping + postings->offset);
+        trigrams->owned = false;
+        trigrams->indexed = index->size;
 
-    close(fd);
+        size_t posting_count = postings->length / sizeof(uint32_t);
+        if(posting_count * sizeof(uint32_t) != postings->length
+           || !index_check_offsets(trigrams->offsets, trigrams->key_count, posting_count)
+           || !index_check_ids(trigrams->postings, posting_count, index->size))
+            trigrams_init(trigrams);
+    }
+
+    const mole_section_t* type_cache = index_find_section(header, sections, Section_Type_Cache);
+    size_t type_capacity = NULL == type_cache ? 0 : type_cache->length / sizeof(mole_type_record_t);
+    if(type_capacity > 0 && (type_capacity & (type_capacity - 1)) == 0
+       && type_cache->length == type_capacity * sizeof(mole_type_record_t)
+       && index_check_type_records((const mole_type_record_t*) ((char*) mapping + type_cache->offset), type_capacity))
+    {
+        index->type_cache.capacity = type_capacity;
+        index->type_cache.slots = (mole_type_record_t*) ((char*) mapping + type_cache->offset);
+        index->type_cache.owned = false;
+    }
+
+    const mole_section_t* size_order = index_find_section(header, sections, Section_Size_Order);
+    if(NULL != size_order && size_order->length == index->size * sizeof(uint32_t)
+       && index_check_ids((const uint32_t*) ((char*) mapping + size_order->offset), index->size, index->size))
+    {
+        index->size_order.ids = (uint32_t*) ((char*) mapping + size_order->offset);
+        index->size_order.owned = false;
+        index->size_order.indexed = index->size;
+    }
+
+    // Ranges are used for scanning, so every one of them has to lie inside the index.
+    const mole_section_t* subtree_ends = index_find_section(header, sections, Section_Subtree_Ends);
+    if(NULL != subtree_ends && subtree_ends->length == index->size * sizeof(uint32_t))
+    {
+        const uint32_t* ends = (const uint32_t*) ((char*) mapping + subtree_ends->offset);
+        size_t i = 0;
+        while(i < index->size && ends[i] > i && ends[i] <= index->size)
+            i++;
+
+        if(i == index->size)
+        {
+            index->subtrees.ends = (uint32_t*) ends;
+            index->subtrees.owned = false;
+            index->subtrees.indexed = index->size;
+        }
+    }
+
+    // Totals are only valid together with subtree ranges they were computed from.
+    const mole_section_t* subtree_totals = index_find_section(header, sections, Section_Subtree_Totals);
+    if(NULL != subtree_totals && subtree_totals->length == index->size * sizeof(uint64_t)
+       && index->subtrees.indexed == index->size)
+    {
+        index->rollups.totals = (uint64_t*) ((char*) mapping + subtree_totals->offset);
+        index->rollups.owned = false;
+        index->rollups.indexed = index->size;
+    }
+
+    const mole_section_t* uids = index_find_section(header, sections, Section_Owner_Uids);
+    const mole_section_t* owner_offsets = index_find_section(header, sections, Section_Owner_Offsets);
+    const mole_section_t* owner_ids = index_find_section(header, sections, Section_Owner_Ids);
+    const mole_section_t* counts = index_find_section(header, sections, Section_Owner_Counts);
+    const mole_section_t* bytes = index_find_section(header, sections, Section_Owner_Bytes);
+    if(NULL != uids && NULL != owner_offsets && NULL != owner_ids && NULL != counts && NULL != bytes)
+    {
+        size_t owner_count = uids->length / sizeof(uint32_t);
+        size_t summary_length = owner_count * FILE_TYPE_COUNT * sizeof(uint64_t);
+        if(owner_offsets->length == (owner_count + 1) * sizeof(uint64_t) && counts->length == summary_length
+           && bytes->length == summary_length && owner_ids->length <= index->size * sizeof(uint32_t))
+        {
+            mole_owners_t* owners = &index->owners;
+            owners->owner_count = owner_count;
+            owners->uids = (uint32_t*) ((char*) mapping + uids->offset);
+            owners->offsets = (uint64_t*) ((char*) mapping + owner_offsets->offset);
+            owners->ids = (uint32_t*) ((char*) mapping + owner_ids->offset);
+            owners->counts = (uint64_t*) ((char*) mapping + counts->offset);
+            owners->bytes = (uint64_t*) ((char*) mapping + bytes->offset);
+            owners->owned = false;
+            owners->indexed = index->size;
+
+            size_t id_count = owner_ids->length / sizeof(uint32_t);
+            if(id_count * sizeof(uint32_t) != owner_ids->length
+               || !index_check_offsets(owners->offsets, owner_count, id_count)
+               || !index_check_ids(owners->ids, id_count, index->size))
+                owners_init(owners);
+        }
+    }
 
     return true;
 }
 
+// Buffer gathering small writes (header, padding, small sections) into large sequential ones.
+typedef struct index_writer
+{
+    int fd;             // File being written
+    size_t used;        // Number of bytes waiting in the buffer
+    char* buffer;       // MOLE_WRITE_BUFFER_SIZE bytes
+} index_writer_t;
+
+static void index_writer_flush(index_writer_t* writer)
+{
+    if(bulk_write(writer->fd, writer->buffer, writer->used) < 0) ERROR("write");
+    writer->used = 0;
+}
+
+static void index_writer_write(index_writer_t* writer, const void* data, size_t length)
+{
+    // Blocks larger than the buffer are written directly, without copying.
+    if(writer->used + length > MOLE_WRITE_BUFFER_SIZE)
+        index_writer_flush(writer);
+    if(length >= MOLE_WRITE_BUFFER_SIZE)
+    {
+        if(bulk_write(writer->fd, data, length) < 0) ERROR("write");
+        return;
+    }
+
+    memcpy(writer->buffer + writer->used, data, length);
+    writer->used += length;
+}
+
+// Writes zeros, so that the next section begins at aligned offset.
+static uint64_t index_write_padding(index_writer_t* writer, uint64_t offset)
+{
+    static const char zeros[MOLE_SECTION_ALIGNMENT] = {0};
+
+    uint64_t padding = (MOLE_SECTION_ALIGNMENT - offset % MOLE_SECTION_ALIGNMENT) % MOLE_SECTION_ALIGNMENT;
+    index_writer_write(writer, zeros, padding);
+
+    return offset + padding;
+}
+
+// Flushes directory containing `path` to disk, so that renaming the file is durable.
+static void index_sync_directory(const char* path)
+{
+    char directory[PATH_MAX];
+    const char* separator = strrchr(path, '/');
+    if(NULL == separator)
+        strcpy(directory, ".");
+    else if(separator == path)
+        strcpy(directory, "/");
+    else
+    {
+        memcpy(directory, path, separator - path);
+        directory[separator - path] = '\0';
+    }
+
+    int fd = open(directory, O_RDONLY | O_DIRECTORY);
+    if(fd < 0) ERROR("open");
+    if(fsync(fd)) ERROR("fsync");
+    if(close(fd)) ERROR("close");
+}
+
 void index_save(mole_index_t* index, char* index_path)
 {
-    int fd = open(index_path, O_CREAT | O_WRONLY, DEFAULT_MASK);
+    char temporary_path[PATH_MAX];
+    if(snprintf(temporary_path, PATH_MAX, "%s.tmp", index_path) >= PATH_MAX) ERROR("snprintf");
+
+    uint64_t start = stats_now();
+    int fd = open(temporary_path, O_CREAT | O_WRONLY | O_TRUNC, DEFAULT_MASK);
     if(fd < 0) ERROR("open");
 
-    uint64_t index_size = index->size;
-    if(write(fd, &index_size, sizeof(index_size)) < 0) ERROR("write");
+    const void* data[MOLE_SECTIONS_MAX];
+    mole_section_t sections[MOLE_SECTIONS_MAX];
+    memset(sections, 0, sizeof(sections));
+    uint32_t section_count = 0;
 
-    if(write(fd, index->elements, index_size * sizeof(mole_index_entry_t)) < 0) ERROR("write");
+    sections[section_count] = (mole_section_t) { .id = Section_Entries, .length = index->size * sizeof(mole_index_entry_t) };
+    data[section_count++] = index->elements;
+    sections[section_count] = (mole_section_t) { .id = Section_Sizes, .length = index->size * sizeof(uint64_t) };
+    data[section_count++] = index->sizes;
+    sections[section_count] = (mole_section_t) { .id = Section_Owner_Uid_Column, .length = index->size * sizeof(uint32_t) };
+    data[section_count++] = index->owner_uids;
+    sections[section_count] = (mole_section_t) { .id = Section_File_Types, .length = index->size * sizeof(uint8_t) };
+    data[section_count++] = index->file_types;
+    size_t packed_length;
+    char* packed = pack_strings(index->strings.data, index->strings.size, &packed_length);
+    sections[section_count] = (mole_section_t) { .id = Section_Strings, .length = packed_length };
+    data[section_count++] = packed;
 
-    close(fd);
+    // Trigram index is saved only if it covers all entries.
+    const mole_trigrams_t* trigrams = &index->trigrams;
+    if(NULL != trigrams->offsets && trigrams->indexed == index->size)
+    {
+        sections[section_count] = (mole_section_t) { .id = Section_Trigram_Keys, .length = trigrams->key_count * sizeof(uint32_t) };
+        data[section_count++] = trigrams->keys;
+        sections[section_count] = (mole_section_t) { .id = Section_Trigram_Offsets, .length = (trigrams->key_count + 1) * sizeof(uint64_t) };
+        data[section_count++] = trigrams->offsets;
+        sections[section_count] = (mole_section_t) { .id = Section_Trigram_Postings, .length = trigrams->offsets[trigrams->key_count] * sizeof(uint32_t) };
+        data[section_count++] = trigrams->postings;
+    }
+
+    const mole_size_order_t* size_order = &index->size_order;
+    if(NULL != size_order->ids && size_order->indexed == index->size)
+    {
+        sections[section_count] = (mole_section_t) { .id = Section_Size_Order, .length = index->size * sizeof(uint32_t) };
+        data[section_count++] = size_order->ids;
+    }
+
+    const mole_owners_t* owners = &index->owners;
+    if(NULL != owners->offsets && owners->indexed == index->size)
+    {
+        size_t summary_length = owners->owner_count * FILE_TYPE_COUNT * sizeof(uint64_t);
+        sections[section_count] = (mole_section_t) { .id = Section_Owner_Uids, .length = owners->owner_count * sizeof(uint32_t) };
+        data[section_count++] = owners->uids;
+        sections[section_count] = (mole_section_t) { .id = Section_Owner_Offsets, .length = (owners->owner_count + 1) * sizeof(uint64_t) };
+        data[section_count++] = owners->offsets;
+        sections[section_count] = (mole_section_t) { .id = Section_Owner_Ids, .length = owners->offsets[owners->owner_count] * sizeof(uint32_t) };
+        data[section_count++] = owners->ids;
+        sections[section_count] = (mole_section_t) { .id = Section_Owner_Counts, .length = summary_length };
+        data[section_count++] = owners->counts;
+        sections[section_count] = (mole_section_t) { .id = Section_Owner_Bytes, .length = summary_length };
+        data[section_count++] = owners->bytes;
+    }
+
+    const mole_subtrees_t* subtrees = &index->subtrees;
+    if(NULL != subtrees->ends && subtrees->indexed == index->size)
+    {
+        sections[section_count] = (mole_section_t) { .id = Section_Subtree_Ends, .length = index->size * sizeof(uint32_t) };
+        data[section_count++] = subtrees->ends;
+    }
+
+    const mole_rollups_t* rollups = &index->rollups;
+    if(NULL != rollups->totals && rollups->indexed == index->size)
+    {
+        sections[section_count] = (mole_section_t) { .id = Section_Subtree_Totals, .length = index->size * sizeof(uint64_t) };
+        data[section_count++] = rollups->totals;
+    }
+
+    const mole_type_cache_t* type_cache = &index->type_cache;
+    if(type_cache->capacity > 0)
+    {
+        sections[section_count] = (mole_section_t) { .id = Section_Type_Cache, .length = type_cache->capacity * sizeof(mole_type_record_t) };
+        data[section_count++] = type_cache->slots;
+    }
+
+    uint64_t offset = sizeof(mole_index_header_t) + section_count * sizeof(mole_section_t);
+    for(uint32_t i = 0; i < section_count; ++i)
+    {
+        offset += (MOLE_SECTION_ALIGNMENT - offset % MOLE_SECTION_ALIGNMENT) % MOLE_SECTION_ALIGNMENT;
+        sections[i].offset = offset;
+        offset += sections[i].length;
+    }
+
+    mole_index_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MOLE_INDEX_MAGIC, sizeof(header.magic));
+    header.version = MOLE_INDEX_VERSION;
+    header.endianness = MOLE_INDEX_ENDIANNESS;
+    header.entry_count = index->size;
+    header.section_count = section_count;
+    header.checksum = header_checksum(&header, sections);
+
+    index_writer_t writer = { .fd = fd, .used = 0, .buffer = malloc(MOLE_WRITE_BUFFER_SIZE) };
+    if(NULL == writer.buffer) ERROR("malloc");
+
+    index_writer_write(&writer, &header, sizeof(header));
+    index_writer_write(&writer, sections, section_count * sizeof(mole_section_t));
+
+    offset = sizeof(header) + section_count * sizeof(mole_section_t);
+    for(uint32_t i = 0; i < section_count; ++i)
+    {
+        offset = index_write_padding(&writer, offset);
+        index_writer_write(&writer, data[i], sections[i].length);
+        offset += sections[i].length;
+    }
+
+    index_writer_flush(&writer);
+    free(writer.buffer);
+    free(packed);
+
+    // File has to be on disk before it replaces the previous one, otherwise
+    // crash right after renaming could leave empty or partial cache behind.
+    if(fsync(fd)) ERROR("fsync");
+    if(close(fd)) ERROR("close");
+
+    if(rename(temporary_path, index_path)) ERROR("rename");
+    index_sync_directory(index_path);
+
+    stats_add(Stat_Saves, 1);
+    stats_add(Stat_Bytes_Written, offset);
+    stats_record(Stat_Save_Time, start);
+}
+
+// Cache file written section by section, whose lengths aren't known in advance.
+// Space for header and the largest section table is left at the beginning of the file,
+// they are written there once all sections are.
+typedef struct index_stream
+{
+    index_writer_t writer;                          // Buffer of written data
+    uint64_t offset;                                // Offset of the next written byte
+    uint32_t section_count;                         // Number of sections begun so far
+    mole_section_t sections[MOLE_SECTIONS_MAX];     // Section table
+} index_stream_t;
+
+// Begins new section at the next aligned offset.
+static void index_stream_begin(index_stream_t* stream, mole_section_id_t id)
+{
+    stream->offset = index_write_padding(&stream->writer, stream->offset);
+    stream->sections[stream->section_count++] = (mole_section_t) { .id = id, .offset = stream->offset, .length = 0 };
+}
+
+// Appends data to the last begun section.
+static void index_stream_write(index_stream_t* stream, const void* data, size_t length)
+{
+    index_writer_write(&stream->writer, data, length);
+    stream->offset += length;
+    stream->sections[stream->section_count - 1].length += length;
+}
+
+static void index_stream_section(index_stream_t* stream, mole_section_id_t id, const void* data, size_t length)
+{
+    index_stream_begin(stream, id);
+    index_stream_write(stream, data, length);
+}
+
+// Makes room for at least `count + 1` elements of growing array.
+static void* index_stream_grow(void* array, size_t* capacity, size_t count, size_t element_size)
+{
+    if(count < *capacity) return array;
+
+    *capacity = *capacity < 64 ? 64 : 2 * *capacity;
+    array = realloc(array, *capacity * element_size);
+    if(NULL == array) ERROR("realloc");
+
+    return array;
+}
+
+// Writes posting lists of trigrams, followed by their keys and offsets.
+static void index_stream_trigrams(index_stream_t* stream, const mole_index_t* index, char* index_path, size_t memory_limit)
+{
+    mole_spill_t spill;
+    spill_init(&spill, memory_limit, index_path);
+
+    uint32_t buffer[STR_MAX];
+    for(size_t i = 0; i < index->size; ++i)
+    {
+        if(index->file_types[i] == Removed) continue;
+
+        const mole_index_entry_t* entry = &index->elements[i];
+        size_t count = trigrams_extract(index_entry_name(index, entry), entry->name_length, buffer);
+        for(size_t j = 0; j < count; ++j)
+            spill_add(&spill, buffer[j], i);
+    }
+    spill_finish(&spill);
+
+    // Records come sorted by trigram, then by id, so every posting list ends up sorted.
+    size_t key_count = 0, capacity = 0;
+    uint32_t* keys = NULL;
+    uint64_t* offsets = NULL;
+    uint64_t posting_count = 0;
+    spill_record_t record;
+    index_stream_begin(stream, Section_Trigram_Postings);
+    while(spill_next(&spill, &record))
+    {
+        if(key_count == 0 || keys[key_count - 1] != record.key)
+        {
+            size_t offsets_capacity = capacity;
+            keys = index_stream_grow(keys, &capacity, key_count, sizeof(uint32_t));
+            offsets = index_stream_grow(offsets, &offsets_capacity, key_count, sizeof(uint64_t));
+            keys[key_count] = record.key;
+            offsets[key_count++] = posting_count;
+        }
+
+        uint32_t id = record.id;
+        index_stream_write(stream, &id, sizeof(uint32_t));
+        posting_count++;
+    }
+    spill_free(&spill);
+
+    offsets = index_stream_grow(offsets, &capacity, key_count, sizeof(uint64_t));
+    offsets[key_count] = posting_count;
+    index_stream_section(stream, Section_Trigram_Keys, keys, key_count * sizeof(uint32_t));
+    index_stream_section(stream, Section_Trigram_Offsets, offsets, (key_count + 1) * sizeof(uint64_t));
+
+    free(keys);
+    free(offsets);
+}
+
+// Writes ids of all entries sorted by size (ties by id).
+static void index_stream_size_order(index_stream_t* stream, const mole_index_t* index, char* index_path, size_t memory_limit)
+{
+    mole_spill_t spill;
+    spill_init(&spill, memory_limit, index_path);
+    for(size_t i = 0; i < index->size; ++i)
+        spill_add(&spill, index->sizes[i], i);
+    spill_finish(&spill);
+
+    spill_record_t record;
+    index_stream_begin(stream, Section_Size_Order);
+    while(spill_next(&spill, &record))
+    {
+        uint32_t id = record.id;
+        index_stream_write(stream, &id, sizeof(uint32_t));
+    }
+    spill_free(&spill);
+}
+
+// Writes posting lists of owners, followed by their uids, offsets and summaries.
+static void index_stream_owners(index_stream_t* stream, const mole_index_t* index, char* index_path, size_t memory_limit)
+{
+    mole_spill_t spill;
+    spill_init(&spill, memory_limit, index_path);
+    for(size_t i = 0; i < index->size; ++i)
+        if(index->file_types[i] != Removed)
+            spill_add(&spill, index->owner_uids[i], i);
+    spill_finish(&spill);
+
+    size_t owner_count = 0, capacity = 0;
+    uint32_t* uids = NULL;
+    uint64_t* offsets = NULL;
+    uint64_t* counts = NULL;
+    uint64_t* bytes = NULL;
+    uint64_t id_count = 0;
+    spill_record_t record;
+    index_stream_begin(stream, Section_Owner_Ids);
+    while(spill_next(&spill, &record))
+    {
+        if(owner_count == 0 || uids[owner_count - 1] != record.key)
+        {
+            size_t offsets_capacity = capacity, counts_capacity = capacity, bytes_capacity = capacity;
+            uids = index_stream_grow(uids, &capacity, owner_count, sizeof(uint32_t));
+            offsets = index_stream_grow(offsets, &offsets_capacity, owner_count, sizeof(uint64_t));
+            counts = index_stream_grow(counts, &counts_capacity, owner_count, FILE_TYPE_COUNT * sizeof(uint64_t));
+            bytes = index_stream_grow(bytes, &bytes_capacity, owner_count, FILE_TYPE_COUNT * sizeof(uint64_t));
+            memset(counts + owner_count * FILE_TYPE_COUNT, 0, FILE_TYPE_COUNT * sizeof(uint64_t));
+            memset(bytes + owner_count * FILE_TYPE_COUNT, 0, FILE_TYPE_COUNT * sizeof(uint64_t));
+            uids[owner_count] = record.key;
+            offsets[owner_count++] = id_count;
+        }
+
+        size_t k = owner_count - 1;
+        counts[k * FILE_TYPE_COUNT + index->file_types[record.id]]++;
+        bytes[k * FILE_TYPE_COUNT + index->file_types[record.id]] += index->sizes[record.id];
+
+        uint32_t id = record.id;
+        index_stream_write(stream, &id, sizeof(uint32_t));
+        id_count++;
+    }
+    spill_free(&spill);
+
+    offsets = index_stream_grow(offsets, &capacity, owner_count, sizeof(uint64_t));
+    offsets[owner_count] = id_count;
+    size_t summary_length = owner_count * FILE_TYPE_COUNT * sizeof(uint64_t);
+    index_stream_section(stream, Section_Owner_Uids, uids, owner_count * sizeof(uint32_t));
+    index_stream_section(stream, Section_Owner_Offsets, offsets, (owner_count + 1) * sizeof(uint64_t));
+    index_stream_section(stream, Section_Owner_Counts, counts, summary_length);
+    index_stream_section(stream, Section_Owner_Bytes, bytes, summary_length);
+
+    free(uids);
+    free(offsets);
+    free(counts);
+    free(bytes);
+}
+
+void index_save_spilled(const mole_index_t* index, char* index_path, size_t memory_limit)
+{
+    char temporary_path[PATH_MAX];
+    if(snprintf(temporary_path, PATH_MAX, "%s.tmp", index_path) >= PATH_MAX) ERROR("snprintf");
+
+    uint64_t start = stats_now();
+    int fd = open(temporary_path, O_CREAT | O_WRONLY | O_TRUNC, DEFAULT_MASK);
+    if(fd < 0) ERROR("open");
+
+    index_stream_t stream;
+    memset(&stream, 0, sizeof(stream));
+    stream.offset = sizeof(mole_index_header_t) + MOLE_SECTIONS_MAX * sizeof(mole_section_t);
+    stream.writer = (index_writer_t) { .fd = fd, .used = 0, .buffer = malloc(MOLE_WRITE_BUFFER_SIZE) };
+    if(NULL == stream.writer.buffer) ERROR("malloc");
+    if(lseek(fd, stream.offset, SEEK_SET) < 0) ERROR("lseek");
+
+    index_stream_section(&stream, Section_Entries, index->elements, index->size * sizeof(mole_index_entry_t));
+    index_stream_section(&stream, Section_Sizes, index->sizes, index->size * sizeof(uint64_t));
+    index_stream_section(&stream, Section_Owner_Uid_Column, index->owner_uids, index->size * sizeof(uint32_t));
+    index_stream_section(&stream, Section_File_Types, index->file_types, index->size * sizeof(uint8_t));
+    size_t packed_length;
+    char* packed = pack_strings(index->strings.data, index->strings.size, &packed_length);
+    index_stream_section(&stream, Section_Strings, packed, packed_length);
+    free(packed);
+
+    // Structures below store entry ids in 32 bits, like the ones built in memory.
+    if(index->size <= UINT32_MAX)
+    {
+        index_stream_trigrams(&stream, index, index_path, memory_limit);
+        index_stream_size_order(&stream, index, index_path, memory_limit);
+        index_stream_owners(&stream, index, index_path, memory_limit);
+    }
+
+    const mole_subtrees_t* subtrees = &index->subtrees;
+    if(NULL != subtrees->ends && subtrees->indexed == index->size)
+        index_stream_section(&stream, Section_Subtree_Ends, subtrees->ends, index->size * sizeof(uint32_t));
+
+    const mole_rollups_t* rollups = &index->rollups;
+    if(NULL != rollups->totals && rollups->indexed == index->size)
+        index_stream_section(&stream, Section_Subtree_Totals, rollups->totals, index->size * sizeof(uint64_t));
+
+    const mole_type_cache_t* type_cache = &index->type_cache;
+    if(type_cache->capacity > 0)
+        index_stream_section(&stream, Section_Type_Cache, type_cache->slots, type_cache->capacity * sizeof(mole_type_record_t));
+
+    index_writer_flush(&stream.writer);
+    free(stream.writer.buffer);
+
+    mole_index_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MOLE_INDEX_MAGIC, sizeof(header.magic));
+    header.version = MOLE_INDEX_VERSION;
+    header.endianness = MOLE_INDEX_ENDIANNESS;
+    header.entry_count = index->size;
+    header.section_count = stream.section_count;
+    header.checksum = header_checksum(&header, stream.sections);
+
+    if(pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) ERROR("pwrite");
+    size_t table_length = stream.section_count * sizeof(mole_section_t);
+    if(pwrite(fd, stream.sections, table_length, sizeof(header)) != (ssize_t) table_length) ERROR("pwrite");
+
+    if(fsync(fd)) ERROR("fsync");
+    if(close(fd)) ERROR("close");
+
+    if(rename(temporary_path, index_path)) ERROR("rename");
+    index_sync_directory(index_path);
+
+    stats_add(Stat_Saves, 1);
+    stats_add(Stat_Bytes_Written, stream.offset);
+    stats_record(Stat_Save_Time, start);
 }
@@ -1,77 +1,367 @@
 #pragma once
 
 #include <stdint.h>
+#include <sys/stat.h>
 
 #include "common.h"
+#include "owners.h"
+#include "rollup.h"
+#include "size_order.h"
+#include "subtree.h"
+#include "trigram.h"
+#include "type_cache.h"
 
 #define MOLE_DIR_VAR "MOLE_DIR"
 #define MOLE_INDEX_PATH_VAR "MOLE_INDEX_PATH"
 #define MOLE_INDEX_NAME_DEFAULT "/.mole-index"
 #define MOLE_DEFAULT_CAPACITY 20
+#define MOLE_SEGMENT_ENTRIES (1 << 16)
+#define MOLE_MAX_ENTRIES (1ULL << 30)
+#define MOLE_ARENA_DEFAULT_CAPACITY 4096
 #define DEFAULT_MASK 0644
+#define MOLE_NO_ENTRY UINT64_MAX
+
+// Cache file format. See `mole_index_header_t`.
+#define MOLE_INDEX_MAGIC "MOLEIDX"
+#define MOLE_INDEX_VERSION 5
+#define MOLE_INDEX_ENDIANNESS 0x01020304
+#define MOLE_SECTION_ALIGNMENT 64
+#define MOLE_SECTIONS_MAX 32
+#define MOLE_WRITE_BUFFER_SIZE (1 << 20)
+
+// Types of files program recognizes: X(type, letter, description, summary name).
+// Letter and description are shown in listings, summary name is used by `count` and `usage`.
+// Order of types is stored in cache file, update MOLE_INDEX_VERSION after changing it.
+#define MOLE_FILE_TYPES(X) \
+    X(Directory,         'd', "Directory",                 "Directories") \
+    X(Image_JPEG,        'j', "JPEG image",                "JPEG Images") \
+    X(Image_PNG,         'p', "PNG image",                 "PNG Images") \
+    X(Image_GIF,         'f', "GIF image",                 "GIF Images") \
+    X(Image_WEBP,        'w', "WebP image",                "WebP Images") \
+    X(Image_BMP,         'b', "BMP image",                 "BMP Images") \
+    X(Image_TIFF,        't', "TIFF image",                "TIFF Images") \
+    X(Document_PDF,      'P', "PDF document",              "PDF Documents") \
+    X(Document_OOXML,    'o', "Office Open XML document",  "Office Open XML Documents") \
+    X(Document_ODF,      'O', "OpenDocument file",         "OpenDocument Files") \
+    X(Document_EPUB,     'e', "EPUB book",                 "EPUB Books") \
+    X(Archive_JAR,       'J', "Java archive",              "Java Archives") \
+    X(Compressed_ZIP,    'z', "compressed ZIP file",       "ZIP Compressed Files") \
+    X(Compressed_GZIP,   'g', "compressed GZIP file",      "GZIP Compressed Files") \
+    X(Compressed_ZSTD,   's', "compressed Zstandard file", "Zstandard Compressed Files") \
+    X(Compressed_XZ,     'x', "compressed XZ file",        "XZ Compressed Files") \
+    X(Compressed_BZIP2,  'B', "compressed BZIP2 file",     "BZIP2 Compressed Files") \
+    X(Archive_7Z,        '7', "7-Zip archive",             "7-Zip Archives") \
+    X(Archive_RAR,       'r', "RAR archive",               "RAR Archives") \
+    X(Archive_TAR,       'T', "TAR archive",               "TAR Archives") \
+    X(Executable_ELF,    'E', "ELF executable",            "ELF Executables") \
+    X(Audio_MP3,         'm', "MP3 audio",                 "MP3 Audio Files") \
+    X(Audio_FLAC,        'F', "FLAC audio",                "FLAC Audio Files") \
+    X(Audio_OGG,         'v', "Ogg media",                 "Ogg Media Files") \
+    X(Audio_WAV,         'W', "WAV audio",                 "WAV Audio Files") \
+    X(Video_AVI,         'a', "AVI video",                 "AVI Videos") \
+    X(Video_MP4,         'M', "MP4 video",                 "MP4 Videos") \
+    X(Database_SQLITE,   'q', "SQLite database",           "SQLite Databases")
 
 // Program scans for there types of files.
 typedef enum file_type
 {
     Unrecognized,       // Other file types
-    Directory,          // Ordinary directory
-    Image_JPEG,         // JPEG image
-    Image_PNG,          // PNG image
-    Compressed_GZIP,    // File compressed using gzip
-    Compressed_ZIP      // File compressed using zip (including format such as .docx, .odt, etc.)
+#define X(type, letter, description, summary_name) type,
+    MOLE_FILE_TYPES(X)
+#undef X
+    Removed             // Entry of file that no longer exists (see `index_remove()`)
 } file_type_t;
 
+#define FILE_TYPE_COUNT (Removed + 1)
+
+// Buffer holding all strings (file names and paths) of an index, one after another.
+// Every string is terminated with '\0', so it can be used directly by C functions.
+// Strings are referenced by their offset, because the buffer moves when it grows.
+typedef struct mole_string_arena
+{
+    size_t size;        // Number of bytes currently used.
+    size_t capacity;    // True size of the buffer.
+    char* data;         // Dynamic buffer of strings.
+} mole_string_arena_t;
+
 // Represents single entry inside program's index.
+// Entry doesn't store strings itself, only references into index's string arena.
+// Attributes scanned by queries (size, owner, type) are not part of the entry,
+// they are stored in separate columns of the index (see `mole_index_t`).
+//
+// Full path of an entry is usually path of its parent followed by its name, so only
+// the name is stored and path is rebuilt when needed (see `index_entry_path()`).
+// Path is stored only for entries anchoring the tree: roots of traversal and files
+// whose path without symbolic links leads somewhere else than through their parent.
 typedef struct mole_index_entry
 {
-    char file_name[STR_MAX];    // File name (name and extension)
-    char full_path[PATH_MAX];   // Full file path (path, name and extension)
-    uint64_t size;              // Size of file (in bytes)
-    uid_t owner_uid;            // File owner's id
-    file_type_t file_type;      // Type of file
+    uint64_t name_offset;       // Offset of file name (name and extension)
+    uint64_t path_offset;       // Offset of full file path, if it is stored (MOLE_NO_ENTRY otherwise)
+    uint32_t name_length;       // Length of file name (without '\0')
+    uint32_t path_length;       // Length of full file path (without '\0'), always less than PATH_MAX
+    uint64_t parent;            // Id of directory containing the file (MOLE_NO_ENTRY for root)
+    uint64_t device;            // Id of device containing the file
+    uint64_t inode;             // File's inode number
+    int64_t modification_time;  // Time of last modification (in nanoseconds)
 } mole_index_entry_t;
 
-// Index is stored as a single dynamic array. The array is usually bigger than it needs.
-// When inserting new elements, it eventually becomes full. If this happens,
-// new array is created (twice the size) and the elements are copied over.
+// Sections of cache file.
+typedef enum mole_section_id
+{
+    Section_Entries = 1,            // Array of `mole_index_entry_t`
+    Section_Strings = 2,            // Contents of string arena, packed (see pack.h)
+    Section_Trigram_Keys = 3,       // Trigrams present in names (see `mole_trigrams_t`)
+    Section_Trigram_Offsets = 4,    // Beginnings of trigrams' posting lists
+    Section_Trigram_Postings = 5,   // Posting lists of all trigrams
+    Section_Size_Order = 6,         // Ids of entries sorted by size (see `mole_size_order_t`)
+    Section_Owner_Uids = 7,         // Ids of owners (see `mole_owners_t`)
+    Section_Owner_Offsets = 8,      // Beginnings of owners' posting lists
+    Section_Owner_Ids = 9,          // Posting lists of all owners
+    Section_Owner_Counts = 10,      // Number of files of every type, per owner
+    Section_Owner_Bytes = 11,       // Total size of files of every type, per owner
+    Section_Sizes = 12,             // Column of sizes of entries
+    Section_Owner_Uid_Column = 13,  // Column of owners of entries
+    Section_File_Types = 14,        // Column of types of entries
+    Section_Type_Cache = 15,        // Types of all files seen during indexing (see `mole_type_cache_t`)
+    Section_Subtree_Ends = 16,      // Ends of subtrees of entries (see `mole_subtrees_t`)
+    Section_Subtree_Totals = 17     // Total sizes of subtrees of entries (see `mole_rollups_t`)
+} mole_section_id_t;
+
+// Describes where single section is located inside cache file.
+typedef struct mole_section
+{
+    uint32_t id;            // Section id (`mole_section_id_t`)
+    uint32_t reserved;      // Always 0
+    uint64_t offset;        // Offset from beginning of file (multiple of MOLE_SECTION_ALIGNMENT)
+    uint64_t length;        // Length of section (in bytes)
+} mole_section_t;
+
+// Cache file begins with this header, followed by a table of `section_count` sections.
+// Sections are aligned, so the file can be mapped into memory and used directly:
+// loading takes constant time and pages are read only when a query touches them.
+// Checksum (FNV-1a) covers header (with checksum set to 0) and section table.
+typedef struct mole_index_header
+{
+    char magic[8];          // MOLE_INDEX_MAGIC
+    uint32_t version;       // MOLE_INDEX_VERSION
+    uint32_t endianness;    // MOLE_INDEX_ENDIANNESS, as written by the machine saving the file
+    uint64_t entry_count;   // Number of entries in the index
+    uint32_t section_count; // Number of sections following the header
+    uint32_t reserved;      // Always 0
+    uint64_t checksum;      // Checksum of header and section table
+} mole_index_header_t;
+
+// Index is stored as a single array of entries. Its space is reserved in advance and made
+// usable in fixed-size segments as entries are inserted (see the last paragraph), so the array
+// doesn't have to be reallocated every time it becomes full.
 //
 // I chose this data structure, because it's really easy to save to a file. Program needs
 // to browse the index using various criteria (name, size, owner), so it doesn't make sense
 // to sort the elements in regard to only one attribute (e.g. size).
 //
-// This implementation is inspired by std::vector.
+// Names (and the few stored paths) are kept in a separate string arena, so entries have
+// fixed, small size no matter how long the path is. Arena is saved right after the array
+// of entries, packed: unlike other sections it is decoded into memory when cache is read.
+//
+// Size, owner and type of entry `i` are stored at position `i` of separate arrays (columns)
+// growing together with the array of entries. Queries that filter by one attribute scan
+// only its column, which is several times smaller than the array of entries (see scan.h).
+//
+// Index read from cache file (apart from its arena) lives inside private file mapping. Entries can be modified
+// in place (pages are copied on write), but before growing, index is detached from the
+// mapping (see `index_detach()`).
+//
+// Otherwise the array of entries and the columns share a single reservation of address space
+// for `reserved` entries. Indexes built by a walk reserve space for MOLE_MAX_ENTRIES entries,
+// other ones for twice the number of entries expected (as much as address space allows).
+// Only its part holding `capacity` entries is usable, index grows by making next segments
+// (MOLE_SEGMENT_ENTRIES entries) usable, so memory is only used by pages that are written.
+// Entries are moved into a new reservation twice as large only if the index outgrows its own
+// (which a walk does only if address space is limited). Whole reservation is released at once.
 typedef struct mole_index
 {
     size_t size;                    // Number of entries currently in the index.
-    size_t capacity;                // True size of the array.
+    size_t capacity;                // Number of entries that fit into usable segments.
+    size_t reserved;                // Number of entries that fit into reserved address space.
     mole_index_entry_t* elements;   // Dynamic array of entries.
+    uint64_t* sizes;                // Sizes of files (in bytes).
+    uint32_t* owner_uids;           // Ids of files' owners.
+    uint8_t* file_types;            // Types of files (`file_type_t`).
+    mole_string_arena_t strings;    // Names and paths of all entries.
+    mole_trigrams_t trigrams;       // Trigram index of names, used by `namepart` query.
+    mole_size_order_t size_order;   // Entries sorted by size, used by size range queries.
+    mole_owners_t owners;           // Entries grouped by owner, used by `owner` and `usage` queries.
+    mole_subtrees_t subtrees;       // Ranges of ids of subtrees, used by queries limited to a directory.
+    mole_rollups_t rollups;         // Total sizes of subtrees, used by `du` query.
+    mole_type_cache_t type_cache;   // Types of files seen during indexing, used by next indexing.
+    void* columns;                  // Reserved address space of entries and columns (NULL if index is mapped).
+    void* mapping;                  // Mapped cache file (NULL if index owns its memory).
+    size_t mapping_size;            // Size of the mapping.
 } mole_index_t;
 
+// Hash table mapping full paths of entries to their ids. Used to find out what was
+// known about a file during previous indexing. It only stores ids (paths are taken
+// from the index), so it has to be used together with the index it was built for.
+typedef struct mole_path_table
+{
+    size_t size;        // Number of occupied slots.
+    size_t capacity;    // Number of slots (power of two).
+    uint64_t* slots;    // Entry id + 1 for occupied slots, 0 for empty ones.
+} mole_path_table_t;
+
+// Rebuilds paths of many entries one after another. Entries usually come grouped by
+// directory, so path of the previous entry's parent is kept and reused for its siblings.
+typedef struct mole_path_builder
+{
+    const mole_index_t* index;  // Index of the previous entry
+    uint64_t parent;            // Parent of the previous entry (MOLE_NO_ENTRY if its path is not reusable)
+    char path[PATH_MAX];        // Path of the previous entry
+} mole_path_builder_t;
+
+// Lists of children of every directory in an index, stored one after another.
+// Children of entry `i` are `ids[offsets[i]]`, ..., `ids[offsets[i + 1] - 1]`.
+typedef struct mole_children
+{
+    uint64_t* offsets;  // Array of `index->size + 1` offsets.
+    uint64_t* ids;      // Ids of children, grouped by parent.
+} mole_children_t;
+
+// Initializes arena, preparing it to hold `capacity` bytes without reallocating.
+void arena_init(mole_string_arena_t* arena, size_t capacity);
+
+// Frees memory used by arena.
+void arena_free(mole_string_arena_t* arena);
+
+// Changes capacity of arena to hold `new_capacity` bytes.
+void arena_extend(mole_string_arena_t* arena, size_t new_capacity);
+
+// Copies `length` bytes of `string` into the arena (adding '\0') and returns its offset.
+uint64_t arena_append(mole_string_arena_t* arena, const char* string, size_t length);
+
 // Initializes index to its default state.
 void index_init(mole_index_t* index);
 
 // Initializes index, preparing it to hold `capacity` elements without reallocating.
 void index_init_capacity(mole_index_t* index, size_t capacity);
 
+// Initializes index like `index_init_capacity()`, reserving address space for `reserve` elements
+// (or as many as address space allows), so that it can grow up to that without being moved.
+void index_init_reserved(mole_index_t* index, size_t capacity, size_t reserve);
+
 // Frees memory used by index.
 void index_free(mole_index_t* index);
 
-// Changes capacity of index to hold `new_capacity` elements.
-// Reallocates internal array, if necessary.
+// Builds auxiliary structures used to speed up queries (trigram index of names,
+// order of entries by size, entries grouped by owner, ranges and total sizes of subtrees).
+// Has to be called again after entries are added or ids change.
+void index_prepare(mole_index_t* index);
+
+// Returns upper bound of memory used by trigram index, size order and owners index
+// built by `index_prepare()`, used to tell whether they fit into a memory limit.
+size_t index_prepare_memory(const mole_index_t* index);
+
+// Copies entries and columns of mapped index into its own memory and unmaps the file.
+// Does nothing if index is not mapped.
+void index_detach(mole_index_t* index);
+
+// Initializes `copy` with contents of `index` (including auxiliary structures),
+// placed in copy's own memory.
+void index_copy(mole_index_t* copy, const mole_index_t* index);
+
+// Changes capacity of index to hold (at least) `new_capacity` elements.
+// Makes more segments usable, if necessary. Entries are moved only if they
+// no longer fit into reserved address space.
 void index_extend(mole_index_t* index, size_t new_capacity);
 
-// Inserts new entry to the index.
-void index_insert(mole_index_t* index, mole_index_entry_t* entry);
+// Inserts copy of entry `id`, that belongs to `source` index, to the index.
+// Strings of the entry are copied into index's own arena. Path of the copy is
+// rebuilt from its parent, so the parent has to be inserted as well.
+void index_insert(mole_index_t* index, const mole_index_t* source, uint64_t id);
+
+// Appends all entries of `source` index (together with their strings) to the index.
+// Parent ids are copied unchanged, it is up to the caller to adjust them.
+void index_merge(mole_index_t* index, const mole_index_t* source);
 
 // Constructs new entry using provided values and inserts it to the index.
-void index_emplace(mole_index_t* index, const char* file_name, const char* full_path,
-                   size_t size, uid_t owner_uid, file_type_t file_type);
+// `full_path` is expected to be absolute path without symbolic links (see `realpath()`),
+// `parent_path` is full path of `parent` (NULL for root). Path is stored only if it
+// can't be rebuilt from the parent's one. Returns id of the new entry.
+uint64_t index_emplace(mole_index_t* index, const char* file_name, const char* full_path,
+                       uint64_t parent, const char* parent_path, const struct stat* stat, file_type_t file_type);
+
+// Checks whether entry `id` describes the same, unmodified file as `stat` does.
+bool index_entry_unchanged(const mole_index_t* index, uint64_t id, const struct stat* stat);
+
+// Marks entry as removed. Removed entries are skipped by all queries
+// and dropped by `index_compact()`.
+void index_remove(mole_index_t* index, uint64_t id);
+
+// Updates size, owner and modification time of entry in place (keeping its id),
+// together with auxiliary structures.
+void index_update(mole_index_t* index, uint64_t id, const struct stat* stat);
+
+// Marks directory entry and all entries inside of it as removed.
+void index_remove_subtree(mole_index_t* index, uint64_t id);
+
+// Drops all removed entries (and their strings) from the index.
+// Ids of remaining entries change, but their order is preserved.
+void index_compact(mole_index_t* index);
 
-// Clears index, leaving its capacity unchanged.
+// Numbers entries in pre-order: every root is followed by its subtree, every directory
+// by its children, each followed by its own subtree (see `mole_subtrees_t`). Entries not
+// reachable from any root are placed at the end. Relative order of siblings is preserved.
+// Auxiliary structures are dropped, `index_prepare()` has to be called afterwards.
+void index_order_preorder(mole_index_t* index);
+
+// Clears index, leaving its capacity unchanged. Memory of entries is returned
+// to the system (it is zeroed again when it is used).
 void index_clear(mole_index_t* index);
 
-// Reads index from file.
+// Returns file name of the entry, that belongs to the index.
+const char* index_entry_name(const mole_index_t* index, const mole_index_entry_t* entry);
+
+// Writes full path of the entry, that belongs to the index, into `buffer` (PATH_MAX bytes).
+// Returns length of the path.
+size_t index_entry_path(const mole_index_t* index, const mole_index_entry_t* entry, char* buffer);
+
+// Prepares builder for rebuilding paths of entries (of one or more indexes).
+void path_builder_init(mole_path_builder_t* builder);
+
+// Returns full path of the entry, that belongs to the index, and stores its length in `length`.
+// Path stays valid until builder is used again.
+const char* path_builder_path(mole_path_builder_t* builder, const mole_index_t* index,
+                              const mole_index_entry_t* entry, size_t* length);
+
+// Builds table of all paths in the index.
+void path_table_build(mole_path_table_t* table, const mole_index_t* index);
+
+// Frees memory used by path table.
+void path_table_free(mole_path_table_t* table);
+
+// Adds entry `id` of the index to the table.
+void path_table_insert(mole_path_table_t* table, const mole_index_t* index, uint64_t id);
+
+// Returns id of entry with given full path or MOLE_NO_ENTRY if there is none.
+// Removed entries are not taken into account.
+uint64_t path_table_find(const mole_path_table_t* table, const mole_index_t* index, const char* path);
+
+// Groups entries of the index by their parent directories.
+void children_build(mole_children_t* children, const mole_index_t* index);
+
+// Frees memory used by children lists.
+void children_free(mole_children_t* children);
+
+// Maps index from cache file, replacing contents of `index`. Returns false
+// (leaving index unchanged) if file doesn't exist or is not a valid cache file.
 bool index_read(mole_index_t* index, char* index_path);
 
-// Saves index into file.
+// Saves index into cache file. File is written under temporary name, flushed to disk
+// and then renamed, so that the cache is never left partially written and mappings
+// of the previous version stay valid. Usually called by persister (see persister.h).
 void index_save(mole_index_t* index, char* index_path);
+
+// Saves index like `index_save()`, but builds trigram index, size order and owners index
+// while writing them, instead of taking them from `index`. Records they are sorted from
+// are spilled into temporary files next to the cache once they take more than
+// `memory_limit` bytes (see spill.h), so they never have to fit into memory all at once.
+void index_save_spilled(const mole_index_t* index, char* index_path, size_t memory_limit);
@@ -0,0 +1,191 @@
+#include "owners.h"
+#include "mole_index.h"
+
+static int uid_compare(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*) a, y = *(const uint32_t*) b;
+    return (x > y) - (x < y);
+}
+
+void owners_init(mole_owners_t* owners)
+{
+    owners->indexed = 0;
+    owners->owner_count = 0;
+    owners->uids = NULL;
+    owners->offsets = NULL;
+    owners->ids = NULL;
+    owners->counts = NULL;
+    owners->bytes = NULL;
+    owners->owned = true;
+}
+
+void owners_free(mole_owners_t* owners)
+{
+    if(owners->owned)
+    {
+        free(owners->uids);
+        free(owners->offsets);
+        free(owners->ids);
+        free(owners->counts);
+        free(owners->bytes);
+    }
+
+    owners_init(owners);
+}
+
+void owners_build(mole_owners_t* owners, const mole_index_t* index)
+{
+    owners_free(owners);
+    if(index->size > UINT32_MAX) return;
+
+    // There are only a few distinct owners, so they are found by sorting all uids.
+    uint32_t* uids = malloc((index->size + 1) * sizeof(uint32_t));
+    if(NULL == uids) ERROR("malloc");
+
+    size_t owner_count = 0;
+    for(size_t i = 0; i < index->size; ++i)
+        if(index->file_types[i] != Removed)
+            uids[owner_count++] = index->owner_uids[i];
+    qsort(uids, owner_count, sizeof(uint32_t), uid_compare);
+
+    size_t distinct = 0;
+    for(size_t i = 0; i < owner_count; ++i)
+        if(distinct == 0 || uids[distinct - 1] != uids[i])
+            uids[distinct++] = uids[i];
+    owners->owner_count = owner_count = distinct;
+    owners->uids = uids;
+
+    owners->offsets = calloc(owner_count + 1, sizeof(uint64_t));
+    owners->ids = malloc((index->size + 1) * sizeof(uint32_t));
+    owners->counts = calloc(owner_count * FILE_TYPE_COUNT + 1, sizeof(uint64_t));
+    owners->bytes = calloc(owner_count * FILE_TYPE_COUNT + 1, sizeof(uint64_t));
+    uint32_t* positions = malloc((index->size + 1) * sizeof(uint32_t));
+    if(NULL == owners->offsets || NULL == owners->ids || NULL == owners->counts
+       || NULL == owners->bytes || NULL == positions) ERROR("malloc");
+
+    for(size_t i = 0; i < index->size; ++i)
+    {
+        uint8_t file_type = index->file_types[i];
+        if(file_type == Removed) continue;
+
+        size_t k = owners_find(owners, index->owner_uids[i]);
+        positions[i] = k;
+        owners->offsets[k + 1]++;
+        owners->counts[k * FILE_TYPE_COUNT + file_type]++;
+        owners->bytes[k * FILE_TYPE_COUNT + file_type] += index->sizes[i];
+    }
+    for(size_t k = 0; k < owner_count; ++k)
+        owners->offsets[k + 1] += owners->offsets[k];
+
+    uint64_t* next = malloc((owner_count + 1) * sizeof(uint64_t));
+    if(NULL == next) ERROR("malloc");
+    memcpy(next, owners->offsets, (owner_count + 1) * sizeof(uint64_t));
+
+    for(size_t i = 0; i < index->size; ++i)
+        if(index->file_types[i] != Removed)
+            owners->ids[next[positions[i]]++] = i;
+
+    free(next);
+    free(positions);
+    owners->indexed = index->size;
+    owners->owned = true;
+}
+
+// Allocates copy of `length` bytes of `data`.
+static void* owners_copy(const void* data, size_t length)
+{
+    void* copy = malloc(length + 1);
+    if(NULL == copy) ERROR("malloc");
+    memcpy(copy, data, length);
+
+    return copy;
+}
+
+void owners_detach(mole_owners_t* owners)
+{
+    if(owners->owned) return;
+
+    size_t owner_count = owners->owner_count;
+    owners->uids = owners_copy(owners->uids, owner_count * sizeof(uint32_t));
+    owners->ids = owners_copy(owners->ids, owners->offsets[owner_count] * sizeof(uint32_t));
+    owners->offsets = owners_copy(owners->offsets, (owner_count + 1) * sizeof(uint64_t));
+    owners->counts = owners_copy(owners->counts, owner_count * FILE_TYPE_COUNT * sizeof(uint64_t));
+    owners->bytes = owners_copy(owners->bytes, owner_count * FILE_TYPE_COUNT * sizeof(uint64_t));
+    owners->owned = true;
+}
+
+size_t owners_find(const mole_owners_t* owners, uid_t uid)
+{
+    size_t low = 0, high = owners->owner_count;
+    while(low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if(owners->uids[middle] < uid) low = middle + 1;
+        else high = middle;
+    }
+
+    return low < owners->owner_count && owners->uids[low] == uid ? low : owners->owner_count;
+}
+
+void owners_forget(mole_owners_t* owners, const mole_index_t* index, uint64_t id)
+{
+    if(id >= owners->indexed || index->file_types[id] == Removed) return;
+
+    size_t k = owners_find(owners, index->owner_uids[id]);
+    if(k == owners->owner_count) return;
+
+    owners->counts[k * FILE_TYPE_COUNT + index->file_types[id]]--;
+    owners->bytes[k * FILE_TYPE_COUNT + index->file_types[id]] -= index->sizes[id];
+}
+
+void owners_update(mole_owners_t* owners, const mole_index_t* index, uint64_t id, uid_t new_uid, uint64_t new_size)
+{
+    uint8_t file_type = index->file_types[id];
+    if(id >= owners->indexed || file_type == Removed) return;
+
+    size_t old_k = owners_find(owners, index->owner_uids[id]);
+    size_t new_k = owners_find(owners, new_uid);
+    if(old_k == owners->owner_count) return;
+
+    // Adding new owner would require resizing all arrays. It is rare enough,
+    // that index is dropped instead (queries fall back to checking all entries).
+    if(new_k == owners->owner_count)
+    {
+        owners_free(owners);
+        return;
+    }
+
+    owners->counts[old_k * FILE_TYPE_COUNT + file_type]--;
+    owners->bytes[old_k * FILE_TYPE_COUNT + file_type] -= index->sizes[id];
+    owners->counts[new_k * FILE_TYPE_COUNT + file_type]++;
+    owners->bytes[new_k * FILE_TYPE_COUNT + file_type] += new_size;
+
+    if(old_k == new_k) return;
+
+    // Entry is moved from one posting list to the other one, lists in between are shifted.
+    uint64_t position = owners->offsets[old_k];
+    while(position < owners->offsets[old_k + 1] && owners->ids[position] != id)
+        position++;
+    if(position == owners->offsets[old_k + 1]) return;
+
+    if(new_k > old_k)
+    {
+        uint64_t target = owners->offsets[new_k] - 1;
+        while(target + 1 < owners->offsets[new_k + 1] && owners->ids[target + 1] < id)
+            target++;
+        memmove(owners->ids + position, owners->ids + position + 1, (target - position) * sizeof(uint32_t));
+        owners->ids[target] = id;
+        for(size_t k = old_k + 1; k <= new_k; ++k)
+            owners->offsets[k]--;
+    }
+    else
+    {
+        uint64_t target = owners->offsets[new_k];
+        while(target < owners->offsets[new_k + 1] && owners->ids[target] < id)
+            target++;
+        memmove(owners->ids + target + 1, owners->ids + target, (position - target) * sizeof(uint32_t));
+        owners->ids[target] = id;
+        for(size_t k = new_k + 1; k <= old_k; ++k)
+            owners->offsets[k]++;
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "common.h"
+
+#include <stdint.h>
+
+// Lists of entries owned by every user (posting lists), together with precomputed
+// number of files and their total size for every user and file type. This way `owner`
+// doesn't have to check every entry and `usage` doesn't have to check any entry.
+//
+// Owner `uids[k]` has list `ids[offsets[k]]`, ..., `ids[offsets[k + 1] - 1]` and
+// summary `counts[k * FILE_TYPE_COUNT + type]`, `bytes[k * FILE_TYPE_COUNT + type]`.
+//
+// Lists cover entries [0, `indexed`). Entries added later (by watcher) are not
+// covered and have to be checked one by one, until owners index is built again.
+// Summaries are kept up to date when entries are modified or removed.
+typedef struct mole_owners
+{
+    size_t indexed;         // Number of entries covered by the index
+    size_t owner_count;     // Number of distinct owners
+    uint32_t* uids;         // Sorted ids of owners
+    uint64_t* offsets;      // Beginnings of posting lists (`owner_count + 1` elements)
+    uint32_t* ids;          // Posting lists (entry ids)
+    uint64_t* counts;       // Number of files of every type, per owner
+    uint64_t* bytes;        // Total size of files of every type, per owner
+    bool owned;             // Flag telling whether arrays were allocated (or are mapped)
+} mole_owners_t;
+
+// Initializes empty owners index, that covers no entries.
+void owners_init(mole_owners_t* owners);
+
+// Frees memory used by owners index.
+void owners_free(mole_owners_t* owners);
+
+// Groups all entries of the index by their owners.
+void owners_build(mole_owners_t* owners, const mole_index_t* index);
+
+// Copies mapped arrays into owners index's own memory.
+void owners_detach(mole_owners_t* owners);
+
+// Returns position of owner `uid` or `owner_count` if there is no such owner.
+size_t owners_find(const mole_owners_t* owners, uid_t uid);
+
+// Updates summaries, as entry `id` is about to be removed.
+void owners_forget(mole_owners_t* owners, const mole_index_t* index, uint64_t id);
+
+// Updates posting lists and summaries, as owner and size of entry `id` are about to change.
+// Has to be called before the entry is modified.
+void owners_update(mole_owners_t* owners, const mole_index_t* index, uint64_t id, uid_t new_uid, uint64_t new_size);
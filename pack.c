@@ -0,0 +1,327 @@
+#include "pack.h"
+
+#define PACK_MIN_MATCH 4
+#define PACK_MAX_OFFSET 65535
+// Front-coded string takes at most two LEB128 numbers (up to 5 bytes each) more than the string.
+#define PACK_CODED_OVERHEAD 10
+
+// Growing buffer of packed data.
+typedef struct pack_buffer
+{
+    size_t size;
+    size_t capacity;
+    char* data;
+} pack_buffer_t;
+
+static char* pack_reserve(pack_buffer_t* buffer, size_t length)
+{
+    if(buffer->size + length > buffer->capacity)
+    {
+        while(buffer->size + length > buffer->capacity)
+            buffer->capacity *= 2;
+        buffer->data = realloc(buffer->data, buffer->capacity);
+        if(NULL == buffer->data) ERROR("realloc");
+    }
+
+    char* reserved = buffer->data + buffer->size;
+    buffer->size += length;
+    return reserved;
+}
+
+static size_t pack_write_number(uint8_t* out, uint32_t value)
+{
+    size_t length = 0;
+    while(value >= 0x80)
+    {
+        out[length++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    out[length++] = value;
+
+    return length;
+}
+
+static bool pack_read_number(const uint8_t** in, const uint8_t* end, uint32_t* value)
+{
+    *value = 0;
+    for(int shift = 0; shift < 35; shift += 7)
+    {
+        if(*in == end) return false;
+        uint8_t byte = *(*in)++;
+        *value |= (uint32_t) (byte & 0x7F) << shift;
+        if(!(byte & 0x80)) return true;
+    }
+
+    return false;
+}
+
+// Front-codes strings from `data` (up to `end`) into `out`, until the block is full.
+// Returns length of coded block and stores number of consumed bytes in `consumed`.
+static size_t pack_front_code(const char* data, const char* end, uint8_t* out, size_t* consumed)
+{
+    const char* previous = data;
+    size_t previous_length = 0;
+    const char* string = data;
+    size_t coded = 0;
+
+    while(string < end)
+    {
+        size_t length = strlen(string);
+        if(coded > 0 && coded + length + PACK_CODED_OVERHEAD > PACK_BLOCK_SIZE) break;
+
+        size_t shared = 0;
+        while(shared < previous_length && shared < length && previous[shared] == string[shared])
+            shared++;
+
+        coded += pack_write_number(out + coded, shared);
+        coded += pack_write_number(out + coded, length - shared);
+        memcpy(out + coded, string + shared, length - shared);
+        coded += length - shared;
+
+        previous = string;
+        previous_length = length;
+        string += length + 1;
+    }
+
+    *consumed = string - data;
+    return coded;
+}
+
+static bool pack_front_decode(const uint8_t* coded, size_t coded_length, char* data, size_t capacity, size_t* written)
+{
+    const uint8_t* end = coded + coded_length;
+    const char* previous = data;
+    size_t previous_length = 0;
+    size_t total = 0;
+
+    while(coded < end)
+    {
+        uint32_t shared, rest;
+        if(!pack_read_number(&coded, end, &shared) || !pack_read_number(&coded, end, &rest)) return false;
+        if(shared > previous_length || rest > (size_t) (end - coded)) return false;
+        if(capacity - total < (size_t) shared + rest + 1) return false;
+
+        char* string = data + total;
+        memmove(string, previous, shared);
+        memcpy(string + shared, coded, rest);
+        string[shared + rest] = '\0';
+        coded += rest;
+
+        previous = string;
+        previous_length = shared + rest;
+        total += previous_length + 1;
+    }
+
+    *written = total;
+    return true;
+}
+
+static uint32_t pack_hash(const uint8_t* bytes)
+{
+    uint32_t word;
+    memcpy(&word, bytes, sizeof(word));
+    return (word * 2654435761u) >> (32 - PACK_HASH_BITS);
+}
+
+static size_t pack_write_length(uint8_t* out, size_t length)
+{
+    size_t written = 0;
+    for(; length >= 255; length -= 255)
+        out[written++] = 255;
+    out[written++] = length;
+
+    return written;
+}
+
+// Appends sequence of literals followed by a match (`match_length` 0 for the last sequence).
+// Returns false if it doesn't fit in `capacity` bytes.
+static bool pack_write_sequence(uint8_t* out, size_t* used, size_t capacity, const uint8_t* literals,
+                                size_t literal_length, size_t offset, size_t match_length)
+{
+    size_t worst = 1 + literal_length / 255 + 1 + literal_length + 2 + match_length / 255 + 1;
+    if(capacity - *used < worst) return false;
+
+    uint8_t* token = out + (*used)++;
+    size_t match_code = match_length == 0 ? 0 : match_length - PACK_MIN_MATCH;
+    *token = (literal_length < 15 ? literal_length : 15) << 4 | (match_code < 15 ? match_code : 15);
+
+    if(literal_length >= 15) *used += pack_write_length(out + *used, literal_length - 15);
+    memcpy(out + *used, literals, literal_length);
+    *used += literal_length;
+    if(match_length == 0) return true;
+
+    out[(*used)++] = offset & 0xFF;
+    out[(*used)++] = offset >> 8;
+    if(match_code >= 15) *used += pack_write_length(out + *used, match_code - 15);
+
+    return true;
+}
+
+// Compresses `length` bytes into `out`. Returns compressed length, or 0 if it would exceed `capacity`.
+static size_t pack_lz_compress(const uint8_t* in, size_t length, uint8_t* out, size_t capacity)
+{
+    uint32_t table[1 << PACK_HASH_BITS];
+    memset(table, 0xFF, sizeof(table));
+
+    size_t used = 0;
+    size_t anchor = 0;
+    size_t position = 0;
+    while(position + PACK_MIN_MATCH <= length)
+    {
+        uint32_t hash = pack_hash(in + position);
+        uint32_t candidate = table[hash];
+        table[hash] = position;
+
+        if(candidate == UINT32_MAX || position - candidate > PACK_MAX_OFFSET
+           || memcmp(in + candidate, in + position, PACK_MIN_MATCH) != 0)
+        {
+            position++;
+            continue;
+        }
+
+        size_t match_length = PACK_MIN_MATCH;
+        while(position + match_length < length && in[candidate + match_length] == in[position + match_length])
+            match_length++;
+
+        if(!pack_write_sequence(out, &used, capacity, in + anchor, position - anchor, position - candidate, match_length))
+            return 0;
+        position += match_length;
+        anchor = position;
+    }
+
+    if(!pack_write_sequence(out, &used, capacity, in + anchor, length - anchor, 0, 0)) return 0;
+    return used;
+}
+
+static bool pack_read_length(const uint8_t** in, const uint8_t* end, size_t* length)
+{
+    uint8_t byte;
+    do
+    {
+        if(*in == end) return false;
+        byte = *(*in)++;
+        *length += byte;
+    } while(byte == 255);
+
+    return true;
+}
+
+static bool pack_lz_decompress(const uint8_t* in, size_t in_length, uint8_t* out, size_t out_length)
+{
+    const uint8_t* end = in + in_length;
+    size_t used = 0;
+    while(in < end)
+    {
+        uint8_t token = *in++;
+        size_t literal_length = token >> 4;
+        if(literal_length == 15 && !pack_read_length(&in, end, &literal_length)) return false;
+        if(literal_length > (size_t) (end - in) || literal_length > out_length - used) return false;
+        memcpy(out + used, in, literal_length);
+        in += literal_length;
+        used += literal_length;
+
+        // Last sequence has no match.
+        if(in == end) break;
+
+        if(end - in < 2) return false;
+        size_t offset = in[0] | (size_t) in[1] << 8;
+        in += 2;
+        size_t match_length = token & 0x0F;
+        if(match_length == 15 && !pack_read_length(&in, end, &match_length)) return false;
+        match_length += PACK_MIN_MATCH;
+        if(offset == 0 || offset > used || match_length > out_length - used) return false;
+
+        // Match may overlap bytes it produces, so it is copied byte by byte.
+        for(size_t i = 0; i < match_length; ++i, ++used)
+            out[used] = out[used - offset];
+    }
+
+    return used == out_length;
+}
+
+char* pack_strings(const char* data, size_t length, size_t* packed_length)
+{
+    pack_buffer_t buffer = { .size = 0, .capacity = sizeof(uint64_t) + PACK_BLOCK_SIZE };
+    buffer.data = malloc(buffer.capacity);
+    uint8_t* coded = malloc(PACK_BLOCK_SIZE);
+    if(NULL == buffer.data || NULL == coded) ERROR("malloc");
+
+    uint64_t total = length;
+    memcpy(pack_reserve(&buffer, sizeof(total)), &total, sizeof(total));
+
+    size_t offset = 0;
+    while(offset < length)
+    {
+        size_t consumed;
+        pack_block_header_t header;
+        header.coded_length = pack_front_code(data + offset, data + length, coded, &consumed);
+        offset += consumed;
+
+        // Header is reserved first, so that the block can be compressed in place.
+        size_t header_position = buffer.size;
+        pack_reserve(&buffer, sizeof(header) + header.coded_length);
+        uint8_t* stored = (uint8_t*) buffer.data + header_position + sizeof(header);
+        header.stored_length = pack_lz_compress(coded, header.coded_length, stored, header.coded_length - 1);
+        if(header.stored_length == 0)
+        {
+            header.stored_length = header.coded_length;
+            memcpy(stored, coded, header.coded_length);
+        }
+
+        memcpy(buffer.data + header_position, &header, sizeof(header));
+        buffer.size = header_position + sizeof(header) + header.stored_length;
+    }
+
+    free(coded);
+    *packed_length = buffer.size;
+    return buffer.data;
+}
+
+size_t pack_unpacked_length(const char* packed, size_t packed_length)
+{
+    uint64_t total;
+    if(packed_length < sizeof(total)) return SIZE_MAX;
+    memcpy(&total, packed, sizeof(total));
+
+    return total;
+}
+
+bool unpack_strings(const char* packed, size_t packed_length, char* data)
+{
+    size_t length = pack_unpacked_length(packed, packed_length);
+    if(length == SIZE_MAX) return false;
+    const char* end = packed + packed_length;
+    packed += sizeof(uint64_t);
+
+    uint8_t* coded = malloc(PACK_BLOCK_SIZE);
+    if(NULL == coded) ERROR("malloc");
+
+    size_t offset = 0;
+    bool valid = true;
+    while(valid && packed < end)
+    {
+        pack_block_header_t header;
+        if((size_t) (end - packed) < sizeof(header)) break;
+        memcpy(&header, packed, sizeof(header));
+        packed += sizeof(header);
+
+        valid = header.coded_length <= PACK_BLOCK_SIZE && header.stored_length <= header.coded_length
+             && header.stored_length <= (size_t) (end - packed);
+        if(!valid) break;
+
+        const uint8_t* stored = (const uint8_t*) packed;
+        if(header.stored_length < header.coded_length)
+        {
+            valid = pack_lz_decompress(stored, header.stored_length, coded, header.coded_length);
+            stored = coded;
+        }
+
+        size_t written;
+        valid = valid && pack_front_decode(stored, header.coded_length, data + offset, length - offset, &written);
+        if(valid) offset += written;
+        packed += header.stored_length;
+    }
+
+    free(coded);
+    return valid && packed == end && offset == length;
+}
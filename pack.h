@@ -0,0 +1,34 @@
+#pragma once
+
+#include "common.h"
+
+#include <stdint.h>
+
+#define PACK_BLOCK_SIZE (1 << 16)
+#define PACK_HASH_BITS 12
+
+// Compact encoding of a sequence of strings (each terminated with '\0'), used for string
+// arena in cache file. Packed data begins with the length of the sequence, followed by
+// blocks of whole strings, that can be decoded independently:
+//
+// - strings of a block are front-coded: every string is stored as the length of prefix
+//   it shares with the previous one (which is usually its sibling), length of the rest
+//   and the rest itself (lengths are LEB128 numbers),
+// - front-coded block is then compressed with a fast LZ77 compressor (in a format similar
+//   to LZ4). Block is stored as it is, if compression doesn't make it smaller.
+typedef struct pack_block_header
+{
+    uint32_t coded_length;      // Length of front-coded block
+    uint32_t stored_length;     // Length of data following the header (equal to `coded_length` if not compressed)
+} pack_block_header_t;
+
+// Packs `length` bytes of strings in `data` (each shorter than PACK_BLOCK_SIZE). Returns
+// packed data (allocated with malloc) and stores its length in `packed_length`.
+char* pack_strings(const char* data, size_t length, size_t* packed_length);
+
+// Returns number of bytes `packed` data unpacks into, or SIZE_MAX if it is too short.
+size_t pack_unpacked_length(const char* packed, size_t packed_length);
+
+// Unpacks `packed` data into `data` (`pack_unpacked_length()` bytes long).
+// Returns false if packed data is corrupted.
+bool unpack_strings(const char* packed, size_t packed_length, char* data);
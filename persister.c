@@ -0,0 +1,98 @@
+#include "persister.h"
+
+static void* persister_thread(void* args)
+{
+    persister_t* persister = (persister_t*) args;
+
+    for(;;)
+    {
+        pthread_mutex_lock(&persister->mutex);
+        while(NULL == persister->pending && !persister->stopping)
+            pthread_cond_wait(&persister->wakeup, &persister->mutex);
+
+        mole_snapshot_t* snapshot = persister->pending;
+        persister->pending = NULL;
+        uint64_t spilled_saves = persister->spilled_saves;
+        pthread_mutex_unlock(&persister->mutex);
+
+        if(NULL == snapshot) break;
+
+        // Snapshot is older than the index written while waiting for the file, so it is skipped.
+        pthread_mutex_lock(&persister->file_mutex);
+        pthread_mutex_lock(&persister->mutex);
+        bool outdated = spilled_saves != persister->spilled_saves;
+        pthread_mutex_unlock(&persister->mutex);
+
+        if(!outdated) index_save(&snapshot->index, persister->context->path_f);
+        pthread_mutex_unlock(&persister->file_mutex);
+        snapshot_release(snapshot);
+    }
+
+    return NULL;
+}
+
+void persister_start(persister_t* persister, mole_context_t* context)
+{
+    persister->context = context;
+    persister->pending = NULL;
+    persister->spilled_saves = 0;
+    persister->stopping = false;
+    if(pthread_mutex_init(&persister->file_mutex, NULL)) ERROR("pthread_mutex_init");
+    if(pthread_mutex_init(&persister->mutex, NULL)) ERROR("pthread_mutex_init");
+    if(pthread_cond_init(&persister->wakeup, NULL)) ERROR("pthread_cond_init");
+
+    if(pthread_create(&persister->tid, NULL, persister_thread, persister)) ERROR("pthread_create");
+}
+
+void persister_request(persister_t* persister, mole_snapshot_t* snapshot)
+{
+    pthread_mutex_lock(&persister->mutex);
+    mole_snapshot_t* skipped = persister->pending;
+    persister->pending = snapshot;
+    pthread_mutex_unlock(&persister->mutex);
+    pthread_cond_signal(&persister->wakeup);
+
+    if(NULL != skipped) snapshot_release(skipped);
+}
+
+bool persister_save_spilled(persister_t* persister, mole_index_t* index, size_t memory_limit)
+{
+    pthread_mutex_lock(&persister->file_mutex);
+    pthread_mutex_lock(&persister->mutex);
+    mole_snapshot_t* skipped = persister->pending;
+    persister->pending = NULL;
+    persister->spilled_saves++;
+    pthread_mutex_unlock(&persister->mutex);
+
+    if(NULL != skipped) snapshot_release(skipped);
+
+    // File is mapped before it is unlocked, so that no older snapshot can replace it first.
+    mole_index_t mapped;
+    index_init(&mapped);
+    index_save_spilled(index, persister->context->path_f, memory_limit);
+    bool read = index_read(&mapped, persister->context->path_f);
+    pthread_mutex_unlock(&persister->file_mutex);
+
+    if(read)
+    {
+        index_free(index);
+        *index = mapped;
+    }
+    else index_free(&mapped);
+
+    return read;
+}
+
+void persister_stop(persister_t* persister)
+{
+    pthread_mutex_lock(&persister->mutex);
+    persister->stopping = true;
+    pthread_mutex_unlock(&persister->mutex);
+    pthread_cond_signal(&persister->wakeup);
+
+    if(pthread_join(persister->tid, NULL)) ERROR("pthread_join");
+
+    pthread_mutex_destroy(&persister->file_mutex);
+    pthread_mutex_destroy(&persister->mutex);
+    pthread_cond_destroy(&persister->wakeup);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <pthread.h>
+
+#include "common.h"
+#include "snapshot.h"
+
+// Writes published snapshots into cache file in a dedicated thread, so that neither
+// indexer nor watcher waits for the disk. Only the newest requested snapshot is kept:
+// if several are published while the previous one is being written, the older ones
+// are skipped, as they would be overwritten right away.
+typedef struct persister
+{
+    mole_context_t* context;        // Program's context
+    pthread_t tid;                  // Id of persister's thread
+    pthread_mutex_t file_mutex;     // Mutex held while cache file is being written
+    pthread_mutex_t mutex;          // Mutex guarding fields below
+    pthread_cond_t wakeup;          // Condition variable signaled when there is work to do
+    mole_snapshot_t* pending;       // Pinned snapshot waiting to be written (or NULL)
+    uint64_t spilled_saves;         // Number of saves made by `persister_save_spilled()`
+    bool stopping;                  // Flag telling that thread should exit once nothing is pending
+} persister_t;
+
+// Starts persister's thread, writing into `context->path_f`.
+void persister_start(persister_t* persister, mole_context_t* context);
+
+// Schedules pinned `snapshot` to be written. Reference is taken over by persister.
+void persister_request(persister_t* persister, mole_snapshot_t* snapshot);
+
+// Writes `index` into cache file with `index_save_spilled()` in the calling thread and
+// replaces it with the index mapped from the written file. Snapshots requested before
+// (pending or already taken by persister's thread) are skipped, as they are older than `index`.
+// Returns false if the file can't be mapped back, `index` is left unchanged then.
+bool persister_save_spilled(persister_t* persister, mole_index_t* index, size_t memory_limit);
+
+// Writes pending snapshot (if there is one) and stops persister's thread.
+void persister_stop(persister_t* persister);
@@ -0,0 +1,232 @@
+#include "probe.h"
+#include "indexer.h"
+#include "stats.h"
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define PROBE_OPCODES 256
+
+static int probe_setup(unsigned entries, struct io_uring_params* params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int probe_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+// Checks whether kernel supports all operations used by prober (added in Linux 5.6).
+static bool probe_supported(int ring_fd)
+{
+    size_t size = sizeof(struct io_uring_probe) + PROBE_OPCODES * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = calloc(1, size);
+    if(NULL == probe) ERROR("calloc");
+
+    bool supported = false;
+    if(syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe, PROBE_OPCODES) == 0)
+    {
+        const uint8_t opcodes[] = { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE };
+        supported = true;
+        for(size_t i = 0; i < sizeof(opcodes); ++i)
+            if(opcodes[i] > probe->last_op || !(probe->ops[opcodes[i]].flags & IO_URING_OP_SUPPORTED))
+                supported = false;
+    }
+
+    free(probe);
+    return supported;
+}
+
+void prober_init(prober_t* prober)
+{
+    prober->available = false;
+    prober->sq_ring = prober->cq_ring = prober->sqes = MAP_FAILED;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    prober->ring_fd = probe_setup(PROBE_RING_ENTRIES, &params);
+    if(prober->ring_fd < 0) return;
+
+    if(!probe_supported(prober->ring_fd))
+    {
+        prober_free(prober);
+        return;
+    }
+
+    prober->entries = params.sq_entries < PROBE_RING_ENTRIES ? params.sq_entries : PROBE_RING_ENTRIES;
+    prober->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    prober->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    prober->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    // Newer kernels map both rings with a single mapping.
+    bool single_mapping = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(single_mapping)
+    {
+        if(prober->cq_ring_size > prober->sq_ring_size) prober->sq_ring_size = prober->cq_ring_size;
+        prober->cq_ring_size = prober->sq_ring_size;
+    }
+
+    prober->sq_ring = mmap(NULL, prober->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           prober->ring_fd, IORING_OFF_SQ_RING);
+    prober->cq_ring = single_mapping ? prober->sq_ring
+                    : mmap(NULL, prober->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           prober->ring_fd, IORING_OFF_CQ_RING);
+    prober->sqes = mmap(NULL, prober->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        prober->ring_fd, IORING_OFF_SQES);
+    if(MAP_FAILED == prober->sq_ring || MAP_FAILED == prober->cq_ring || MAP_FAILED == prober->sqes)
+    {
+        prober_free(prober);
+        return;
+    }
+
+    char* sq = prober->sq_ring;
+    char* cq = prober->cq_ring;
+    prober->sq_tail = (unsigned*) (sq + params.sq_off.tail);
+    prober->sq_mask = (unsigned*) (sq + params.sq_off.ring_mask);
+    prober->sq_array = (unsigned*) (sq + params.sq_off.array);
+    prober->cq_head = (unsigned*) (cq + params.cq_off.head);
+    prober->cq_tail = (unsigned*) (cq + params.cq_off.tail);
+    prober->cq_mask = (unsigned*) (cq + params.cq_off.ring_mask);
+    prober->cqes = cq + params.cq_off.cqes;
+    prober->available = true;
+}
+
+void prober_free(prober_t* prober)
+{
+    if(MAP_FAILED != prober->sqes) munmap(prober->sqes, prober->sqes_size);
+    if(MAP_FAILED != prober->cq_ring && prober->cq_ring != prober->sq_ring) munmap(prober->cq_ring, prober->cq_ring_size);
+    if(MAP_FAILED != prober->sq_ring) munmap(prober->sq_ring, prober->sq_ring_size);
+    if(prober->ring_fd >= 0) close(prober->ring_fd);
+
+    prober->sq_ring = prober->cq_ring = prober->sqes = MAP_FAILED;
+    prober->ring_fd = -1;
+    prober->available = false;
+}
+
+// Returns next free submission queue entry (cleared), queue must not be full.
+static struct io_uring_sqe* probe_next_sqe(prober_t* prober, unsigned* tail)
+{
+    unsigned index = *tail & *prober->sq_mask;
+    struct io_uring_sqe* sqe = (struct io_uring_sqe*) prober->sqes + index;
+    memset(sqe, 0, sizeof(*sqe));
+    prober->sq_array[index] = index;
+    (*tail)++;
+
+    return sqe;
+}
+
+// Submits `count` prepared entries and stores result of every one of them in `results`
+// (indexed by `user_data`).
+static void probe_submit_and_wait(prober_t* prober, unsigned tail, unsigned count, int* results)
+{
+    __atomic_store_n(prober->sq_tail, tail, __ATOMIC_RELEASE);
+
+    unsigned to_submit = count, completed = 0;
+    while(completed < count)
+    {
+        int submitted = probe_enter(prober->ring_fd, to_submit, count - completed, IORING_ENTER_GETEVENTS);
+        if(submitted < 0)
+        {
+            if(errno == EINTR || errno == EAGAIN || errno == EBUSY) continue;
+            ERROR("io_uring_enter");
+        }
+        to_submit -= submitted;
+
+        unsigned head = *prober->cq_head;
+        unsigned cq_tail = __atomic_load_n(prober->cq_tail, __ATOMIC_ACQUIRE);
+        for(; head != cq_tail; ++head, ++completed)
+        {
+            const struct io_uring_cqe* cqe = (const struct io_uring_cqe*) prober->cqes + (head & *prober->cq_mask);
+            results[cqe->user_data] = cqe->res;
+        }
+        __atomic_store_n(prober->cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+
+// Probes at most `prober->entries` files: opens all of them, then reads all of them,
+// then closes all of them.
+static void prober_run_batch(prober_t* prober, int dir_fd, probe_request_t* requests, size_t count)
+{
+    int results[PROBE_RING_ENTRIES];
+
+    unsigned tail = *prober->sq_tail;
+    for(size_t i = 0; i < count; ++i)
+    {
+        struct io_uring_sqe* sqe = probe_next_sqe(prober, &tail);
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = dir_fd;
+        sqe->addr = (uintptr_t) requests[i].name;
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+        sqe->user_data = i;
+    }
+    uint64_t start = stats_now();
+    probe_submit_and_wait(prober, tail, count, results);
+    stats_record(Stat_Open_Time, start);
+
+    unsigned opened = 0;
+    for(size_t i = 0; i < count; ++i)
+    {
+        requests[i].length = 0;
+        requests[i].fd = results[i];
+        requests[i].failed = results[i] < 0;
+        if(requests[i].failed) continue;
+
+        struct io_uring_sqe* sqe = probe_next_sqe(prober, &tail);
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = requests[i].fd;
+        sqe->addr = (uintptr_t) requests[i].header;
+        sqe->len = sizeof(requests[i].header);
+        sqe->off = 0;
+        sqe->user_data = i;
+        opened++;
+    }
+    if(opened > 0)
+    {
+        start = stats_now();
+        probe_submit_and_wait(prober, tail, opened, results);
+        stats_record(Stat_Read_Time, start);
+
+        for(size_t i = 0; i < count; ++i)
+        {
+            if(requests[i].fd < 0) continue;
+            if(results[i] < 0) requests[i].failed = true;
+            else requests[i].length = results[i];
+
+            struct io_uring_sqe* sqe = probe_next_sqe(prober, &tail);
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->fd = requests[i].fd;
+            sqe->user_data = i;
+        }
+        probe_submit_and_wait(prober, tail, opened, results);
+
+        for(size_t i = 0; i < count; ++i)
+        {
+            if(requests[i].fd >= 0 && results[i] < 0)
+            {
+                errno = -results[i];
+                ERROR("close");
+            }
+        }
+    }
+
+    // Failed files are probed again the usual way, which reports errors just like before.
+    for(size_t i = 0; i < count; ++i)
+        requests[i].file_type = requests[i].failed ? get_file_type_at(dir_fd, requests[i].name)
+                                                   : get_file_type(requests[i].header, requests[i].length);
+}
+
+void prober_run(prober_t* prober, int dir_fd, probe_request_t* requests, size_t count)
+{
+    if(!prober->available)
+    {
+        for(size_t i = 0; i < count; ++i)
+            requests[i].file_type = get_file_type_at(dir_fd, requests[i].name);
+        return;
+    }
+
+    for(size_t i = 0; i < count; i += prober->entries)
+        prober_run_batch(prober, dir_fd, requests + i, count - i < prober->entries ? count - i : prober->entries);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "common.h"
+#include "mole_index.h"
+#include "signature.h"
+
+#include <stdint.h>
+
+#define PROBE_RING_ENTRIES 256
+
+// Single file, whose type should be found by reading its signature.
+typedef struct probe_request
+{
+    const char* name;           // Name of file inside probed directory
+    int fd;                     // Descriptor of opened file (-1 if it couldn't be opened)
+    bool failed;                // Flag telling that file has to be probed without the ring
+    size_t length;              // Number of bytes read into `header`
+    unsigned char header[MOLE_HEADER_WINDOW];   // Beginning of the file
+    file_type_t file_type;      // Result of probing
+} probe_request_t;
+
+// Probes types of many files at once. Opening, reading and closing files is submitted
+// to io_uring in batches (one batch per stage), so probing hundreds of files takes
+// a few system calls instead of three per file.
+//
+// If io_uring is not available (old kernel, disabled by seccomp or sysctl), files are
+// probed one by one using `get_file_type_at()`. Every walker thread has its own prober,
+// so then the walker threads themselves act as the pool doing blocking probes.
+typedef struct prober
+{
+    bool available;             // Flag telling whether ring was set up
+    int ring_fd;                // Io_uring instance
+    unsigned entries;           // Number of submission queue entries
+    void* sq_ring;              // Mapped submission queue ring
+    size_t sq_ring_size;        // Size of submission queue mapping
+    void* cq_ring;              // Mapped completion queue ring (may be the same as above)
+    size_t cq_ring_size;        // Size of completion queue mapping
+    void* sqes;                 // Mapped array of submission queue entries
+    size_t sqes_size;           // Size of the array mapping
+    unsigned* sq_tail;          // Fields of the rings shared with kernel
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    void* cqes;
+} prober_t;
+
+// Sets up prober, falling back to blocking probes if io_uring can't be used.
+void prober_init(prober_t* prober);
+
+// Frees resources of prober.
+void prober_free(prober_t* prober);
+
+// Finds types of `count` files inside directory `dir_fd`.
+void prober_run(prober_t* prober, int dir_fd, probe_request_t* requests, size_t count);
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+
+// Protocol spoken over server's Unix domain socket (see server.h). Client sends requests
+// and reads responses one at a time, any number of them over a single connection.
+// Both ends run on the same machine, so integers are sent in native byte order.
+//
+// Response to `Command_Count` is followed by `count` numbers of files of every type.
+// Responses to queries printing files are followed by entries, each followed by its path
+// (`path_length` bytes, not terminated). Last entry has `last` flag set and no path.
+// Responses to other commands have nothing after them.
+//
+// Queries are limited to a directory, if its path (absolute, without symbolic links) is sent
+// right after the string argument. Whole index is searched if `scope_length` is 0.
+
+#define PROTOCOL_MAGIC 0x454c4f4d       // "MOLE"
+#define PROTOCOL_STRING_MAX 255
+#define PROTOCOL_SCOPE_MAX 4095
+
+typedef enum protocol_command
+{
+    Command_Count = 1,          // Count files of every type
+    Command_Size_Range,         // Find files with size in range [`arguments[0]`, `arguments[1]`]
+    Command_Name_Part,          // Find files whose names contain the string
+    Command_Owner,              // Find files owned by user `arguments[0]`
+    Command_Index               // Start indexing (if it is not pending already)
+} protocol_command_t;
+
+typedef enum protocol_status
+{
+    Status_Ok,                  // Request was handled
+    Status_Invalid_Request,     // Request was malformed, connection is closed after this response
+    Status_Indexing_Pending,    // Indexing was not started, because it is already pending
+    Status_Scope_Not_Found      // Directory the query is limited to is not in the index
+} protocol_status_t;
+
+typedef struct protocol_request
+{
+    uint32_t magic;             // PROTOCOL_MAGIC
+    uint16_t command;           // Requested command (`protocol_command_t`)
+    uint16_t string_length;     // Length of string argument sent right after the request
+    uint16_t scope_length;      // Length of path of directory sent after the string argument
+    uint16_t reserved[3];
+    uint64_t arguments[2];      // Numeric arguments of the command
+    uint64_t offset;            // Number of skipped files (see `cli_page_t`)
+    uint64_t limit;             // Maximal number of sent files
+} protocol_request_t;
+
+typedef struct protocol_response
+{
+    uint32_t magic;             // PROTOCOL_MAGIC
+    uint32_t status;            // Result of the request (`protocol_status_t`)
+    uint64_t count;             // Number of counters following the response (for `Command_Count`)
+} protocol_response_t;
+
+typedef struct protocol_entry
+{
+    uint64_t size;              // Size of file (in bytes)
+    uint32_t path_length;       // Length of path following the entry
+    uint8_t file_type;          // Type of file (`file_type_t`)
+    uint8_t last;               // 1 for terminating entry, 0 otherwise
+    uint16_t reserved;
+} protocol_entry_t;
+
+_Static_assert(sizeof(protocol_request_t) == 48, "Layout of request changed");
+_Static_assert(sizeof(protocol_response_t) == 16, "Layout of response changed");
+_Static_assert(sizeof(protocol_entry_t) == 16, "Layout of entry changed");
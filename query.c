@@ -0,0 +1,473 @@
+#include "query.h"
+
+#include <ctype.h>
+
+typedef struct query_parser
+{
+    mole_query_t* query;            // Query being built
+    char* tokens[STR_MAX];          // Tokens of the expression (pointing into `query->text`)
+    size_t token_count;             // Number of tokens
+    size_t position;                // Number of tokens already consumed
+} query_parser_t;
+
+// Prints error message about `token` (NULL at the end of the expression). Always returns false.
+static bool query_error(const char* message, const char* token)
+{
+    if(NULL == token)
+        fprintf(stderr, "Invalid query: unexpected end of the query.\n");
+    else
+        fprintf(stderr, "Invalid query: %s `%s`.\n", message, token);
+    return false;
+}
+
+// Splits `text` into words, parentheses and comparison operators, copying them into the query.
+static bool query_tokenize(query_parser_t* parser, const char* text)
+{
+    char* output = parser->query->text;
+    char* output_end = output + sizeof(parser->query->text);
+    parser->token_count = 0;
+    parser->position = 0;
+
+    while(*text)
+    {
+        if(*text == ' ')
+        {
+            text++;
+            continue;
+        }
+
+        const char* end = text + 1;
+        if(*text != '(' && *text != ')')
+        {
+            bool operator = strchr("<>=", *text) != NULL;
+            while(*end && *end != ' ' && *end != '(' && *end != ')' && (strchr("<>=", *end) != NULL) == operator)
+                end++;
+        }
+
+        size_t length = end - text;
+        if(output + length + 1 > output_end) return query_error("query is too long at", text);
+        memcpy(output, text, length);
+        output[length] = '\0';
+
+        parser->tokens[parser->token_count++] = output;
+        output += length + 1;
+        text = end;
+    }
+
+    return true;
+}
+
+static const char* query_peek(query_parser_t* parser)
+{
+    return parser->position < parser->token_count ? parser->tokens[parser->position] : NULL;
+}
+
+static char* query_take(query_parser_t* parser)
+{
+    return parser->position < parser->token_count ? parser->tokens[parser->position++] : NULL;
+}
+
+static bool query_accept(query_parser_t* parser, const char* word)
+{
+    const char* token = query_peek(parser);
+    if(NULL == token || strcmp(token, word) != 0) return false;
+
+    parser->position++;
+    return true;
+}
+
+// Appends `node` to the query and stores its position in `result`.
+static bool query_add(query_parser_t* parser, const mole_query_node_t* node, size_t* result)
+{
+    mole_query_t* query = parser->query;
+    if(query->node_count == QUERY_NODES_MAX)
+    {
+        fprintf(stderr, "Invalid query: it has more than %d parts.\n", QUERY_NODES_MAX);
+        return false;
+    }
+
+    *result = query->node_count;
+    query->nodes[query->node_count++] = *node;
+    return true;
+}
+
+// Parses size with optional binary suffix (k, M, G or T).
+static bool query_parse_size(const char* token, uint64_t* size)
+{
+    if(NULL == token || !isdigit((unsigned char) token[0])) return query_error("expected size instead of", token);
+
+    char* end;
+    errno = 0;
+    unsigned long long number = strtoull(token, &end, 10);
+    int shift = 0;
+    switch(*end)
+    {
+        case 'k': case 'K': shift = 10; end++; break;
+        case 'M': shift = 20; end++; break;
+        case 'G': shift = 30; end++; break;
+        case 'T': shift = 40; end++; break;
+    }
+    if(*end != '\0' || errno == ERANGE || number > (UINT64_MAX >> shift))
+        return query_error("expected size instead of", token);
+
+    *size = (uint64_t) number << shift;
+    return true;
+}
+
+static bool query_parse_expression(query_parser_t* parser, size_t* result);
+
+static bool query_parse_predicate(query_parser_t* parser, size_t* result)
+{
+    mole_query_node_t node;
+    memset(&node, 0, sizeof(node));
+
+    const char* word = query_take(parser);
+    char* value = query_take(parser);
+    if(NULL == word) return query_error(NULL, NULL);
+    if(NULL == value) return query_error("missing value of", word);
+
+    if(strcmp(word, "name") == 0)
+    {
+        node.kind = Query_Name;
+        node.string = value;
+    }
+    else if(strcmp(word, "size") == 0)
+    {
+        uint64_t size = 0;
+        if(!query_parse_size(query_take(parser), &size)) return false;
+
+        // Empty ranges have minimum larger than maximum.
+        node.kind = Query_Size;
+        node.min_size = 0;
+        node.max_size = UINT64_MAX;
+        if(strcmp(value, "<") == 0)
+        {
+            node.min_size = size == 0 ? 1 : 0;
+            node.max_size = size == 0 ? 0 : size - 1;
+        }
+        else if(strcmp(value, "<=") == 0)
+            node.max_size = size;
+        else if(strcmp(value, ">") == 0)
+        {
+            node.min_size = size == UINT64_MAX ? 1 : size + 1;
+            node.max_size = size == UINT64_MAX ? 0 : UINT64_MAX;
+        }
+        else if(strcmp(value, ">=") == 0)
+            node.min_size = size;
+        else if(strcmp(value, "=") == 0)
+            node.min_size = node.max_size = size;
+        else
+            return query_error("expected comparison instead of", value);
+    }
+    else if(strcmp(word, "owner") == 0)
+    {
+        char* end;
+        unsigned long uid = strtoul(value, &end, 10);
+        if(*end != '\0' || end == value || uid > UINT32_MAX) return query_error("expected user id instead of", value);
+
+        node.kind = Query_Owner;
+        node.uid = uid;
+    }
+    else if(strcmp(word, "type") == 0)
+    {
+        node.kind = Query_Type;
+        node.type = Removed;
+#define X(file_type, letter, description, summary_name) if(value[0] == letter && value[1] == '\0') node.type = file_type;
+        MOLE_FILE_TYPES(X)
+#undef X
+        if(node.type == Removed) return query_error("unknown type", value);
+    }
+    else if(strcmp(word, "path") == 0)
+    {
+        // Paths in the index are absolute and without symbolic links. Path that doesn't exist
+        // anymore may still be in the index, so it is looked up as it is.
+        node.kind = Query_Path;
+        node.string = realpath(value, NULL);
+        if(NULL == node.string && NULL == (node.string = strdup(value))) ERROR("strdup");
+        if(query_add(parser, &node, result)) return true;
+
+        free(node.string);
+        return false;
+    }
+    else
+        return query_error("unknown predicate", word);
+
+    return query_add(parser, &node, result);
+}
+
+static bool query_parse_factor(query_parser_t* parser, size_t* result)
+{
+    mole_query_node_t node;
+    memset(&node, 0, sizeof(node));
+
+    if(query_accept(parser, "not"))
+    {
+        node.kind = Query_Not;
+        return query_parse_factor(parser, &node.left) && query_add(parser, &node, result);
+    }
+
+    if(query_accept(parser, "("))
+    {
+        if(!query_parse_expression(parser, result)) return false;
+        return query_accept(parser, ")") || query_error("expected `)` instead of", query_peek(parser));
+    }
+
+    return query_parse_predicate(parser, result);
+}
+
+static bool query_parse_term(query_parser_t* parser, size_t* result)
+{
+    if(!query_parse_factor(parser, result)) return false;
+
+    // Predicates following each other are combined by `and`, even without it.
+    for(;;)
+    {
+        const char* token = query_peek(parser);
+        if(NULL == token || strcmp(token, ")") == 0 || strcmp(token, "or") == 0) return true;
+        query_accept(parser, "and");
+
+        mole_query_node_t node;
+        memset(&node, 0, sizeof(node));
+        node.kind = Query_And;
+        node.left = *result;
+        if(!query_parse_factor(parser, &node.right) || !query_add(parser, &node, result)) return false;
+    }
+}
+
+static bool query_parse_expression(query_parser_t* parser, size_t* result)
+{
+    if(!query_parse_term(parser, result)) return false;
+
+    while(query_accept(parser, "or"))
+    {
+        mole_query_node_t node;
+        memset(&node, 0, sizeof(node));
+        node.kind = Query_Or;
+        node.left = *result;
+        if(!query_parse_term(parser, &node.right) || !query_add(parser, &node, result)) return false;
+    }
+
+    return true;
+}
+
+bool query_parse(mole_query_t* query, const char* text)
+{
+    query_parser_t parser;
+    parser.query = query;
+    query->node_count = 0;
+
+    size_t root;
+    bool valid = query_tokenize(&parser, text) && query_parse_expression(&parser, &root);
+    if(valid && parser.position < parser.token_count)
+        valid = query_error("unexpected", query_peek(&parser));
+
+    if(!valid) query_free(query);
+    return valid;
+}
+
+void query_free(mole_query_t* query)
+{
+    for(size_t i = 0; i < query->node_count; ++i)
+        if(query->nodes[i].kind == Query_Path)
+            free(query->nodes[i].string);
+
+    query->node_count = 0;
+}
+
+// Returns number of entries, that query limited to `scope` has to check one by one.
+static uint64_t query_scope_extent(const mole_scope_t* scope, const mole_index_t* index)
+{
+    if(scope->id == MOLE_NO_ENTRY) return index->size;
+
+    uint64_t tail = scope->tail > scope->end ? scope->tail : scope->end;
+    return (scope->end - scope->begin) + (index->size - tail);
+}
+
+void query_plan(mole_query_plan_t* plan, const mole_query_t* query, const mole_index_t* index,
+                const mole_scope_t* within)
+{
+    plan->within = *within;
+    plan->min_size = 0;
+    plan->max_size = UINT64_MAX;
+    plan->string = NULL;
+    plan->uid = 0;
+
+    // Subtree searched by scanning is the smallest of those every match has to belong to.
+    mole_scope_t scope = *within;
+    bool empty = false;
+    for(size_t i = 0; i < query->node_count; ++i)
+        if(query->nodes[i].kind == Query_Path && !scope_find(&plan->paths[i], index, query->nodes[i].string))
+            scope_empty(&plan->paths[i], index);
+
+    // Predicates every match has to satisfy are found by descending through `and` nodes.
+    size_t conjuncts[QUERY_NODES_MAX];
+    size_t conjunct_count = 0;
+    size_t stack[QUERY_NODES_MAX];
+    size_t depth = 0;
+    stack[depth++] = query->node_count - 1;
+    while(depth > 0)
+    {
+        const mole_query_node_t* node = &query->nodes[stack[--depth]];
+        if(node->kind != Query_And)
+        {
+            conjuncts[conjunct_count++] = node - query->nodes;
+            continue;
+        }
+
+        stack[depth++] = node->right;
+        stack[depth++] = node->left;
+    }
+
+    for(size_t i = 0; i < conjunct_count; ++i)
+    {
+        const mole_query_node_t* node = &query->nodes[conjuncts[i]];
+        if(node->kind == Query_Size)
+        {
+            if(node->min_size > plan->min_size) plan->min_size = node->min_size;
+            if(node->max_size < plan->max_size) plan->max_size = node->max_size;
+        }
+        else if(node->kind == Query_Path)
+        {
+            const mole_scope_t* path = &plan->paths[conjuncts[i]];
+            if(path->id == MOLE_NO_ENTRY) empty = true;
+            else if(query_scope_extent(path, index) < query_scope_extent(&scope, index)) scope = *path;
+        }
+    }
+
+    // Size order is always available. Entries it doesn't cover are added to every estimate.
+    const mole_size_order_t* order = &index->size_order;
+    uint64_t count = 0;
+    if(plan->min_size <= plan->max_size)
+    {
+        size_t end = plan->max_size == UINT64_MAX ? order->indexed : size_order_lower_bound(order, index, plan->max_size + 1);
+        count = end - size_order_lower_bound(order, index, plan->min_size);
+    }
+    else
+        empty = true;
+
+    plan->access = Access_Size_Order;
+    plan->cost = count + (index->size - order->indexed);
+    scope_whole(&plan->scope, index);
+    if(empty)
+    {
+        plan->min_size = 1;
+        plan->max_size = 0;
+        plan->cost = 0;
+        return;
+    }
+
+    if(scope.id != MOLE_NO_ENTRY && query_scope_extent(&scope, index) / QUERY_SCAN_COST_DIVISOR < plan->cost)
+    {
+        plan->access = Access_Scan;
+        plan->cost = query_scope_extent(&scope, index) / QUERY_SCAN_COST_DIVISOR;
+        plan->scope = scope;
+    }
+
+    for(size_t i = 0; i < conjunct_count; ++i)
+    {
+        const mole_query_node_t* node = &query->nodes[conjuncts[i]];
+        if(node->kind == Query_Name)
+        {
+            const mole_trigrams_t* trigrams = &index->trigrams;
+            uint64_t cost = trigrams_estimate(trigrams, node->string) + (index->size - trigrams->indexed);
+            if(cost < plan->cost)
+            {
+                plan->access = Access_Trigrams;
+                plan->cost = cost;
+                plan->string = node->string;
+                plan->scope = scope;
+            }
+        }
+        else if(node->kind == Query_Owner)
+        {
+            const mole_owners_t* owners = &index->owners;
+            size_t k = owners_find(owners, node->uid);
+            uint64_t cost = (k < owners->owner_count ? owners->offsets[k + 1] - owners->offsets[k] : 0)
+                          + (index->size - owners->indexed);
+            if(cost < plan->cost)
+            {
+                plan->access = Access_Owners;
+                plan->cost = cost;
+                plan->uid = node->uid;
+                scope_whole(&plan->scope, index);
+            }
+        }
+    }
+}
+
+void query_start(mole_cursor_t* cursor, const mole_query_plan_t* plan, const mole_index_t* index)
+{
+    switch(plan->access)
+    {
+        case Access_Scan:
+        case Access_Size_Order:
+            cursor_size_range(cursor, index, &plan->scope, plan->min_size, plan->max_size);
+            break;
+        case Access_Trigrams:
+            cursor_name_part(cursor, index, &plan->scope, plan->string);
+            break;
+        case Access_Owners:
+            cursor_owner(cursor, index, &plan->scope, plan->uid);
+            break;
+    }
+}
+
+static bool query_node_matches(const mole_query_t* query, const mole_query_plan_t* plan,
+                               const mole_index_t* index, uint64_t id, size_t position)
+{
+    const mole_query_node_t* node = &query->nodes[position];
+    switch(node->kind)
+    {
+        case Query_And:
+            return query_node_matches(query, plan, index, id, node->left)
+                && query_node_matches(query, plan, index, id, node->right);
+        case Query_Or:
+            return query_node_matches(query, plan, index, id, node->left)
+                || query_node_matches(query, plan, index, id, node->right);
+        case Query_Not:
+            return !query_node_matches(query, plan, index, id, node->left);
+        case Query_Name:
+            return strstr(index_entry_name(index, &index->elements[id]), node->string) != NULL;
+        case Query_Size:
+            return index->sizes[id] >= node->min_size && index->sizes[id] <= node->max_size;
+        case Query_Owner:
+            return index->owner_uids[id] == node->uid;
+        case Query_Type:
+            return index->file_types[id] == node->type;
+        case Query_Path:
+            return scope_contains(&plan->paths[position], index, id);
+    }
+
+    return false;
+}
+
+bool query_matches(const mole_query_t* query, const mole_query_plan_t* plan, const mole_index_t* index, uint64_t id)
+{
+    if(plan->within.id != MOLE_NO_ENTRY && !scope_contains(&plan->within, index, id)) return false;
+
+    return query_node_matches(query, plan, index, id, query->node_count - 1);
+}
+
+void query_describe(const mole_query_plan_t* plan, char* buffer, size_t size)
+{
+    switch(plan->access)
+    {
+        case Access_Scan:
+            snprintf(buffer, size, "scan of subtree of %lu entries", plan->scope.end - plan->scope.begin);
+            break;
+        case Access_Size_Order:
+            if(plan->min_size > plan->max_size)
+                snprintf(buffer, size, "nothing, no entry can match");
+            else if(plan->max_size == UINT64_MAX)
+                snprintf(buffer, size, "size order, sizes from %lu", plan->min_size);
+            else
+                snprintf(buffer, size, "size order, sizes from %lu to %lu", plan->min_size, plan->max_size);
+            break;
+        case Access_Trigrams:
+            snprintf(buffer, size, "trigram index, names containing \"%s\"", plan->string);
+            break;
+        case Access_Owners:
+            snprintf(buffer, size, "list of files of user with id %u", plan->uid);
+            break;
+    }
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "common.h"
+#include "cursor.h"
+#include "mole_index.h"
+
+#include <stdint.h>
+
+#define QUERY_NODES_MAX 64
+#define QUERY_SCAN_COST_DIVISOR 4
+
+// Expression of `find` command: boolean combination of predicates on entries.
+//
+//   expression := term { `or` term }
+//   term       := factor { [`and`] factor }
+//   factor     := `not` factor | `(` expression `)` | predicate
+//   predicate  := `name` <string>                  (name contains <string>)
+//               | `size` (`<`|`<=`|`>`|`>=`|`=`) <n>[k|M|G|T]
+//               | `owner` <uid>
+//               | `type` <letter>                   (letter as printed by queries)
+//               | `path` <directory>                (entry is inside <directory>)
+//
+// Expression is stored as a tree of nodes, children always precede their parent.
+typedef enum query_node_kind
+{
+    Query_And,                  // Both operands match
+    Query_Or,                   // At least one of operands matches
+    Query_Not,                  // Operand (`left`) doesn't match
+    Query_Name,                 // Name contains `string`
+    Query_Size,                 // Size is in range [`min_size`, `max_size`]
+    Query_Owner,                // Owner is user `uid`
+    Query_Type,                 // Type is `type`
+    Query_Path                  // Entry belongs to subtree of directory `string`
+} query_node_kind_t;
+
+typedef struct mole_query_node
+{
+    query_node_kind_t kind;     // Kind of the node
+    size_t left;                // Operands of `and`, `or` and `not`
+    size_t right;
+    char* string;               // Parameters of predicates (depending on kind), directory of
+                                // `path` is allocated (absolute, without symbolic links)
+    uint64_t min_size;
+    uint64_t max_size;
+    uid_t uid;
+    file_type_t type;
+} mole_query_node_t;
+
+typedef struct mole_query
+{
+    char text[2 * STR_MAX];                     // Tokens of the expression, strings of nodes point into them
+    size_t node_count;                          // Number of nodes
+    mole_query_node_t nodes[QUERY_NODES_MAX];   // Nodes, the last one is the root
+} mole_query_t;
+
+typedef enum query_access
+{
+    Access_Scan,                // Entries of the scope are scanned (checking size first)
+    Access_Size_Order,          // Entries in size range are taken from size order
+    Access_Trigrams,            // Candidates are taken from trigram index
+    Access_Owners               // Entries are taken from owner's posting list
+} query_access_t;
+
+// The way the query is answered for a single index. The most selective access path
+// is chosen among predicates every match has to satisfy (ones combined by `and` at
+// the top of the expression), whole expression is then evaluated on its candidates.
+typedef struct mole_query_plan
+{
+    query_access_t access;                      // Chosen access path
+    uint64_t cost;                              // Estimated number of candidates (scanned entries are cheaper)
+    uint64_t min_size;                          // Size range that every match has to be in
+    uint64_t max_size;
+    const char* string;                         // Name part used by trigram access path
+    uid_t uid;                                  // Owner used by owners access path
+    mole_scope_t scope;                         // Subtree searched by the access path
+    mole_scope_t within;                        // Subtree every match has to belong to (query's `in`)
+    mole_scope_t paths[QUERY_NODES_MAX];        // Subtrees of `path` predicates (by node)
+} mole_query_plan_t;
+
+// Parses `text` into `query`. Prints error message and returns false if it is not valid
+// (nothing has to be freed then).
+bool query_parse(mole_query_t* query, const char* text);
+
+// Frees memory used by the query.
+void query_free(mole_query_t* query);
+
+// Chooses access path of the query for `index`, limited to `within`.
+void query_plan(mole_query_plan_t* plan, const mole_query_t* query, const mole_index_t* index,
+                const mole_scope_t* within);
+
+// Initializes cursor over candidates of the plan (they still have to be checked by `query_matches()`).
+void query_start(mole_cursor_t* cursor, const mole_query_plan_t* plan, const mole_index_t* index);
+
+// Checks whether entry `id` matches the query (and belongs to `within` subtree of the plan).
+bool query_matches(const mole_query_t* query, const mole_query_plan_t* plan, const mole_index_t* index, uint64_t id);
+
+// Describes access path of the plan into `buffer` (of `size` bytes).
+void query_describe(const mole_query_plan_t* plan, char* buffer, size_t size);
@@ -0,0 +1,72 @@
+#include "rollup.h"
+#include "mole_index.h"
+
+void rollups_init(mole_rollups_t* rollups)
+{
+    rollups->indexed = 0;
+    rollups->totals = NULL;
+    rollups->owned = true;
+}
+
+void rollups_free(mole_rollups_t* rollups)
+{
+    if(rollups->owned) free(rollups->totals);
+
+    rollups_init(rollups);
+}
+
+void rollups_build(mole_rollups_t* rollups, const mole_index_t* index)
+{
+    rollups_free(rollups);
+
+    size_t indexed = index->subtrees.indexed;
+    uint64_t* totals = malloc((indexed + 1) * sizeof(uint64_t));
+    if(NULL == totals) ERROR("malloc");
+
+    for(size_t i = 0; i < indexed; ++i)
+        totals[i] = index->file_types[i] == Removed ? 0 : index->sizes[i];
+
+    // In pre-order every entry follows its parent, so children are added up before their parent is.
+    for(size_t i = indexed; i-- > 0;)
+    {
+        uint64_t parent = index->elements[i].parent;
+        if(parent != MOLE_NO_ENTRY) totals[parent] += totals[i];
+    }
+
+    rollups->indexed = indexed;
+    rollups->totals = totals;
+    rollups->owned = true;
+}
+
+void rollups_detach(mole_rollups_t* rollups)
+{
+    if(rollups->owned) return;
+
+    uint64_t* totals = malloc((rollups->indexed + 1) * sizeof(uint64_t));
+    if(NULL == totals) ERROR("malloc");
+    memcpy(totals, rollups->totals, rollups->indexed * sizeof(uint64_t));
+
+    rollups->totals = totals;
+    rollups->owned = true;
+}
+
+// Adds `delta` (modulo 2^64) to totals of entry `id` and all its ancestors.
+static void rollups_add(mole_rollups_t* rollups, const mole_index_t* index, uint64_t id, uint64_t delta)
+{
+    for(; id < rollups->indexed; id = index->elements[id].parent)
+        rollups->totals[id] += delta;
+}
+
+void rollups_update(mole_rollups_t* rollups, const mole_index_t* index, uint64_t id, uint64_t new_size)
+{
+    if(id >= rollups->indexed || index->file_types[id] == Removed) return;
+
+    rollups_add(rollups, index, id, new_size - index->sizes[id]);
+}
+
+void rollups_forget(mole_rollups_t* rollups, const mole_index_t* index, uint64_t id)
+{
+    if(id >= rollups->indexed || index->file_types[id] == Removed) return;
+
+    rollups_add(rollups, index, id, -index->sizes[id]);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "common.h"
+
+#include <stdint.h>
+
+// Cumulative sizes of subtrees: total size of every entry together with all entries
+// inside of it, so that `du` doesn't have to add up sizes of files on every query.
+// Totals are computed when the index is prepared and kept up to date when entries
+// are modified or removed.
+//
+// Totals cover entries [0, `indexed`), which are numbered in pre-order (see `mole_subtrees_t`).
+// Entries added later (by watcher) are not covered and their sizes have to be added
+// to totals of their ancestors by the query, until totals are computed again.
+typedef struct mole_rollups
+{
+    size_t indexed;     // Number of entries covered by the totals
+    uint64_t* totals;   // Total sizes of subtrees of entries (`indexed` elements)
+    bool owned;         // Flag telling whether array was allocated (or is mapped)
+} mole_rollups_t;
+
+// Initializes empty totals, that cover no entries.
+void rollups_init(mole_rollups_t* rollups);
+
+// Frees memory used by the totals.
+void rollups_free(mole_rollups_t* rollups);
+
+// Computes totals of the prefix of the index covered by subtree ranges.
+void rollups_build(mole_rollups_t* rollups, const mole_index_t* index);
+
+// Copies mapped array into totals' own memory.
+void rollups_detach(mole_rollups_t* rollups);
+
+// Updates totals of the entry and its ancestors, as its size is about to change to `new_size`.
+// Has to be called before the entry is modified.
+void rollups_update(mole_rollups_t* rollups, const mole_index_t* index, uint64_t id, uint64_t new_size);
+
+// Updates totals of the entry and its ancestors, as the entry is about to be removed.
+void rollups_forget(mole_rollups_t* rollups, const mole_index_t* index, uint64_t id);
@@ -0,0 +1,335 @@
+#include "roots.h"
+
+bool roots_query_begin(mole_roots_query_t* query, mole_roots_t* roots, const char* scope_path)
+{
+    query->count = 0;
+    query->current = 0;
+    query->snapshots = malloc(roots->count * sizeof(mole_snapshot_t*));
+    query->scopes = malloc(roots->count * sizeof(mole_scope_t));
+    query->contexts = malloc(roots->count * sizeof(mole_context_t*));
+    query->cursors = calloc(roots->count, sizeof(mole_cursor_t));
+    query->expression = NULL;
+    query->plans = NULL;
+    if(NULL == query->snapshots || NULL == query->scopes || NULL == query->contexts || NULL == query->cursors)
+        ERROR("malloc");
+
+    // Roots not containing the directory are left out, so they aren't searched at all.
+    for(size_t i = 0; i < roots->count; ++i)
+    {
+        mole_snapshot_t* snapshot = snapshot_acquire(&roots->contexts[i]);
+        mole_scope_t* scope = &query->scopes[query->count];
+        if(NULL == scope_path)
+            scope_whole(scope, &snapshot->index);
+        else if(!scope_find(scope, &snapshot->index, scope_path))
+        {
+            snapshot_release(snapshot);
+            continue;
+        }
+
+        query->contexts[query->count] = &roots->contexts[i];
+        query->snapshots[query->count++] = snapshot;
+    }
+
+    if(query->count > 0) return true;
+    roots_query_end(query);
+    return false;
+}
+
+void roots_query_count_types(mole_roots_query_t* query, uint64_t* counts)
+{
+    for(size_t i = 0; i < query->count; ++i)
+        scope_count_types(&query->scopes[i], &query->snapshots[i]->index, counts);
+}
+
+void roots_query_size_range(mole_roots_query_t* query, uint64_t min_size, uint64_t max_size)
+{
+    for(size_t i = 0; i < query->count; ++i)
+        cursor_size_range(&query->cursors[i], &query->snapshots[i]->index, &query->scopes[i], min_size, max_size);
+}
+
+void roots_query_name_part(mole_roots_query_t* query, const char* string)
+{
+    for(size_t i = 0; i < query->count; ++i)
+        cursor_name_part(&query->cursors[i], &query->snapshots[i]->index, &query->scopes[i], string);
+}
+
+void roots_query_owner(mole_roots_query_t* query, uid_t uid)
+{
+    for(size_t i = 0; i < query->count; ++i)
+        cursor_owner(&query->cursors[i], &query->snapshots[i]->index, &query->scopes[i], uid);
+}
+
+void roots_query_find(mole_roots_query_t* query, const mole_query_t* expression)
+{
+    query->expression = expression;
+    query->plans = malloc(query->count * sizeof(mole_query_plan_t));
+    if(NULL == query->plans) ERROR("malloc");
+
+    // Every root has its own plan, as selectivity of predicates differs between them.
+    for(size_t i = 0; i < query->count; ++i)
+    {
+        const mole_index_t* index = &query->snapshots[i]->index;
+        query_plan(&query->plans[i], expression, index, &query->scopes[i]);
+        query_start(&query->cursors[i], &query->plans[i], index);
+    }
+}
+
+bool roots_query_next(mole_roots_query_t* query, const mole_index_t** index, uint64_t* id)
+{
+    for(; query->current < query->count; ++query->current)
+    {
+        mole_cursor_t* cursor = &query->cursors[query->current];
+        const mole_query_plan_t* plan = NULL == query->plans ? NULL : &query->plans[query->current];
+        while(cursor_next(cursor, id))
+        {
+            // Candidates of the plan are checked against the whole expression.
+            if(NULL != plan && !query_matches(query->expression, plan, cursor->index, *id)) continue;
+
+            *index = cursor->index;
+            return true;
+        }
+
+        // Candidates of exhausted cursor aren't needed anymore.
+        cursor_free(cursor);
+    }
+
+    return false;
+}
+
+// Ranked entries are kept in a min-heap bounded to `k` elements, so that memory used
+// doesn't depend on the size of indexes. Ties are broken by id (larger id ranks higher).
+typedef struct roots_ranking
+{
+    size_t k;                   // Maximal number of ranked entries
+    size_t count;               // Number of entries in the heap
+    mole_ranked_t* heap;        // Ranked entries, the smallest one at the top
+} roots_ranking_t;
+
+static bool roots_ranked_below(const mole_ranked_t* a, const mole_ranked_t* b)
+{
+    return a->size < b->size || (a->size == b->size && a->id < b->id);
+}
+
+static void roots_ranking_init(roots_ranking_t* ranking, mole_roots_query_t* query, size_t k)
+{
+    // There can't be more ranked entries than entries in searched indexes.
+    size_t entries = 0;
+    for(size_t i = 0; i < query->count; ++i)
+        entries += query->snapshots[i]->index.size;
+
+    ranking->k = k < entries ? k : entries;
+    ranking->count = 0;
+    ranking->heap = malloc((ranking->k + 1) * sizeof(mole_ranked_t));
+    if(NULL == ranking->heap) ERROR("malloc");
+}
+
+// Moves element at position `i` down the heap of `count` elements.
+static void roots_ranking_sift_down(mole_ranked_t* heap, size_t count, size_t i)
+{
+    for(;;)
+    {
+        size_t smallest = i, left = 2 * i + 1, right = 2 * i + 2;
+        if(left < count && roots_ranked_below(&heap[left], &heap[smallest])) smallest = left;
+        if(right < count && roots_ranked_below(&heap[right], &heap[smallest])) smallest = right;
+        if(smallest == i) return;
+
+        mole_ranked_t swapped = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = swapped;
+        i = smallest;
+    }
+}
+
+// Checks whether entry `id` of size `size` would get into the ranking.
+static bool roots_ranking_accepts(const roots_ranking_t* ranking, uint64_t id, uint64_t size)
+{
+    mole_ranked_t ranked = { .id = id, .size = size };
+    return ranking->count < ranking->k || (ranking->k > 0 && roots_ranked_below(&ranking->heap[0], &ranked));
+}
+
+static void roots_ranking_offer(roots_ranking_t* ranking, const mole_index_t* index, uint64_t id, uint64_t size)
+{
+    mole_ranked_t ranked = { .index = index, .id = id, .size = size };
+    mole_ranked_t* heap = ranking->heap;
+    if(ranking->count < ranking->k)
+    {
+        size_t i = ranking->count++;
+        for(; i > 0 && roots_ranked_below(&ranked, &heap[(i - 1) / 2]); i = (i - 1) / 2)
+            heap[i] = heap[(i - 1) / 2];
+        heap[i] = ranked;
+    }
+    else if(roots_ranking_accepts(ranking, id, size))
+    {
+        heap[0] = ranked;
+        roots_ranking_sift_down(heap, ranking->count, 0);
+    }
+}
+
+// Sorts ranked entries (the largest first) and returns them.
+static mole_ranked_t* roots_ranking_finish(roots_ranking_t* ranking, size_t* count)
+{
+    // The smallest entry is moved behind the shrinking heap, until it is empty.
+    mole_ranked_t* heap = ranking->heap;
+    for(size_t n = ranking->count; n > 1; --n)
+    {
+        mole_ranked_t smallest = heap[0];
+        heap[0] = heap[n - 1];
+        heap[n - 1] = smallest;
+        roots_ranking_sift_down(heap, n - 1, 0);
+    }
+
+    *count = ranking->count;
+    return heap;
+}
+
+static bool roots_is_file(const mole_index_t* index, uint64_t id)
+{
+    return index->file_types[id] != Directory && index->file_types[id] != Removed;
+}
+
+mole_ranked_t* roots_query_top(mole_roots_query_t* query, size_t k, size_t* count)
+{
+    roots_ranking_t ranking;
+    roots_ranking_init(&ranking, query, k);
+
+    for(size_t r = 0; r < query->count; ++r)
+    {
+        const mole_index_t* index = &query->snapshots[r]->index;
+        const mole_size_order_t* order = &index->size_order;
+        const mole_scope_t* scope = &query->scopes[r];
+
+        // Size order is followed from the largest entry, until no other one can get into
+        // the ranking. Small scope is scanned instead, as most of large entries are outside of it.
+        uint64_t extent = scope->end - scope->begin;
+        bool ordered = extent > 0 && ranking.k * (uint64_t) order->indexed / extent < extent / QUERY_SCAN_COST_DIVISOR;
+        if(ordered)
+        {
+            for(size_t i = order->indexed; i-- > 0;)
+            {
+                // Entries further in the order are smaller (or of equal size and smaller id).
+                uint64_t id = order->ids[i];
+                if(!roots_ranking_accepts(&ranking, id, index->sizes[id])) break;
+                if(roots_is_file(index, id) && scope_contains(scope, index, id))
+                    roots_ranking_offer(&ranking, index, id, index->sizes[id]);
+            }
+        }
+        else
+        {
+            for(size_t id = scope->begin; id < scope->end; ++id)
+                if(roots_is_file(index, id))
+                    roots_ranking_offer(&ranking, index, id, index->sizes[id]);
+        }
+
+        // Entries not covered by size order or subtree ranges are checked one by one.
+        size_t tail = ordered ? order->indexed : scope->tail > scope->end ? scope->tail : scope->end;
+        for(size_t id = tail; id < index->size; ++id)
+            if(roots_is_file(index, id) && roots_ranking_accepts(&ranking, id, index->sizes[id])
+               && scope_contains(scope, index, id))
+                roots_ranking_offer(&ranking, index, id, index->sizes[id]);
+    }
+
+    return roots_ranking_finish(&ranking, count);
+}
+
+// Size of an entry not covered by totals, that has to be added to total of entry `id`.
+typedef struct roots_delta
+{
+    uint64_t id;        // Entry whose total changes
+    uint64_t size;      // Size added to it
+} roots_delta_t;
+
+static int roots_delta_compare(const void* a, const void* b)
+{
+    uint64_t first = ((const roots_delta_t*) a)->id, second = ((const roots_delta_t*) b)->id;
+    return first < second ? -1 : first > second;
+}
+
+// Collects sizes of entries not covered by totals of `index` (added by watcher) into `deltas`,
+// merged per entry they have to be added to (sorted by id). Returns number of deltas.
+static size_t roots_collect_deltas(const mole_index_t* index, roots_delta_t** deltas)
+{
+    size_t count = 0, capacity = 0;
+    *deltas = NULL;
+    for(uint64_t added = index->rollups.indexed; added < index->size; ++added)
+    {
+        if(index->file_types[added] == Removed) continue;
+
+        // Entry itself is included, as total of an uncovered directory is made of deltas only.
+        for(uint64_t id = added; id < index->size; id = index->elements[id].parent)
+        {
+            if(count == capacity)
+            {
+                capacity = capacity == 0 ? 64 : 2 * capacity;
+                *deltas = realloc(*deltas, capacity * sizeof(roots_delta_t));
+                if(NULL == *deltas) ERROR("realloc");
+            }
+            (*deltas)[count++] = (roots_delta_t) { .id = id, .size = index->sizes[added] };
+        }
+    }
+    if(count == 0) return 0;
+
+    qsort(*deltas, count, sizeof(roots_delta_t), roots_delta_compare);
+    size_t merged = 0;
+    for(size_t i = 0; i < count; ++i)
+    {
+        if(merged > 0 && (*deltas)[merged - 1].id == (*deltas)[i].id)
+            (*deltas)[merged - 1].size += (*deltas)[i].size;
+        else
+            (*deltas)[merged++] = (*deltas)[i];
+    }
+
+    return merged;
+}
+
+// Returns total size of subtree of directory `id`.
+static uint64_t roots_total(const mole_index_t* index, uint64_t id, const roots_delta_t* deltas, size_t delta_count)
+{
+    uint64_t total = id < index->rollups.indexed ? index->rollups.totals[id] : 0;
+    roots_delta_t key = { .id = id };
+    const roots_delta_t* delta = delta_count == 0 ? NULL
+                               : bsearch(&key, deltas, delta_count, sizeof(roots_delta_t), roots_delta_compare);
+    return NULL == delta ? total : total + delta->size;
+}
+
+mole_ranked_t* roots_query_du(mole_roots_query_t* query, size_t k, size_t* count)
+{
+    roots_ranking_t ranking;
+    roots_ranking_init(&ranking, query, k);
+
+    for(size_t r = 0; r < query->count; ++r)
+    {
+        const mole_index_t* index = &query->snapshots[r]->index;
+        const mole_scope_t* scope = &query->scopes[r];
+
+        roots_delta_t* deltas;
+        size_t delta_count = roots_collect_deltas(index, &deltas);
+
+        // Totals are precomputed, so only types of entries in the scope are scanned.
+        for(size_t id = scope->begin; id < scope->end; ++id)
+            if(index->file_types[id] == Directory)
+                roots_ranking_offer(&ranking, index, id, roots_total(index, id, deltas, delta_count));
+
+        for(size_t id = scope->tail > scope->end ? scope->tail : scope->end; id < index->size; ++id)
+            if(index->file_types[id] == Directory && scope_contains(scope, index, id))
+                roots_ranking_offer(&ranking, index, id, roots_total(index, id, deltas, delta_count));
+
+        free(deltas);
+    }
+
+    return roots_ranking_finish(&ranking, count);
+}
+
+void roots_query_end(mole_roots_query_t* query)
+{
+    for(size_t i = 0; i < query->count; ++i)
+    {
+        cursor_free(&query->cursors[i]);
+        snapshot_release(query->snapshots[i]);
+    }
+
+    free(query->snapshots);
+    free(query->scopes);
+    free(query->contexts);
+    free(query->cursors);
+    free(query->plans);
+}
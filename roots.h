@@ -0,0 +1,76 @@
+#pragma once
+
+#include "common.h"
+#include "cursor.h"
+#include "mole_index.h"
+#include "query.h"
+#include "snapshot.h"
+
+// Directories indexed by the program. Every root has its own context (see `mole_context_t`):
+// its own index and snapshots, cache file, indexing worker, watcher and reindex interval.
+// Roots are indexed independently of each other, so slow root (e.g. network filesystem)
+// doesn't hold back the others, and query of a root never waits for indexing of another.
+typedef struct mole_roots
+{
+    size_t count;                   // Number of roots
+    mole_context_t* contexts;       // Contexts of roots (`count` elements)
+} mole_roots_t;
+
+// Query over all roots. It pins current snapshot of every root and yields matches
+// of one root after another, so results of a root are in the same order as if
+// it was the only one.
+typedef struct mole_roots_query
+{
+    size_t count;                   // Number of roots searched by the query
+    mole_snapshot_t** snapshots;    // Pinned snapshots of searched roots
+    mole_scope_t* scopes;           // Parts of their indexes searched by the query
+    mole_context_t** contexts;      // Contexts of searched roots
+    mole_cursor_t* cursors;         // Cursors over their indexes (see `roots_query_*()`)
+    const mole_query_t* expression; // Expression matches have to satisfy (or NULL)
+    mole_query_plan_t* plans;       // Plans of the expression for every searched root (or NULL)
+    size_t current;                 // Root, whose cursor is used now
+} mole_roots_query_t;
+
+// Entry ranked by `top` and `du` queries.
+typedef struct mole_ranked
+{
+    const mole_index_t* index;      // Index of the entry
+    uint64_t id;                    // Id of the entry
+    uint64_t size;                  // Size the entry is ranked by
+} mole_ranked_t;
+
+// Pins snapshots of roots, that contain directory `scope_path` (all roots if NULL).
+// `scope_path` has to be absolute and without symbolic links. Returns false, if no root
+// contains it (nothing has to be freed then).
+bool roots_query_begin(mole_roots_query_t* query, mole_roots_t* roots, const char* scope_path);
+
+// Adds number of entries of every type in searched parts of indexes to `counts`.
+void roots_query_count_types(mole_roots_query_t* query, uint64_t* counts);
+
+// Initializes cursors over entries with size in range [`min_size`, `max_size`].
+void roots_query_size_range(mole_roots_query_t* query, uint64_t min_size, uint64_t max_size);
+
+// Initializes cursors over entries, whose names contain `string`.
+void roots_query_name_part(mole_roots_query_t* query, const char* string);
+
+// Initializes cursors over entries owned by user `uid`.
+void roots_query_owner(mole_roots_query_t* query, uid_t uid);
+
+// Plans `expression` for every root and initializes cursors over its candidates.
+// Expression has to stay valid until the query ends.
+void roots_query_find(mole_roots_query_t* query, const mole_query_t* expression);
+
+// Stores next match (its index and id) in `index` and `id`. Returns false if there are no more matches.
+bool roots_query_next(mole_roots_query_t* query, const mole_index_t** index, uint64_t* id);
+
+// Finds at most `k` largest files (other than directories) in searched parts of indexes.
+// Returns allocated array of them (the largest first) and stores their number in `count`.
+mole_ranked_t* roots_query_top(mole_roots_query_t* query, size_t k, size_t* count);
+
+// Finds at most `k` directories in searched parts of indexes with the largest total size
+// of their subtrees (see `mole_rollups_t`). Returns allocated array of them (the largest
+// first, ranked by total size) and stores their number in `count`.
+mole_ranked_t* roots_query_du(mole_roots_query_t* query, size_t k, size_t* count);
+
+// Frees cursors and releases pinned snapshots.
+void roots_query_end(mole_roots_query_t* query);
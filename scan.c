@@ -0,0 +1,221 @@
+#include "scan.h"
+#include "mole_index.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+// Flips sign bit, so that unsigned numbers can be compared with signed instructions.
+#define SCAN_SIGN_BIT 0x8000000000000000ULL
+
+// Byte counters overflow after 255 blocks, so they are summed up at least that often.
+#define SCAN_FLUSH_BLOCKS 255
+
+static void scan_count_types_scalar(const uint8_t* file_types, size_t begin, size_t end, uint64_t* counts)
+{
+    for(size_t i = begin; i < end; ++i)
+        if(file_types[i] < FILE_TYPE_COUNT)
+            counts[file_types[i]]++;
+}
+
+static size_t scan_size_range_scalar(const uint64_t* sizes, size_t begin, size_t end,
+                                     uint64_t min_size, uint64_t max_size, uint64_t* ids)
+{
+    size_t count = 0;
+    for(size_t i = begin; i < end; ++i)
+        if(sizes[i] >= min_size && sizes[i] <= max_size)
+            ids[count++] = i;
+
+    return count;
+}
+
+static size_t scan_owner_scalar(const uint32_t* owner_uids, size_t begin, size_t end, uint32_t uid, uint64_t* ids)
+{
+    size_t count = 0;
+    for(size_t i = begin; i < end; ++i)
+        if(owner_uids[i] == uid)
+            ids[count++] = i;
+
+    return count;
+}
+
+#ifdef SCAN_X86
+
+// Stores ids of set bits of `mask`, where bit `j` stands for entry `base + j`.
+static inline size_t scan_store_mask(uint32_t mask, size_t base, uint64_t* ids)
+{
+    size_t count = 0;
+    while(mask)
+    {
+        ids[count++] = base + __builtin_ctz(mask);
+        mask &= mask - 1;
+    }
+
+    return count;
+}
+
+// Every block of types is compared with every type. Matches (-1) are subtracted from byte
+// counters, which are summed up by `psadbw` before they overflow.
+__attribute__((target("avx2")))
+static void scan_count_types_avx2(const uint8_t* file_types, size_t begin, size_t end, uint64_t* counts)
+{
+    size_t i = begin;
+    while(i + 32 <= end)
+    {
+        __m256i counters[FILE_TYPE_COUNT];
+        for(int type = 0; type < FILE_TYPE_COUNT; ++type)
+            counters[type] = _mm256_setzero_si256();
+
+        for(size_t block = 0; block < SCAN_FLUSH_BLOCKS && i + 32 <= end; ++block, i += 32)
+        {
+            __m256i values = _mm256_loadu_si256((const __m256i*) (file_types + i));
+            for(int type = 0; type < FILE_TYPE_COUNT; ++type)
+                counters[type] = _mm256_sub_epi8(counters[type], _mm256_cmpeq_epi8(values, _mm256_set1_epi8(type)));
+        }
+
+        for(int type = 0; type < FILE_TYPE_COUNT; ++type)
+        {
+            __m256i sums = _mm256_sad_epu8(counters[type], _mm256_setzero_si256());
+            counts[type] += _mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1)
+                          + _mm256_extract_epi64(sums, 2) + _mm256_extract_epi64(sums, 3);
+        }
+    }
+
+    scan_count_types_scalar(file_types, i, end, counts);
+}
+
+static void scan_count_types_sse2(const uint8_t* file_types, size_t begin, size_t end, uint64_t* counts)
+{
+    size_t i = begin;
+    while(i + 16 <= end)
+    {
+        __m128i counters[FILE_TYPE_COUNT];
+        for(int type = 0; type < FILE_TYPE_COUNT; ++type)
+            counters[type] = _mm_setzero_si128();
+
+        for(size_t block = 0; block < SCAN_FLUSH_BLOCKS && i + 16 <= end; ++block, i += 16)
+        {
+            __m128i values = _mm_loadu_si128((const __m128i*) (file_types + i));
+            for(int type = 0; type < FILE_TYPE_COUNT; ++type)
+                counters[type] = _mm_sub_epi8(counters[type], _mm_cmpeq_epi8(values, _mm_set1_epi8(type)));
+        }
+
+        for(int type = 0; type < FILE_TYPE_COUNT; ++type)
+        {
+            __m128i sums = _mm_sad_epu8(counters[type], _mm_setzero_si128());
+            counts[type] += _mm_cvtsi128_si64(sums) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(sums, sums));
+        }
+    }
+
+    scan_count_types_scalar(file_types, i, end, counts);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_size_range_avx2(const uint64_t* sizes, size_t begin, size_t end,
+                                   uint64_t min_size, uint64_t max_size, uint64_t* ids)
+{
+    const __m256i sign = _mm256_set1_epi64x(SCAN_SIGN_BIT);
+    const __m256i min = _mm256_set1_epi64x(min_size ^ SCAN_SIGN_BIT);
+    const __m256i max = _mm256_set1_epi64x(max_size ^ SCAN_SIGN_BIT);
+
+    size_t count = 0, i = begin;
+    for(; i + 4 <= end; i += 4)
+    {
+        __m256i values = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*) (sizes + i)), sign);
+        __m256i outside = _mm256_or_si256(_mm256_cmpgt_epi64(min, values), _mm256_cmpgt_epi64(values, max));
+        uint32_t mask = ~_mm256_movemask_pd(_mm256_castsi256_pd(outside)) & 0xF;
+        count += scan_store_mask(mask, i, ids + count);
+    }
+
+    return count + scan_size_range_scalar(sizes, i, end, min_size, max_size, ids + count);
+}
+
+__attribute__((target("sse4.2")))
+static size_t scan_size_range_sse42(const uint64_t* sizes, size_t begin, size_t end,
+                                    uint64_t min_size, uint64_t max_size, uint64_t* ids)
+{
+    const __m128i sign = _mm_set1_epi64x(SCAN_SIGN_BIT);
+    const __m128i min = _mm_set1_epi64x(min_size ^ SCAN_SIGN_BIT);
+    const __m128i max = _mm_set1_epi64x(max_size ^ SCAN_SIGN_BIT);
+
+    size_t count = 0, i = begin;
+    for(; i + 2 <= end; i += 2)
+    {
+        __m128i values = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (sizes + i)), sign);
+        __m128i outside = _mm_or_si128(_mm_cmpgt_epi64(min, values), _mm_cmpgt_epi64(values, max));
+        uint32_t mask = ~_mm_movemask_pd(_mm_castsi128_pd(outside)) & 0x3;
+        count += scan_store_mask(mask, i, ids + count);
+    }
+
+    return count + scan_size_range_scalar(sizes, i, end, min_size, max_size, ids + count);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_owner_avx2(const uint32_t* owner_uids, size_t begin, size_t end, uint32_t uid, uint64_t* ids)
+{
+    const __m256i needle = _mm256_set1_epi32(uid);
+
+    size_t count = 0, i = begin;
+    for(; i + 8 <= end; i += 8)
+    {
+        __m256i values = _mm256_loadu_si256((const __m256i*) (owner_uids + i));
+        uint32_t mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(values, needle)));
+        count += scan_store_mask(mask, i, ids + count);
+    }
+
+    return count + scan_owner_scalar(owner_uids, i, end, uid, ids + count);
+}
+
+static size_t scan_owner_sse2(const uint32_t* owner_uids, size_t begin, size_t end, uint32_t uid, uint64_t* ids)
+{
+    const __m128i needle = _mm_set1_epi32(uid);
+
+    size_t count = 0, i = begin;
+    for(; i + 4 <= end; i += 4)
+    {
+        __m128i values = _mm_loadu_si128((const __m128i*) (owner_uids + i));
+        uint32_t mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(values, needle)));
+        count += scan_store_mask(mask, i, ids + count);
+    }
+
+    return count + scan_owner_scalar(owner_uids, i, end, uid, ids + count);
+}
+
+#endif
+
+void scan_count_types(const uint8_t* file_types, size_t begin, size_t end, uint64_t* counts)
+{
+#ifdef SCAN_X86
+    if(__builtin_cpu_supports("avx2"))
+        scan_count_types_avx2(file_types, begin, end, counts);
+    else
+        scan_count_types_sse2(file_types, begin, end, counts);
+#else
+    scan_count_types_scalar(file_types, begin, end, counts);
+#endif
+}
+
+size_t scan_size_range(const uint64_t* sizes, size_t begin, size_t end,
+                       uint64_t min_size, uint64_t max_size, uint64_t* ids)
+{
+#ifdef SCAN_X86
+    if(__builtin_cpu_supports("avx2"))
+        return scan_size_range_avx2(sizes, begin, end, min_size, max_size, ids);
+    if(__builtin_cpu_supports("sse4.2"))
+        return scan_size_range_sse42(sizes, begin, end, min_size, max_size, ids);
+#endif
+    return scan_size_range_scalar(sizes, begin, end, min_size, max_size, ids);
+}
+
+size_t scan_owner(const uint32_t* owner_uids, size_t begin, size_t end, uint32_t uid, uint64_t* ids)
+{
+#ifdef SCAN_X86
+    if(__builtin_cpu_supports("avx2"))
+        return scan_owner_avx2(owner_uids, begin, end, uid, ids);
+    else
+        return scan_owner_sse2(owner_uids, begin, end, uid, ids);
+#else
+    return scan_owner_scalar(owner_uids, begin, end, uid, ids);
+#endif
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "common.h"
+
+#include <stdint.h>
+
+// Kernels scanning single column of the index (see `mole_index_t`). They are used by
+// queries that have to check every entry (or entries not covered by auxiliary structures).
+// Columns are processed 16 or 32 bytes at a time using SSE or AVX2 instructions,
+// depending on what the processor supports. Other architectures use scalar loops.
+
+// Adds number of entries of every type among entries [`begin`, `end`) to `counts`
+// (array of FILE_TYPE_COUNT elements).
+void scan_count_types(const uint8_t* file_types, size_t begin, size_t end, uint64_t* counts);
+
+// Stores ids of entries [`begin`, `end`) with size in range [`min_size`, `max_size`] in `ids`
+// (which has to hold `end - begin` elements). Returns number of found entries.
+size_t scan_size_range(const uint64_t* sizes, size_t begin, size_t end,
+                       uint64_t min_size, uint64_t max_size, uint64_t* ids);
+
+// Stores ids of entries [`begin`, `end`) owned by user `uid` in `ids`
+// (which has to hold `end - begin` elements). Returns number of found entries.
+size_t scan_owner(const uint32_t* owner_uids, size_t begin, size_t end, uint32_t uid, uint64_t* ids);
@@ -0,0 +1,263 @@
+#include "server.h"
+#include "indexer.h"
+#include "stats.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+// Response being sent to a client. It is sent when buffer is full and when it is complete.
+typedef struct server_writer
+{
+    int fd;                             // Client's socket
+    bool failed;                        // Flag telling that client can't be written to anymore
+    size_t used;                        // Number of bytes in the buffer
+    char buffer[SERVER_BUFFER_SIZE];    // Part of response not sent yet
+} server_writer_t;
+
+static void server_flush(server_writer_t* writer)
+{
+    size_t total = 0;
+    while(!writer->failed && total < writer->used)
+    {
+        // Client might have disconnected, which must not kill the server with SIGPIPE.
+        ssize_t result = TEMP_FAILURE_RETRY(send(writer->fd, writer->buffer + total, writer->used - total, MSG_NOSIGNAL));
+        if(result < 0) writer->failed = true;
+        else total += result;
+    }
+
+    writer->used = 0;
+}
+
+static void server_write(server_writer_t* writer, const void* data, size_t length)
+{
+    while(length > 0 && !writer->failed)
+    {
+        if(writer->used == SERVER_BUFFER_SIZE) server_flush(writer);
+
+        size_t part = SERVER_BUFFER_SIZE - writer->used < length ? SERVER_BUFFER_SIZE - writer->used : length;
+        memcpy(writer->buffer + writer->used, data, part);
+        writer->used += part;
+        data = (const char*) data + part;
+        length -= part;
+    }
+}
+
+static void server_write_response(server_writer_t* writer, protocol_status_t status, uint64_t count)
+{
+    protocol_response_t response = { .magic = PROTOCOL_MAGIC, .status = status, .count = count };
+    server_write(writer, &response, sizeof(response));
+}
+
+// Sends entries found by `query`, only those on the page requested by `request`.
+static void server_write_entries(server_writer_t* writer, mole_roots_query_t* query, const protocol_request_t* request)
+{
+    server_write_response(writer, Status_Ok, 0);
+
+    const mole_index_t* index;
+    uint64_t id;
+    for(uint64_t i = 0; i < request->offset && roots_query_next(query, &index, &id); ++i);
+
+    mole_path_builder_t paths;
+    path_builder_init(&paths);
+    for(uint64_t sent = 0; sent < request->limit && !writer->failed && roots_query_next(query, &index, &id); ++sent)
+    {
+        const mole_index_entry_t* element = &index->elements[id];
+        protocol_entry_t entry = { .size = index->sizes[id], .path_length = element->path_length,
+                                   .file_type = index->file_types[id], .last = 0, .reserved = 0 };
+        server_write(writer, &entry, sizeof(entry));
+        size_t path_length;
+        const char* path = path_builder_path(&paths, index, element, &path_length);
+        server_write(writer, path, path_length);
+    }
+
+    protocol_entry_t last = { .size = 0, .path_length = 0, .file_type = Unrecognized, .last = 1, .reserved = 0 };
+    server_write(writer, &last, sizeof(last));
+}
+
+static void server_handle(server_t* server, server_writer_t* writer, const protocol_request_t* request,
+                          const char* string, const char* scope_path)
+{
+    mole_roots_t* roots = server->roots;
+    uint64_t start = stats_now();
+
+    if(request->command == Command_Index)
+    {
+        // Indexing is reported as pending only if it is pending in every root.
+        bool pending = true;
+        for(size_t i = 0; i < roots->count; ++i)
+        {
+            mole_context_t* context = &roots->contexts[i];
+            pthread_mutex_lock(context->indexing_mutex);
+            bool root_pending = context->indexing_pending;
+            pthread_mutex_unlock(context->indexing_mutex);
+
+            if(!root_pending) indexer_start_worker(context);
+            pending = pending && root_pending;
+        }
+
+        server_write_response(writer, pending ? Status_Indexing_Pending : Status_Ok, 0);
+        return;
+    }
+
+    mole_roots_query_t query;
+    if(!roots_query_begin(&query, roots, request->scope_length == 0 ? NULL : scope_path))
+    {
+        server_write_response(writer, Status_Scope_Not_Found, 0);
+        return;
+    }
+
+    switch(request->command)
+    {
+        case Command_Count:
+        {
+            uint64_t counts[FILE_TYPE_COUNT] = {0};
+            roots_query_count_types(&query, counts);
+            server_write_response(writer, Status_Ok, FILE_TYPE_COUNT);
+            server_write(writer, counts, sizeof(counts));
+            stats_record(Stat_Count_Time, start);
+            break;
+        }
+        case Command_Size_Range:
+            roots_query_size_range(&query, request->arguments[0], request->arguments[1]);
+            server_write_entries(writer, &query, request);
+            stats_record(Stat_Between_Time, start);
+            break;
+        case Command_Name_Part:
+            roots_query_name_part(&query, string);
+            server_write_entries(writer, &query, request);
+            stats_record(Stat_Namepart_Time, start);
+            break;
+        case Command_Owner:
+            roots_query_owner(&query, request->arguments[0]);
+            server_write_entries(writer, &query, request);
+            stats_record(Stat_Owner_Time, start);
+            break;
+    }
+    roots_query_end(&query);
+}
+
+// Waits until `fd` is readable. Returns false if server is stopping instead.
+static bool server_wait(server_t* server, int fd)
+{
+    struct pollfd fds[2] = { { .fd = fd, .events = POLLIN }, { .fd = server->stop_pipe[0], .events = POLLIN } };
+    while(poll(fds, 2, -1) < 0)
+        if(errno != EINTR) ERROR("poll");
+
+    return !(fds[1].revents & POLLIN);
+}
+
+// Serves requests of a single client, until it disconnects or sends malformed request.
+static void server_serve(server_t* server, server_writer_t* writer, int fd)
+{
+    writer->fd = fd;
+    writer->failed = false;
+    writer->used = 0;
+
+    while(!writer->failed && server_wait(server, fd))
+    {
+        protocol_request_t request;
+        if(bulk_read(fd, &request, sizeof(request)) != (ssize_t) sizeof(request)) return;
+
+        char string[PROTOCOL_STRING_MAX + 1];
+        char scope[PROTOCOL_SCOPE_MAX + 1];
+        bool valid = request.magic == PROTOCOL_MAGIC && request.command >= Command_Count
+                  && request.command <= Command_Index && request.string_length <= PROTOCOL_STRING_MAX
+                  && request.scope_length <= PROTOCOL_SCOPE_MAX
+                  && (request.command != Command_Name_Part || request.string_length > 0);
+        if(valid && bulk_read(fd, string, request.string_length) != (ssize_t) request.string_length) return;
+        if(valid && bulk_read(fd, scope, request.scope_length) != (ssize_t) request.scope_length) return;
+        string[valid ? request.string_length : 0] = '\0';
+        scope[valid ? request.scope_length : 0] = '\0';
+
+        if(valid)
+            server_handle(server, writer, &request, string, scope);
+        else
+            server_write_response(writer, Status_Invalid_Request, 0);
+        server_flush(writer);
+
+        if(!valid) return;
+    }
+}
+
+static void* server_worker(void* args)
+{
+    server_t* server = (server_t*) args;
+
+    server_writer_t* writer = malloc(sizeof(server_writer_t));
+    if(NULL == writer) ERROR("malloc");
+
+    while(server_wait(server, server->listen_fd))
+    {
+        // Other worker might have taken the connection first.
+        int fd = accept4(server->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if(fd < 0)
+        {
+            if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ECONNABORTED) continue;
+            ERROR("accept4");
+        }
+
+        // Client that stops reading or stalls in the middle of a request must not hold the worker forever.
+        struct timeval timeout = { .tv_sec = SERVER_TIMEOUT_S, .tv_usec = 0 };
+        if(setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout))) ERROR("setsockopt");
+        if(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout))) ERROR("setsockopt");
+
+        server_serve(server, writer, fd);
+        if(close(fd)) ERROR("close");
+    }
+
+    free(writer);
+    return NULL;
+}
+
+void server_start(server_t* server, mole_roots_t* roots, char* path)
+{
+    server->roots = roots;
+    server->path = path;
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "Socket path `%s` is too long.\n", path);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(address.sun_path, path);
+
+    // Socket left behind by server that didn't exit cleanly is replaced.
+    struct stat path_stat;
+    if(lstat(path, &path_stat) == 0)
+    {
+        if(!S_ISSOCK(path_stat.st_mode))
+        {
+            fprintf(stderr, "File `%s` exists and is not a socket.\n", path);
+            exit(EXIT_FAILURE);
+        }
+        if(unlink(path)) ERROR("unlink");
+    }
+
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(server->listen_fd < 0) ERROR("socket");
+    if(bind(server->listen_fd, (struct sockaddr*) &address, sizeof(address))) ERROR("bind");
+    if(listen(server->listen_fd, SERVER_BACKLOG)) ERROR("listen");
+    if(pipe2(server->stop_pipe, O_CLOEXEC)) ERROR("pipe2");
+
+    for(int i = 0; i < SERVER_WORKERS; ++i)
+        if(pthread_create(&server->tids[i], NULL, server_worker, server)) ERROR("pthread_create");
+}
+
+void server_stop(server_t* server)
+{
+    // Pipe is never drained, so every worker sees it readable.
+    if(write(server->stop_pipe[1], "", 1) < 0) ERROR("write");
+    for(int i = 0; i < SERVER_WORKERS; ++i)
+        if(pthread_join(server->tids[i], NULL)) ERROR("pthread_join");
+
+    close(server->listen_fd);
+    close(server->stop_pipe[0]);
+    close(server->stop_pipe[1]);
+    if(unlink(server->path) && errno != ENOENT) ERROR("unlink");
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "common.h"
+#include "protocol.h"
+#include "roots.h"
+
+#include <pthread.h>
+
+#define SERVER_WORKERS 8
+#define SERVER_BACKLOG 64
+#define SERVER_BUFFER_SIZE (1 << 16)
+#define SERVER_TIMEOUT_S 10
+
+// Answers queries sent by clients (see protocol.h and client.c) over a Unix domain socket,
+// so that many clients can share a single index instead of loading their own.
+//
+// Every worker of the pool waits for a connection, then serves requests of that client
+// until it disconnects. Queries use current snapshots of roots, just like commands typed into
+// the command line interface, so they run concurrently with each other and with indexing.
+typedef struct server
+{
+    mole_roots_t* roots;                // Indexed roots
+    char* path;                         // Path of the socket
+    int listen_fd;                      // Listening socket (non-blocking)
+    int stop_pipe[2];                   // Pipe used to wake workers up when they should stop
+    pthread_t tids[SERVER_WORKERS];     // Ids of worker threads
+} server_t;
+
+// Creates socket `path` (replacing stale one) and starts worker threads.
+void server_start(server_t* server, mole_roots_t* roots, char* path);
+
+// Stops worker threads (after they finish current requests) and removes the socket.
+void server_stop(server_t* server);
@@ -0,0 +1,79 @@
+#include "signature.h"
+
+#include <pthread.h>
+
+typedef struct mole_signature
+{
+    file_type_t type;           // Type of matching files
+    uint16_t offset;            // Offset of the first part
+    uint16_t length;            // Length of the first part
+    const char* bytes;          // First part
+    uint16_t second_offset;     // Offset of the second part
+    uint16_t second_length;     // Length of the second part (0 if there is none)
+    const char* second_bytes;   // Second part
+} mole_signature_t;
+
+static const mole_signature_t signatures[] =
+{
+#define X(type, offset, bytes, second_offset, second_bytes) \
+    { type, offset, sizeof(bytes) - 1, bytes, second_offset, sizeof(second_bytes) - 1, second_bytes },
+    MOLE_SIGNATURES(X)
+#undef X
+};
+
+#define SIGNATURE_COUNT (sizeof(signatures) / sizeof(signatures[0]))
+
+// Signatures starting at offset 0, grouped by their first byte: signatures starting with
+// byte `b` are `order[starts[b]]`, ..., `order[starts[b + 1] - 1]`. Other signatures are
+// `order[starts[256]]`, ... Groups keep the order signatures are listed in.
+static uint16_t starts[257 + 1];
+static uint16_t order[SIGNATURE_COUNT];
+static pthread_once_t table_once = PTHREAD_ONCE_INIT;
+
+static int signature_group(const mole_signature_t* signature)
+{
+    return signature->offset == 0 ? (unsigned char) signature->bytes[0] : 256;
+}
+
+static void signature_build_table()
+{
+    for(size_t i = 0; i < SIGNATURE_COUNT; ++i)
+        starts[signature_group(&signatures[i]) + 1]++;
+    for(int group = 0; group < 257; ++group)
+        starts[group + 1] += starts[group];
+
+    uint16_t positions[257];
+    memcpy(positions, starts, sizeof(positions));
+    for(size_t i = 0; i < SIGNATURE_COUNT; ++i)
+        order[positions[signature_group(&signatures[i])]++] = i;
+}
+
+static bool signature_matches(const mole_signature_t* signature, const unsigned char* header, size_t length)
+{
+    return signature->offset + signature->length <= length
+        && memcmp(header + signature->offset, signature->bytes, signature->length) == 0
+        && signature->second_offset + signature->second_length <= length
+        && memcmp(header + signature->second_offset, signature->second_bytes, signature->second_length) == 0;
+}
+
+// Returns type of the first matching signature of `group` (or Unrecognized).
+static file_type_t signature_match_group(int group, const unsigned char* header, size_t length)
+{
+    for(uint16_t i = starts[group]; i < starts[group + 1]; ++i)
+        if(signature_matches(&signatures[order[i]], header, length))
+            return signatures[order[i]].type;
+
+    return Unrecognized;
+}
+
+file_type_t signature_match(const unsigned char* header, size_t length)
+{
+    pthread_once(&table_once, signature_build_table);
+    if(length == 0) return Unrecognized;
+
+    file_type_t type = signature_match_group(256, header, length);
+    if(type == Unrecognized)
+        type = signature_match_group(header[0], header, length);
+
+    return type;
+}
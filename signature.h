@@ -0,0 +1,60 @@
+#pragma once
+
+#include "common.h"
+#include "mole_index.h"
+
+#include <stdint.h>
+
+// Number of bytes read from the beginning of every file to determine its type.
+// Signatures that don't fit into the window are never matched.
+#ifndef MOLE_HEADER_WINDOW
+#define MOLE_HEADER_WINDOW 512
+#endif
+
+// Signatures of recognized file types: X(type, offset, bytes, second_offset, second_bytes).
+// File matches if it contains `bytes` at `offset` and `second_bytes` at `second_offset`
+// (empty string if there is no second part). Signatures starting further in the file are
+// checked first: they are long or far from the beginning (like `ustar` of TAR), while some
+// of those at offset 0 are only 2-3 bytes, that can also begin e.g. name of TAR's first member.
+// Otherwise signatures are checked in the order they are listed here, so more specific ones
+// (like formats based on ZIP) have to come first.
+#define MOLE_SIGNATURES(X) \
+    X(Image_JPEG,        0,   "\xFF\xD8\xFF",                0,  "") \
+    X(Image_PNG,         0,   "\x89PNG\r\n\x1A\n",           0,  "") \
+    X(Image_GIF,         0,   "GIF87a",                      0,  "") \
+    X(Image_GIF,         0,   "GIF89a",                      0,  "") \
+    X(Image_WEBP,        0,   "RIFF",                        8,  "WEBP") \
+    X(Image_BMP,         0,   "BM",                          6,  "\0\0\0\0") \
+    X(Image_TIFF,        0,   "II*\0",                       0,  "") \
+    X(Image_TIFF,        0,   "MM\0*",                       0,  "") \
+    X(Document_PDF,      0,   "%PDF-",                       0,  "") \
+    X(Document_OOXML,    0,   "PK\x03\x04",                  30, "[Content_Types].xml") \
+    X(Document_OOXML,    0,   "PK\x03\x04",                  30, "_rels/.rels") \
+    X(Document_ODF,      0,   "PK\x03\x04",                  30, "mimetypeapplication/vnd.oasis.opendocument.") \
+    X(Document_EPUB,     0,   "PK\x03\x04",                  30, "mimetypeapplication/epub+zip") \
+    X(Archive_JAR,       0,   "PK\x03\x04",                  30, "META-INF/") \
+    X(Compressed_ZIP,    0,   "PK\x03\x04",                  0,  "") \
+    X(Compressed_ZIP,    0,   "PK\x05\x06",                  0,  "") \
+    X(Compressed_ZIP,    0,   "PK\x07\x08",                  0,  "") \
+    X(Compressed_GZIP,   0,   "\x1F\x8B",                    0,  "") \
+    X(Compressed_ZSTD,   0,   "\x28\xB5\x2F\xFD",            0,  "") \
+    X(Compressed_XZ,     0,   "\xFD" "7zXZ\0",               0,  "") \
+    X(Compressed_BZIP2,  0,   "BZh",                         0,  "") \
+    X(Archive_7Z,        0,   "7z\xBC\xAF\x27\x1C",          0,  "") \
+    X(Archive_RAR,       0,   "Rar!\x1A\x07",                0,  "") \
+    X(Archive_TAR,       257, "ustar",                       0,  "") \
+    X(Executable_ELF,    0,   "\x7F" "ELF",                  0,  "") \
+    X(Audio_MP3,         0,   "ID3",                         0,  "") \
+    X(Audio_FLAC,        0,   "fLaC",                        0,  "") \
+    X(Audio_OGG,         0,   "OggS",                        0,  "") \
+    X(Audio_WAV,         0,   "RIFF",                        8,  "WAVE") \
+    X(Video_AVI,         0,   "RIFF",                        8,  "AVI ") \
+    X(Video_MP4,         4,   "ftyp",                        0,  "") \
+    X(Database_SQLITE,   0,   "SQLite format 3\0",           0,  "")
+
+// Returns type of file beginning with `length` bytes of `header`.
+//
+// Signatures starting at offset 0 are grouped by their first byte, so only the few
+// starting further in the file (and the few sharing the file's first byte) are
+// compared, no matter how many signatures there are.
+file_type_t signature_match(const unsigned char* header, size_t length);
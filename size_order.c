@@ -0,0 +1,103 @@
+#include "size_order.h"
+#include "mole_index.h"
+
+static int size_order_compare(const void* a, const void* b, void* args)
+{
+    const mole_index_t* index = (const mole_index_t*) args;
+    uint32_t x = *(const uint32_t*) a, y = *(const uint32_t*) b;
+    uint64_t x_size = index->sizes[x], y_size = index->sizes[y];
+    if(x_size != y_size) return (x_size > y_size) - (x_size < y_size);
+    return (x > y) - (x < y);
+}
+
+void size_order_init(mole_size_order_t* order)
+{
+    order->indexed = 0;
+    order->ids = NULL;
+    order->owned = true;
+}
+
+void size_order_free(mole_size_order_t* order)
+{
+    if(order->owned) free(order->ids);
+
+    size_order_init(order);
+}
+
+void size_order_build(mole_size_order_t* order, const mole_index_t* index)
+{
+    size_order_free(order);
+    if(index->size > UINT32_MAX) return;
+
+    uint32_t* ids = malloc((index->size + 1) * sizeof(uint32_t));
+    if(NULL == ids) ERROR("malloc");
+    for(size_t i = 0; i < index->size; ++i)
+        ids[i] = i;
+
+    qsort_r(ids, index->size, sizeof(uint32_t), size_order_compare, (void*) index);
+
+    order->indexed = index->size;
+    order->ids = ids;
+    order->owned = true;
+}
+
+void size_order_detach(mole_size_order_t* order)
+{
+    if(order->owned) return;
+
+    uint32_t* ids = malloc((order->indexed + 1) * sizeof(uint32_t));
+    if(NULL == ids) ERROR("malloc");
+    memcpy(ids, order->ids, order->indexed * sizeof(uint32_t));
+
+    order->ids = ids;
+    order->owned = true;
+}
+
+size_t size_order_lower_bound(const mole_size_order_t* order, const mole_index_t* index, uint64_t size)
+{
+    size_t low = 0, high = order->indexed;
+    while(low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if(index->sizes[order->ids[middle]] < size) low = middle + 1;
+        else high = middle;
+    }
+
+    return low;
+}
+
+void size_order_update(mole_size_order_t* order, const mole_index_t* index, uint64_t id, uint64_t new_size)
+{
+    if(id >= order->indexed) return;
+
+    uint64_t old_size = index->sizes[id];
+    if(old_size == new_size) return;
+
+    size_t position = size_order_lower_bound(order, index, old_size);
+    while(position < order->indexed && order->ids[position] != id)
+        position++;
+    if(position == order->indexed) return;
+
+    // Entries between old and new position are shifted by one place.
+    if(new_size > old_size)
+    {
+        size_t target = position;
+        while(target + 1 < order->indexed && index->sizes[order->ids[target + 1]] < new_size)
+            target++;
+        while(target + 1 < order->indexed && index->sizes[order->ids[target + 1]] == new_size
+              && order->ids[target + 1] < id)
+            target++;
+        memmove(order->ids + position, order->ids + position + 1, (target - position) * sizeof(uint32_t));
+        order->ids[target] = id;
+    }
+    else
+    {
+        size_t target = position;
+        while(target > 0 && index->sizes[order->ids[target - 1]] > new_size)
+            target--;
+        while(target > 0 && index->sizes[order->ids[target - 1]] == new_size && order->ids[target - 1] > id)
+            target--;
+        memmove(order->ids + target + 1, order->ids + target, (position - target) * sizeof(uint32_t));
+        order->ids[target] = id;
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "common.h"
+
+#include <stdint.h>
+
+// Permutation of entry ids, sorted by size of entries (ties are sorted by id).
+// Entries with size in some range occupy a contiguous part of it, that is found
+// by binary search. This way `largerthan` doesn't have to check every entry.
+//
+// Order covers entries [0, `indexed`). Entries added later (by watcher) are not
+// covered and have to be checked one by one, until the order is built again.
+typedef struct mole_size_order
+{
+    size_t indexed;     // Number of entries covered by the order
+    uint32_t* ids;      // Ids of entries sorted by size (`indexed` elements)
+    bool owned;         // Flag telling whether array was allocated (or is mapped)
+} mole_size_order_t;
+
+// Initializes empty order, that covers no entries.
+void size_order_init(mole_size_order_t* order);
+
+// Frees memory used by the order.
+void size_order_free(mole_size_order_t* order);
+
+// Sorts all entries of the index by size.
+void size_order_build(mole_size_order_t* order, const mole_index_t* index);
+
+// Copies mapped array into order's own memory.
+void size_order_detach(mole_size_order_t* order);
+
+// Returns first position in the order, where entry's size is not smaller than `size`.
+size_t size_order_lower_bound(const mole_size_order_t* order, const mole_index_t* index, uint64_t size);
+
+// Moves entry `id` to its new position, as its size is about to change to `new_size`.
+// Has to be called before size of the entry is modified.
+void size_order_update(mole_size_order_t* order, const mole_index_t* index, uint64_t id, uint64_t new_size);
@@ -0,0 +1,66 @@
+#include <sched.h>
+
+#include "snapshot.h"
+
+// Moves `index` into a new snapshot with a single reference.
+static mole_snapshot_t* snapshot_new(mole_index_t* index, size_t generation)
+{
+    mole_snapshot_t* snapshot = malloc(sizeof(mole_snapshot_t));
+    if(NULL == snapshot) ERROR("malloc");
+
+    snapshot->index = *index;
+    snapshot->generation = generation;
+    atomic_init(&snapshot->references, 1);
+
+    return snapshot;
+}
+
+void snapshot_init(mole_context_t* context, mole_index_t* index)
+{
+    atomic_init(&context->snapshot, snapshot_new(index, 0));
+    atomic_init(&context->snapshot_readers, 0);
+}
+
+mole_snapshot_t* snapshot_acquire(mole_context_t* context)
+{
+    // Publisher doesn't drop its reference to replaced snapshot until there are no readers
+    // in between these lines, so snapshot can't be freed before it is pinned.
+    atomic_fetch_add(&context->snapshot_readers, 1);
+    mole_snapshot_t* snapshot = atomic_load(&context->snapshot);
+    atomic_fetch_add(&snapshot->references, 1);
+    atomic_fetch_sub(&context->snapshot_readers, 1);
+
+    return snapshot;
+}
+
+void snapshot_release(mole_snapshot_t* snapshot)
+{
+    if(atomic_fetch_sub(&snapshot->references, 1) > 1) return;
+
+    index_free(&snapshot->index);
+    free(snapshot);
+}
+
+mole_snapshot_t* snapshot_publish(mole_context_t* context, mole_index_t* index, bool renumbered)
+{
+    pthread_mutex_lock(context->publish_mutex);
+    mole_snapshot_t* old = atomic_load(&context->snapshot);
+    mole_snapshot_t* snapshot = snapshot_new(index, old->generation + (renumbered ? 1 : 0));
+    atomic_fetch_add(&snapshot->references, 1);
+    atomic_store(&context->snapshot, snapshot);
+    pthread_mutex_unlock(context->publish_mutex);
+
+    // Readers, that loaded pointer to old snapshot, are about to pin it. The window is
+    // a few instructions long, so waiting for it to close is cheap.
+    while(atomic_load(&context->snapshot_readers) > 0)
+        sched_yield();
+    snapshot_release(old);
+
+    return snapshot;
+}
+
+void snapshot_destroy(mole_context_t* context)
+{
+    snapshot_release(atomic_load(&context->snapshot));
+    atomic_store(&context->snapshot, NULL);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "common.h"
+#include "mole_index.h"
+
+// Published version of the index. Snapshot is never modified after it is published:
+// indexer and watcher build new index on the side and publish it as a new snapshot.
+//
+// Queries pin current snapshot without taking any lock (see `snapshot_acquire()`), so they
+// are never blocked by indexing, saving the cache or by each other. Old snapshot is freed
+// by whoever releases the last reference to it, usually the last query that was using it.
+typedef struct mole_snapshot
+{
+    mole_index_t index;         // Contents of the snapshot
+    size_t generation;          // Number incremented every time ids of entries change
+    atomic_size_t references;   // Number of holders (including context, while it is current)
+} mole_snapshot_t;
+
+// Creates first snapshot of the program, taking ownership of `index`.
+void snapshot_init(mole_context_t* context, mole_index_t* index);
+
+// Pins current snapshot. It stays valid until `snapshot_release()` is called.
+mole_snapshot_t* snapshot_acquire(mole_context_t* context);
+
+// Drops reference to the snapshot, freeing it if it was the last one.
+void snapshot_release(mole_snapshot_t* snapshot);
+
+// Replaces current snapshot with a new one, taking ownership of `index`. `renumbered`
+// tells whether ids of entries changed (so that tables built for old ids are rebuilt).
+// Returns pinned new snapshot, so that it can be saved after publishing.
+mole_snapshot_t* snapshot_publish(mole_context_t* context, mole_index_t* index, bool renumbered);
+
+// Releases current snapshot of the program. Has to be called after all threads finished.
+void snapshot_destroy(mole_context_t* context);
@@ -0,0 +1,203 @@
+#include "spill.h"
+#include "stats.h"
+
+static int spill_compare(const void* a, const void* b)
+{
+    const spill_record_t* x = (const spill_record_t*) a;
+    const spill_record_t* y = (const spill_record_t*) b;
+    if(x->key != y->key) return (x->key > y->key) - (x->key < y->key);
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+void spill_init(mole_spill_t* spill, size_t memory_limit, const char* path)
+{
+    spill->capacity = memory_limit / sizeof(spill_record_t);
+    if(spill->capacity < SPILL_RECORDS_MIN) spill->capacity = SPILL_RECORDS_MIN;
+    spill->count = 0;
+    spill->position = 0;
+    spill->buffer = malloc(spill->capacity * sizeof(spill_record_t));
+    if(NULL == spill->buffer) ERROR("malloc");
+    spill->path = path;
+    spill->run_count = 0;
+    spill->heap_size = 0;
+}
+
+void spill_free(mole_spill_t* spill)
+{
+    for(size_t i = 0; i < spill->run_count; ++i)
+        if(close(spill->runs[i].fd)) ERROR("close");
+
+    free(spill->buffer);
+    spill->buffer = NULL;
+    spill->capacity = 0;
+    spill->count = 0;
+    spill->run_count = 0;
+    spill->heap_size = 0;
+}
+
+// Creates temporary file for a run. It is unlinked right away, so it disappears
+// when it is closed, even if the program is killed.
+static int spill_create_file(const mole_spill_t* spill)
+{
+    char path[PATH_MAX];
+    if(snprintf(path, PATH_MAX, "%s.runXXXXXX", spill->path) >= PATH_MAX) ERROR("snprintf");
+
+    int fd = mkstemp(path);
+    if(fd < 0) ERROR("mkstemp");
+    if(unlink(path)) ERROR("unlink");
+
+    return fd;
+}
+
+// Rewinds file of a run written so far, so that it is read from the beginning.
+static void spill_add_run(mole_spill_t* spill, int fd, uint64_t count)
+{
+    if(lseek(fd, 0, SEEK_SET) < 0) ERROR("lseek");
+
+    spill_run_t* run = &spill->runs[spill->run_count++];
+    run->fd = fd;
+    run->remaining = count;
+    run->block = NULL;
+    run->block_capacity = 0;
+    run->count = 0;
+    run->position = 0;
+}
+
+// Reads next block of the run, if the current one was used up. Returns false if there are no more records.
+static bool spill_run_fill(spill_run_t* run)
+{
+    if(run->position < run->count) return true;
+    if(run->remaining == 0) return false;
+
+    size_t count = run->remaining < run->block_capacity ? run->remaining : run->block_capacity;
+    if(bulk_read(run->fd, run->block, count * sizeof(spill_record_t)) != (ssize_t) (count * sizeof(spill_record_t)))
+        ERROR("read");
+
+    run->remaining -= count;
+    run->count = count;
+    run->position = 0;
+    return true;
+}
+
+static bool spill_run_below(const mole_spill_t* spill, size_t a, size_t b)
+{
+    const spill_run_t* x = &spill->runs[a];
+    const spill_run_t* y = &spill->runs[b];
+    return spill_compare(&x->block[x->position], &y->block[y->position]) < 0;
+}
+
+// Moves run at position `i` down the heap.
+static void spill_sift_down(mole_spill_t* spill, size_t i)
+{
+    for(;;)
+    {
+        size_t smallest = i, left = 2 * i + 1, right = 2 * i + 2;
+        if(left < spill->heap_size && spill_run_below(spill, spill->heap[left], spill->heap[smallest])) smallest = left;
+        if(right < spill->heap_size && spill_run_below(spill, spill->heap[right], spill->heap[smallest])) smallest = right;
+        if(smallest == i) return;
+
+        size_t swapped = spill->heap[i];
+        spill->heap[i] = spill->heap[smallest];
+        spill->heap[smallest] = swapped;
+        i = smallest;
+    }
+}
+
+// Gives every run a block of `block_capacity` records of the buffer and orders runs in the heap.
+static void spill_merge_start(mole_spill_t* spill, size_t block_capacity)
+{
+    spill->heap_size = 0;
+    for(size_t i = 0; i < spill->run_count; ++i)
+    {
+        spill_run_t* run = &spill->runs[i];
+        run->block = spill->buffer + i * block_capacity;
+        run->block_capacity = block_capacity;
+        if(spill_run_fill(run)) spill->heap[spill->heap_size++] = i;
+    }
+
+    for(size_t i = spill->heap_size / 2; i-- > 0;)
+        spill_sift_down(spill, i);
+}
+
+static bool spill_merge_next(mole_spill_t* spill, spill_record_t* record)
+{
+    if(spill->heap_size == 0) return false;
+
+    spill_run_t* run = &spill->runs[spill->heap[0]];
+    *record = run->block[run->position++];
+    if(!spill_run_fill(run)) spill->heap[0] = spill->heap[--spill->heap_size];
+    spill_sift_down(spill, 0);
+
+    return true;
+}
+
+// Merges all runs into a single one. The last block of the buffer collects merged records.
+static void spill_compact(mole_spill_t* spill)
+{
+    size_t block_capacity = spill->capacity / (spill->run_count + 1);
+    spill_record_t* output = spill->buffer + spill->run_count * block_capacity;
+    spill_merge_start(spill, block_capacity);
+
+    int fd = spill_create_file(spill);
+    uint64_t total = 0;
+    size_t used = 0;
+    spill_record_t record;
+    while(spill_merge_next(spill, &record))
+    {
+        output[used++] = record;
+        if(used == block_capacity || spill->heap_size == 0)
+        {
+            if(bulk_write(fd, output, used * sizeof(spill_record_t)) < 0) ERROR("write");
+            total += used;
+            used = 0;
+        }
+    }
+
+    for(size_t i = 0; i < spill->run_count; ++i)
+        if(close(spill->runs[i].fd)) ERROR("close");
+    spill->run_count = 0;
+    spill_add_run(spill, fd, total);
+}
+
+// Sorts the buffer and writes it as a new run.
+static void spill_write_buffer(mole_spill_t* spill)
+{
+    qsort(spill->buffer, spill->count, sizeof(spill_record_t), spill_compare);
+
+    int fd = spill_create_file(spill);
+    if(bulk_write(fd, spill->buffer, spill->count * sizeof(spill_record_t)) < 0) ERROR("write");
+    stats_add(Stat_Records_Spilled, spill->count);
+    spill_add_run(spill, fd, spill->count);
+    spill->count = 0;
+
+    if(spill->run_count == SPILL_RUNS_MAX) spill_compact(spill);
+}
+
+void spill_add(mole_spill_t* spill, uint64_t key, uint64_t id)
+{
+    if(spill->count == spill->capacity) spill_write_buffer(spill);
+
+    spill->buffer[spill->count++] = (spill_record_t) { .key = key, .id = id };
+}
+
+void spill_finish(mole_spill_t* spill)
+{
+    if(spill->run_count == 0)
+    {
+        qsort(spill->buffer, spill->count, sizeof(spill_record_t), spill_compare);
+        spill->position = 0;
+        return;
+    }
+
+    if(spill->count > 0) spill_write_buffer(spill);
+    spill_merge_start(spill, spill->capacity / spill->run_count);
+}
+
+bool spill_next(mole_spill_t* spill, spill_record_t* record)
+{
+    if(spill->run_count > 0) return spill_merge_next(spill, record);
+
+    if(spill->position == spill->count) return false;
+    *record = spill->buffer[spill->position++];
+    return true;
+}
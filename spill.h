@@ -0,0 +1,64 @@
+#pragma once
+
+#include "common.h"
+
+#include <stdint.h>
+
+#define SPILL_RUNS_MAX 64
+#define SPILL_RECORDS_MIN (1 << 12)
+
+// Record sorted by `mole_spill_t`: entry `id` with sort `key` (e.g. trigram of its name).
+// Records are ordered by key, records with equal keys by id.
+typedef struct spill_record
+{
+    uint64_t key;               // Sort key
+    uint64_t id;                // Id of entry the record belongs to
+} spill_record_t;
+
+// Sorted part of records written into temporary file, read back in blocks while merging.
+typedef struct spill_run
+{
+    int fd;                     // Temporary file (already unlinked)
+    uint64_t remaining;         // Number of records in the file that weren't read yet
+    spill_record_t* block;      // Records read from the file (part of spill's buffer)
+    size_t block_capacity;      // Number of records that fit into the block
+    size_t count;               // Number of records in the block
+    size_t position;            // Next record of the block
+} spill_run_t;
+
+// External sort of records, that may not fit into memory. Records are gathered in a buffer
+// of a fixed size. When it fills up, it is sorted and written into temporary file as a run.
+// Once all records are added, runs are merged: the smallest record among heads of all runs
+// is taken from a heap. Buffer is then divided between runs, so memory used never exceeds it.
+//
+// If all records fit into the buffer, nothing is written and they are sorted in place.
+// If there would be more than SPILL_RUNS_MAX runs, existing runs are merged into one first,
+// so that number of open files is bounded.
+typedef struct mole_spill
+{
+    size_t capacity;                        // Number of records that fit into the buffer
+    size_t count;                           // Number of records in the buffer
+    size_t position;                        // Next record of the buffer (if nothing was written)
+    spill_record_t* buffer;                 // Buffer of records
+    const char* path;                       // Temporary files are created next to this path
+    size_t run_count;                       // Number of written runs
+    spill_run_t runs[SPILL_RUNS_MAX];       // Written runs
+    size_t heap_size;                       // Number of runs in the heap
+    size_t heap[SPILL_RUNS_MAX];            // Runs ordered by their next records
+} mole_spill_t;
+
+// Initializes empty sort using at most `memory_limit` bytes for records (but space for
+// at least SPILL_RECORDS_MIN records). Temporary files are created in directory of `path`.
+void spill_init(mole_spill_t* spill, size_t memory_limit, const char* path);
+
+// Closes temporary files and frees memory used by the sort.
+void spill_free(mole_spill_t* spill);
+
+// Adds record to the sort.
+void spill_add(mole_spill_t* spill, uint64_t key, uint64_t id);
+
+// Ends adding records and prepares them to be read in order.
+void spill_finish(mole_spill_t* spill);
+
+// Stores next record in `record`. Returns false if all records were read.
+bool spill_next(mole_spill_t* spill, spill_record_t* record);
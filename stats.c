@@ -0,0 +1,189 @@
+#include "stats.h"
+
+#include <pthread.h>
+#include <time.h>
+
+static pthread_mutex_t shards_mutex = PTHREAD_MUTEX_INITIALIZER;
+static stats_shard_t* shards = NULL;                // All shards ever created
+static stats_shard_t* free_shards = NULL;           // Shards of threads that finished
+static pthread_key_t shard_key;
+static pthread_once_t shard_key_once = PTHREAD_ONCE_INIT;
+static __thread stats_shard_t* local_shard = NULL;
+
+// Returns shard of finished thread to the pool.
+static void stats_release_shard(void* shard)
+{
+    pthread_mutex_lock(&shards_mutex);
+    ((stats_shard_t*) shard)->next_free = free_shards;
+    free_shards = shard;
+    pthread_mutex_unlock(&shards_mutex);
+}
+
+static void stats_create_key()
+{
+    if(pthread_key_create(&shard_key, stats_release_shard)) ERROR("pthread_key_create");
+}
+
+static stats_shard_t* stats_local()
+{
+    if(NULL != local_shard) return local_shard;
+
+    pthread_once(&shard_key_once, stats_create_key);
+    pthread_mutex_lock(&shards_mutex);
+    if(NULL != free_shards)
+    {
+        local_shard = free_shards;
+        free_shards = free_shards->next_free;
+    }
+    else
+    {
+        local_shard = calloc(1, sizeof(stats_shard_t));
+        if(NULL == local_shard) ERROR("calloc");
+        local_shard->next = shards;
+        shards = local_shard;
+    }
+    pthread_mutex_unlock(&shards_mutex);
+
+    if(pthread_setspecific(shard_key, local_shard)) ERROR("pthread_setspecific");
+    return local_shard;
+}
+
+// Only the owner writes to its shard, so a plain load and store are enough.
+static inline void stats_increase(_Atomic uint64_t* value, uint64_t delta)
+{
+    atomic_store_explicit(value, atomic_load_explicit(value, memory_order_relaxed) + delta, memory_order_relaxed);
+}
+
+uint64_t stats_now()
+{
+    struct timespec now;
+    if(clock_gettime(CLOCK_MONOTONIC, &now)) ERROR("clock_gettime");
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void stats_add(stats_counter_t counter, uint64_t value)
+{
+    stats_increase(&stats_local()->counters[counter], value);
+}
+
+void stats_add_type(file_type_t file_type)
+{
+    stats_shard_t* shard = stats_local();
+    stats_increase(&shard->types[file_type], 1);
+    stats_increase(&shard->counters[Stat_Entries_Emitted], 1);
+}
+
+void stats_record(stats_histogram_t histogram, uint64_t start)
+{
+    stats_shard_t* shard = stats_local();
+    uint64_t elapsed = stats_now() - start;
+    int bucket = elapsed == 0 ? 0 : 64 - __builtin_clzll(elapsed);
+    if(bucket >= STATS_BUCKETS) bucket = STATS_BUCKETS - 1;
+
+    stats_increase(&shard->buckets[histogram][bucket], 1);
+    stats_increase(&shard->sums[histogram], elapsed);
+    if(elapsed > atomic_load_explicit(&shard->maxima[histogram], memory_order_relaxed))
+        atomic_store_explicit(&shard->maxima[histogram], elapsed, memory_order_relaxed);
+}
+
+// Returns upper bound (in microseconds) of bucket containing given `percentile` of records,
+// but not more than `maximum` (in nanoseconds).
+static double stats_percentile(const uint64_t* buckets, uint64_t count, int percentile, uint64_t maximum)
+{
+    uint64_t rank = (count * percentile + 99) / 100, seen = 0;
+    for(int bucket = 0; bucket < STATS_BUCKETS; ++bucket)
+    {
+        seen += buckets[bucket];
+        if(seen >= rank) return (1ULL << bucket < maximum ? 1ULL << bucket : maximum) / 1e3;
+    }
+
+    return maximum / 1e3;
+}
+
+void stats_print(FILE* stream)
+{
+    uint64_t counters[STATS_COUNTER_COUNT] = {0};
+    uint64_t types[FILE_TYPE_COUNT] = {0};
+    uint64_t buckets[STATS_HISTOGRAM_COUNT][STATS_BUCKETS] = {{0}};
+    uint64_t sums[STATS_HISTOGRAM_COUNT] = {0};
+    uint64_t maxima[STATS_HISTOGRAM_COUNT] = {0};
+
+    pthread_mutex_lock(&shards_mutex);
+    for(stats_shard_t* shard = shards; NULL != shard; shard = shard->next)
+    {
+        for(int i = 0; i < STATS_COUNTER_COUNT; ++i)
+            counters[i] += atomic_load_explicit(&shard->counters[i], memory_order_relaxed);
+        for(int i = 0; i < FILE_TYPE_COUNT; ++i)
+            types[i] += atomic_load_explicit(&shard->types[i], memory_order_relaxed);
+        for(int i = 0; i < STATS_HISTOGRAM_COUNT; ++i)
+        {
+            for(int bucket = 0; bucket < STATS_BUCKETS; ++bucket)
+                buckets[i][bucket] += atomic_load_explicit(&shard->buckets[i][bucket], memory_order_relaxed);
+            sums[i] += atomic_load_explicit(&shard->sums[i], memory_order_relaxed);
+            uint64_t maximum = atomic_load_explicit(&shard->maxima[i], memory_order_relaxed);
+            if(maximum > maxima[i]) maxima[i] = maximum;
+        }
+    }
+    pthread_mutex_unlock(&shards_mutex);
+
+    fprintf(stream, "Counters:\n");
+#define X(counter, description) fprintf(stream, "  " description ": %lu\n", counters[counter]);
+    STATS_COUNTERS(X)
+#undef X
+
+    fprintf(stream, "Entries emitted per type:\n");
+#define X(type, letter, description, summary_name) \
+    if(types[type] > 0) fprintf(stream, "  " summary_name ": %lu\n", types[type]);
+    MOLE_FILE_TYPES(X)
+#undef X
+
+    fprintf(stream, "Latency (microseconds, percentiles are upper bounds):\n");
+    fprintf(stream, "  %-12s %10s %12s %12s %12s %12s\n", "operation", "count", "mean", "p50", "p99", "max");
+    const char* names[] = {
+#define X(histogram, name) name,
+        STATS_HISTOGRAMS(X)
+#undef X
+    };
+    for(int i = 0; i < STATS_HISTOGRAM_COUNT; ++i)
+    {
+        uint64_t count = 0;
+        for(int bucket = 0; bucket < STATS_BUCKETS; ++bucket)
+            count += buckets[i][bucket];
+        if(count == 0) continue;
+
+        fprintf(stream, "  %-12s %10lu %12.1f %12.1f %12.1f %12.1f\n", names[i], count, sums[i] / 1e3 / count,
+                stats_percentile(buckets[i], count, 50, maxima[i]), stats_percentile(buckets[i], count, 99, maxima[i]),
+                maxima[i] / 1e3);
+    }
+}
+
+void stats_dump(const char* path)
+{
+    FILE* stream = fopen(path, "w");
+    if(NULL == stream)
+    {
+        perror("fopen");
+        return;
+    }
+
+    stats_print(stream);
+    if(fclose(stream)) perror("fclose");
+}
+
+void* stats_dump_worker(void* args)
+{
+    mole_context_t* context = (mole_context_t*) args;
+
+    for(;;)
+    {
+        unsigned int tts = STATS_DUMP_INTERVAL;
+        while(tts > 0)
+            tts = sleep(tts);
+
+        // Thread must not be cancelled while it holds the lock of shards.
+        int state;
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+        stats_dump(context->path_s);
+        pthread_setcancelstate(state, NULL);
+    }
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "common.h"
+#include "mole_index.h"
+
+#include <stdint.h>
+
+#define STATS_BUCKETS 64
+#define STATS_DUMP_INTERVAL 60
+
+// Counters: X(counter, description).
+#define STATS_COUNTERS(X) \
+    X(Stat_Dirs_Read,       "Directories read") \
+    X(Stat_Dirs_Reused,     "Directories reused from previous index") \
+    X(Stat_Files_Visited,   "Files visited") \
+    X(Stat_Files_Probed,    "Files opened to find their type") \
+    X(Stat_Files_Known,     "Files with type known without opening") \
+    X(Stat_Entries_Emitted, "Entries emitted") \
+    X(Stat_Indexings,       "Indexing runs") \
+    X(Stat_Saves,           "Cache saves") \
+    X(Stat_Bytes_Written,   "Bytes written into cache") \
+    X(Stat_Records_Spilled, "Records sorted through temporary files")
+
+// Latency histograms: X(histogram, name). Open and read are measured per file when files
+// are probed one by one, and per batch when they are probed through io_uring.
+#define STATS_HISTOGRAMS(X) \
+    X(Stat_Stat_Time,       "stat") \
+    X(Stat_Open_Time,       "open") \
+    X(Stat_Read_Time,       "read") \
+    X(Stat_Index_Time,      "indexing") \
+    X(Stat_Publish_Time,    "publish") \
+    X(Stat_Save_Time,       "save") \
+    X(Stat_Count_Time,      "count") \
+    X(Stat_Larger_Time,     "largerthan") \
+    X(Stat_Smaller_Time,    "smallerthan") \
+    X(Stat_Between_Time,    "between") \
+    X(Stat_Namepart_Time,   "namepart") \
+    X(Stat_Owner_Time,      "owner") \
+    X(Stat_Usage_Time,      "usage") \
+    X(Stat_Find_Time,       "find") \
+    X(Stat_Top_Time,        "top") \
+    X(Stat_Du_Time,         "du")
+
+typedef enum stats_counter
+{
+#define X(counter, description) counter,
+    STATS_COUNTERS(X)
+#undef X
+    STATS_COUNTER_COUNT
+} stats_counter_t;
+
+typedef enum stats_histogram
+{
+#define X(histogram, name) histogram,
+    STATS_HISTOGRAMS(X)
+#undef X
+    STATS_HISTOGRAM_COUNT
+} stats_histogram_t;
+
+// Statistics gathered by a single thread. Only the owner thread writes them (without
+// atomic read-modify-write operations), other threads just read them when statistics
+// are printed. Shards of finished threads are reused by new ones, so counters are kept.
+typedef struct stats_shard
+{
+    _Atomic uint64_t counters[STATS_COUNTER_COUNT];                     // Values of counters
+    _Atomic uint64_t types[FILE_TYPE_COUNT];                            // Entries emitted per type
+    _Atomic uint64_t buckets[STATS_HISTOGRAM_COUNT][STATS_BUCKETS];     // Histograms (bucket k: < 2^k ns)
+    _Atomic uint64_t sums[STATS_HISTOGRAM_COUNT];                       // Sum of recorded times
+    _Atomic uint64_t maxima[STATS_HISTOGRAM_COUNT];                     // Longest recorded time
+    struct stats_shard* next;                                           // Next of all shards
+    struct stats_shard* next_free;                                      // Next of unused shards
+} stats_shard_t;
+
+// Returns monotonic time in nanoseconds.
+uint64_t stats_now();
+
+// Adds `value` to `counter`.
+void stats_add(stats_counter_t counter, uint64_t value);
+
+// Counts entry of type `file_type` emitted by indexing (both per type and in total).
+void stats_add_type(file_type_t file_type);
+
+// Records time that passed since `start` (returned by `stats_now()`).
+void stats_record(stats_histogram_t histogram, uint64_t start);
+
+// Merges shards of all threads and prints statistics into `stream`.
+void stats_print(FILE* stream);
+
+// Writes statistics into file `path`, replacing its contents.
+void stats_dump(const char* path);
+
+// This function is supposed to be executed inside seperate thread.
+// It writes statistics into `context->path_s` every STATS_DUMP_INTERVAL seconds.
+void* stats_dump_worker(void* args);
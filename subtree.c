@@ -0,0 +1,157 @@
+#include "subtree.h"
+#include "mole_index.h"
+#include "scan.h"
+
+void subtrees_init(mole_subtrees_t* subtrees)
+{
+    subtrees->indexed = 0;
+    subtrees->ends = NULL;
+    subtrees->owned = true;
+}
+
+void subtrees_free(mole_subtrees_t* subtrees)
+{
+    if(subtrees->owned) free(subtrees->ends);
+
+    subtrees_init(subtrees);
+}
+
+void subtrees_build(mole_subtrees_t* subtrees, const mole_index_t* index)
+{
+    subtrees_free(subtrees);
+    if(index->size > UINT32_MAX) return;
+
+    uint32_t* ends = malloc((index->size + 1) * sizeof(uint32_t));
+    uint32_t* stack = malloc((index->size + 1) * sizeof(uint32_t));
+    if(NULL == ends || NULL == stack) ERROR("malloc");
+
+    // Stack holds directories whose subtrees are still open. Entry closes subtrees
+    // until its parent is on top, prefix ends at entry whose parent was already closed.
+    size_t depth = 0;
+    size_t i = 0;
+    for(; i < index->size; ++i)
+    {
+        uint64_t parent = index->elements[i].parent;
+        while(depth > 0 && stack[depth - 1] != parent)
+            ends[stack[--depth]] = i;
+        if(parent != MOLE_NO_ENTRY && depth == 0) break;
+
+        stack[depth++] = i;
+    }
+    while(depth > 0)
+        ends[stack[--depth]] = i;
+    free(stack);
+
+    subtrees->indexed = i;
+    subtrees->ends = ends;
+    subtrees->owned = true;
+}
+
+void subtrees_detach(mole_subtrees_t* subtrees)
+{
+    if(subtrees->owned) return;
+
+    uint32_t* ends = malloc((subtrees->indexed + 1) * sizeof(uint32_t));
+    if(NULL == ends) ERROR("malloc");
+    memcpy(ends, subtrees->ends, subtrees->indexed * sizeof(uint32_t));
+
+    subtrees->ends = ends;
+    subtrees->owned = true;
+}
+
+void scope_whole(mole_scope_t* scope, const mole_index_t* index)
+{
+    scope->id = MOLE_NO_ENTRY;
+    scope->begin = 0;
+    scope->end = index->size;
+    scope->tail = index->size;
+}
+
+void scope_empty(mole_scope_t* scope, const mole_index_t* index)
+{
+    scope->id = MOLE_NO_ENTRY;
+    scope->begin = 0;
+    scope->end = 0;
+    scope->tail = index->size;
+}
+
+// Checks whether path of entry `id` is `path` or its ancestor. Path of the parent
+// of derived entry is known to be an ancestor already, so only the name is compared.
+static bool scope_path_matches(const mole_index_t* index, uint64_t id, const char* path, size_t length)
+{
+    const mole_index_entry_t* entry = &index->elements[id];
+    size_t entry_length = entry->path_length;
+    if(index->file_types[id] == Removed || entry_length > length) return false;
+    if(entry_length < length && path[entry_length] != '/' && !(entry_length > 0 && path[entry_length - 1] == '/'))
+        return false;
+
+    if(entry->path_offset != MOLE_NO_ENTRY)
+        return memcmp(index->strings.data + entry->path_offset, path, entry_length) == 0;
+    return memcmp(index_entry_name(index, entry), path + entry_length - entry->name_length, entry->name_length) == 0;
+}
+
+bool scope_find(mole_scope_t* scope, const mole_index_t* index, const char* path)
+{
+    const mole_subtrees_t* subtrees = &index->subtrees;
+    size_t length = strlen(path);
+    uint64_t found = MOLE_NO_ENTRY;
+
+    // Covered entries are found by descending from roots: children of directory `d`
+    // are `d + 1`, `ends[d + 1]`, ... up to `ends[d]`.
+    uint64_t first = 0, last = subtrees->indexed;
+    while(found == MOLE_NO_ENTRY && first < last)
+    {
+        uint64_t next = MOLE_NO_ENTRY;
+        for(uint64_t id = first; id < last && next == MOLE_NO_ENTRY; id = subtrees->ends[id])
+        {
+            if(!scope_path_matches(index, id, path, length)) continue;
+
+            if(index->elements[id].path_length == length) found = id;
+            else next = id;
+        }
+
+        if(next == MOLE_NO_ENTRY) break;
+        first = next + 1;
+        last = subtrees->ends[next];
+    }
+
+    // Entries not covered by ranges (and ones whose path leads elsewhere) are compared one by one.
+    char entry_path[PATH_MAX];
+    for(uint64_t id = 0; id < index->size && found == MOLE_NO_ENTRY; ++id)
+    {
+        const mole_index_entry_t* entry = &index->elements[id];
+        if(index->file_types[id] == Removed || entry->path_length != length) continue;
+
+        index_entry_path(index, entry, entry_path);
+        if(strcmp(entry_path, path) == 0) found = id;
+    }
+    if(found == MOLE_NO_ENTRY) return false;
+
+    scope->id = found;
+    scope->tail = subtrees->indexed;
+    scope->begin = found < subtrees->indexed ? found : subtrees->indexed;
+    scope->end = found < subtrees->indexed ? subtrees->ends[found] : subtrees->indexed;
+    return true;
+}
+
+bool scope_contains(const mole_scope_t* scope, const mole_index_t* index, uint64_t id)
+{
+    if(id < scope->end) return id >= scope->begin;
+
+    // Entries not covered by ranges belong to the scope if one of their ancestors does.
+    for(; id < index->size; id = index->elements[id].parent)
+    {
+        if(id == scope->id) return true;
+        if(id < scope->tail) return id >= scope->begin && id < scope->end;
+    }
+
+    return false;
+}
+
+void scope_count_types(const mole_scope_t* scope, const mole_index_t* index, uint64_t* counts)
+{
+    scan_count_types(index->file_types, scope->begin, scope->end, counts);
+    for(size_t i = scope->tail > scope->end ? scope->tail : scope->end; i < index->size; ++i)
+        if(scope_contains(scope, index, i))
+            counts[index->file_types[i]]++;
+}
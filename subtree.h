@@ -0,0 +1,60 @@
+#pragma once
+
+#include "common.h"
+
+#include <stdint.h>
+
+// Ranges of ids occupied by subtrees of the index. Entries are numbered in pre-order
+// (see `index_order_preorder()`): every directory is followed by all entries inside
+// of it, so its subtree is a contiguous range [`id`, `ends[id]`). Query limited to
+// a directory scans only that range instead of the whole index.
+//
+// Ranges cover entries [0, `indexed`), which is the longest prefix of the index that
+// is numbered in pre-order. Entries added later (by watcher) are not covered and their
+// ancestors have to be checked one by one, until entries are numbered again.
+typedef struct mole_subtrees
+{
+    size_t indexed;     // Number of entries covered by the ranges
+    uint32_t* ends;     // Ends of subtrees of entries (`indexed` elements)
+    bool owned;         // Flag telling whether array was allocated (or is mapped)
+} mole_subtrees_t;
+
+// Part of the index a query is limited to: subtree of a single entry or the whole index.
+// Entries [`begin`, `end`) belong to it, entries [`tail`, size of index) may belong to it.
+// Subtree follows directories as they were traversed, so symbolic links inside of it
+// belong to it, even though their paths (without symbolic links) lead elsewhere.
+typedef struct mole_scope
+{
+    uint64_t id;        // Entry at the top of the subtree (MOLE_NO_ENTRY for whole index)
+    uint64_t begin;     // Range of covered entries belonging to the scope
+    uint64_t end;
+    uint64_t tail;      // First entry not covered by subtree ranges (not below `end`)
+} mole_scope_t;
+
+// Initializes empty ranges, that cover no entries.
+void subtrees_init(mole_subtrees_t* subtrees);
+
+// Frees memory used by the ranges.
+void subtrees_free(mole_subtrees_t* subtrees);
+
+// Finds subtree ranges of the longest prefix of the index numbered in pre-order.
+void subtrees_build(mole_subtrees_t* subtrees, const mole_index_t* index);
+
+// Copies mapped array into ranges' own memory.
+void subtrees_detach(mole_subtrees_t* subtrees);
+
+// Initializes scope covering the whole index.
+void scope_whole(mole_scope_t* scope, const mole_index_t* index);
+
+// Initializes scope, that no entry belongs to.
+void scope_empty(mole_scope_t* scope, const mole_index_t* index);
+
+// Initializes scope covering subtree of entry with full path `path` (absolute, without
+// symbolic links). Returns false if there is no such entry in the index.
+bool scope_find(mole_scope_t* scope, const mole_index_t* index, const char* path);
+
+// Checks whether entry `id` belongs to the scope.
+bool scope_contains(const mole_scope_t* scope, const mole_index_t* index, uint64_t id);
+
+// Adds number of entries of every type in the scope to `counts` (FILE_TYPE_COUNT elements).
+void scope_count_types(const mole_scope_t* scope, const mole_index_t* index, uint64_t* counts);
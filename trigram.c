@@ -0,0 +1,231 @@
+#include "trigram.h"
+#include "mole_index.h"
+
+#define TRIGRAM(bytes, i) (((uint32_t) (bytes)[i] << 16) | ((uint32_t) (bytes)[(i) + 1] << 8) | (bytes)[(i) + 2])
+
+static int trigram_compare(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*) a, y = *(const uint32_t*) b;
+    return (x > y) - (x < y);
+}
+
+size_t trigrams_extract(const char* string, size_t length, uint32_t* result)
+{
+    if(length < 3) return 0;
+
+    const unsigned char* bytes = (const unsigned char*) string;
+    for(size_t i = 0; i + 2 < length; ++i)
+        result[i] = TRIGRAM(bytes, i);
+
+    size_t count = length - 2;
+    qsort(result, count, sizeof(uint32_t), trigram_compare);
+
+    size_t distinct = 0;
+    for(size_t i = 0; i < count; ++i)
+        if(distinct == 0 || result[distinct - 1] != result[i])
+            result[distinct++] = result[i];
+
+    return distinct;
+}
+
+void trigrams_init(mole_trigrams_t* trigrams)
+{
+    trigrams->indexed = 0;
+    trigrams->key_count = 0;
+    trigrams->keys = NULL;
+    trigrams->offsets = NULL;
+    trigrams->postings = NULL;
+    trigrams->owned = true;
+}
+
+void trigrams_free(mole_trigrams_t* trigrams)
+{
+    if(trigrams->owned)
+    {
+        free(trigrams->keys);
+        free(trigrams->offsets);
+        free(trigrams->postings);
+    }
+
+    trigrams_init(trigrams);
+}
+
+void trigrams_build(mole_trigrams_t* trigrams, const mole_index_t* index)
+{
+    trigrams_free(trigrams);
+    if(index->size > UINT32_MAX) return;
+
+    // Dense table indexed by trigram. First it counts entries containing every trigram,
+    // then it maps trigram to its position in `keys`. Only touched pages are allocated.
+    uint32_t* table = calloc(TRIGRAM_KEYS, sizeof(uint32_t));
+    if(NULL == table) ERROR("calloc");
+
+    uint32_t buffer[STR_MAX];
+    for(size_t i = 0; i < index->size; ++i)
+    {
+        if(index->file_types[i] == Removed) continue;
+
+        const mole_index_entry_t* entry = &index->elements[i];
+        size_t count = trigrams_extract(index_entry_name(index, entry), entry->name_length, buffer);
+        for(size_t j = 0; j < count; ++j)
+            table[buffer[j]]++;
+    }
+
+    size_t key_count = 0;
+    for(uint32_t key = 0; key < TRIGRAM_KEYS; ++key)
+        if(table[key] > 0) key_count++;
+
+    uint32_t* keys = malloc((key_count + 1) * sizeof(uint32_t));
+    uint64_t* offsets = malloc((key_count + 1) * sizeof(uint64_t));
+    if(NULL == keys || NULL == offsets) ERROR("malloc");
+
+    offsets[0] = 0;
+    for(uint32_t key = 0, k = 0; key < TRIGRAM_KEYS; ++key)
+    {
+        if(table[key] == 0) continue;
+
+        keys[k] = key;
+        offsets[k + 1] = offsets[k] + table[key];
+        table[key] = k;
+        k++;
+    }
+
+    uint32_t* postings = malloc((offsets[key_count] + 1) * sizeof(uint32_t));
+    uint64_t* next = malloc((key_count + 1) * sizeof(uint64_t));
+    if(NULL == postings || NULL == next) ERROR("malloc");
+    memcpy(next, offsets, (key_count + 1) * sizeof(uint64_t));
+
+    // Entries are visited in order, so every posting list ends up sorted.
+    for(size_t i = 0; i < index->size; ++i)
+    {
+        if(index->file_types[i] == Removed) continue;
+
+        const mole_index_entry_t* entry = &index->elements[i];
+        size_t count = trigrams_extract(index_entry_name(index, entry), entry->name_length, buffer);
+        for(size_t j = 0; j < count; ++j)
+            postings[next[table[buffer[j]]]++] = i;
+    }
+
+    free(next);
+    free(table);
+
+    trigrams->indexed = index->size;
+    trigrams->key_count = key_count;
+    trigrams->keys = keys;
+    trigrams->offsets = offsets;
+    trigrams->postings = postings;
+    trigrams->owned = true;
+}
+
+void trigrams_detach(mole_trigrams_t* trigrams)
+{
+    if(trigrams->owned) return;
+
+    size_t key_count = trigrams->key_count;
+    size_t posting_count = trigrams->offsets[key_count];
+
+    uint32_t* keys = malloc((key_count + 1) * sizeof(uint32_t));
+    uint64_t* offsets = malloc((key_count + 1) * sizeof(uint64_t));
+    uint32_t* postings = malloc((posting_count + 1) * sizeof(uint32_t));
+    if(NULL == keys || NULL == offsets || NULL == postings) ERROR("malloc");
+
+    memcpy(keys, trigrams->keys, key_count * sizeof(uint32_t));
+    memcpy(offsets, trigrams->offsets, (key_count + 1) * sizeof(uint64_t));
+    memcpy(postings, trigrams->postings, posting_count * sizeof(uint32_t));
+
+    trigrams->keys = keys;
+    trigrams->offsets = offsets;
+    trigrams->postings = postings;
+    trigrams->owned = true;
+}
+
+// Returns position of `key` in `keys` or `key_count` if there is no such trigram.
+static size_t trigrams_find(const mole_trigrams_t* trigrams, uint32_t key)
+{
+    size_t low = 0, high = trigrams->key_count;
+    while(low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+        if(trigrams->keys[middle] < key) low = middle + 1;
+        else high = middle;
+    }
+
+    return low < trigrams->key_count && trigrams->keys[low] == key ? low : trigrams->key_count;
+}
+
+bool trigrams_candidates(const mole_trigrams_t* trigrams, const char* string, uint32_t** ids, size_t* count)
+{
+    uint32_t keys[STR_MAX];
+    size_t key_count = trigrams_extract(string, strnlen(string, STR_MAX - 1), keys);
+    if(key_count == 0) return false;
+
+    // Start with the shortest posting list, so that intersection is as small as possible.
+    size_t positions[STR_MAX];
+    for(size_t i = 0; i < key_count; ++i)
+    {
+        positions[i] = trigrams_find(trigrams, keys[i]);
+        if(positions[i] == trigrams->key_count)
+        {
+            *ids = NULL;
+            *count = 0;
+            return true;
+        }
+    }
+
+    size_t shortest = 0;
+    for(size_t i = 1; i < key_count; ++i)
+    {
+        size_t length = trigrams->offsets[positions[i] + 1] - trigrams->offsets[positions[i]];
+        if(length < trigrams->offsets[positions[shortest] + 1] - trigrams->offsets[positions[shortest]])
+            shortest = i;
+    }
+
+    size_t result_count = trigrams->offsets[positions[shortest] + 1] - trigrams->offsets[positions[shortest]];
+    uint32_t* result = malloc((result_count + 1) * sizeof(uint32_t));
+    if(NULL == result) ERROR("malloc");
+    memcpy(result, trigrams->postings + trigrams->offsets[positions[shortest]], result_count * sizeof(uint32_t));
+
+    // Both lists are sorted, so they are intersected by merging.
+    for(size_t i = 0; i < key_count && result_count > 0; ++i)
+    {
+        if(i == shortest) continue;
+
+        const uint32_t* list = trigrams->postings + trigrams->offsets[positions[i]];
+        size_t list_length = trigrams->offsets[positions[i] + 1] - trigrams->offsets[positions[i]];
+
+        size_t kept = 0;
+        for(size_t r = 0, l = 0; r < result_count && l < list_length;)
+        {
+            if(result[r] < list[l]) r++;
+            else if(result[r] > list[l]) l++;
+            else
+            {
+                result[kept++] = result[r];
+                r++;
+                l++;
+            }
+        }
+        result_count = kept;
+    }
+
+    *ids = result;
+    *count = result_count;
+    return true;
+}
+
+size_t trigrams_estimate(const mole_trigrams_t* trigrams, const char* string)
+{
+    uint32_t keys[STR_MAX];
+    size_t key_count = trigrams_extract(string, strnlen(string, STR_MAX - 1), keys);
+    if(key_count == 0) return trigrams->indexed;
+
+    size_t shortest = trigrams->indexed;
+    for(size_t i = 0; i < key_count; ++i)
+    {
+        size_t k = trigrams_find(trigrams, keys[i]);
+        size_t length = k == trigrams->key_count ? 0 : trigrams->offsets[k + 1] - trigrams->offsets[k];
+        if(length < shortest) shortest = length;
+    }
+
+    return shortest;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "common.h"
+
+#include <stdint.h>
+
+#define TRIGRAM_KEYS (1 << 24)
+
+// Inverted index of file names: for every trigram (three consecutive bytes), that appears
+// in any name, it stores sorted list of ids of entries containing it (posting list).
+// Entries containing some string are among those on posting lists of all its trigrams,
+// so `namepart` only has to check names of entries on the intersection of these lists.
+//
+// Posting lists are stored one after another. Trigram `keys[k]` has list
+// `postings[offsets[k]]`, ..., `postings[offsets[k + 1] - 1]`.
+//
+// Index covers entries [0, `indexed`). Entries added later (by watcher) are not covered
+// and have to be checked one by one, until trigram index is built again.
+typedef struct mole_trigrams
+{
+    size_t indexed;         // Number of entries covered by the index
+    size_t key_count;       // Number of distinct trigrams
+    uint32_t* keys;         // Sorted trigrams (first byte in bits 16-23, last one in bits 0-7)
+    uint64_t* offsets;      // Beginnings of posting lists (`key_count + 1` elements)
+    uint32_t* postings;     // Posting lists (entry ids)
+    bool owned;             // Flag telling whether arrays were allocated (or are mapped)
+} mole_trigrams_t;
+
+// Writes distinct trigrams of `string` (sorted) into `result`, that has room for `length`
+// of them, and returns their number.
+size_t trigrams_extract(const char* string, size_t length, uint32_t* result);
+
+// Initializes empty trigram index, that covers no entries.
+void trigrams_init(mole_trigrams_t* trigrams);
+
+// Frees memory used by trigram index.
+void trigrams_free(mole_trigrams_t* trigrams);
+
+// Builds trigram index of names of all entries in the index.
+void trigrams_build(mole_trigrams_t* trigrams, const mole_index_t* index);
+
+// Copies mapped arrays into trigram index's own memory.
+void trigrams_detach(mole_trigrams_t* trigrams);
+
+// Finds ids of entries, whose names may contain `string`. Returns false if trigram
+// index can't narrow down the search (string is shorter than three characters).
+// Otherwise, `*ids` is set to allocated array of `*count` candidates (to be freed by caller).
+bool trigrams_candidates(const mole_trigrams_t* trigrams, const char* string, uint32_t** ids, size_t* count);
+
+// Returns length of the shortest posting list among trigrams of `string` (upper bound
+// of the number of candidates), or number of covered entries if it is too short.
+size_t trigrams_estimate(const mole_trigrams_t* trigrams, const char* string);
@@ -0,0 +1,86 @@
+#include "type_cache.h"
+
+static uint64_t type_cache_hash(uint64_t device, uint64_t inode)
+{
+    uint64_t hash = (inode ^ (device * 0x9e3779b97f4a7c15)) * 0xff51afd7ed558ccd;
+    return hash ^ (hash >> 32);
+}
+
+void type_cache_init(mole_type_cache_t* cache)
+{
+    cache->capacity = 0;
+    cache->slots = NULL;
+    cache->owned = true;
+}
+
+void type_cache_free(mole_type_cache_t* cache)
+{
+    if(cache->owned) free(cache->slots);
+    type_cache_init(cache);
+}
+
+void type_cache_build(mole_type_cache_t* cache, const mole_type_record_t* records, size_t count)
+{
+    type_cache_free(cache);
+    if(count == 0) return;
+
+    cache->capacity = 16;
+    while(cache->capacity < 2 * count)
+        cache->capacity *= 2;
+
+    cache->slots = calloc(cache->capacity, sizeof(mole_type_record_t));
+    if(NULL == cache->slots) ERROR("calloc");
+
+    // The same file may be reached more than once (e.g. through a symbolic link).
+    for(size_t i = 0; i < count; ++i)
+    {
+        size_t slot = type_cache_hash(records[i].device, records[i].inode) & (cache->capacity - 1);
+        while(cache->slots[slot].occupied
+              && (cache->slots[slot].device != records[i].device || cache->slots[slot].inode != records[i].inode))
+            slot = (slot + 1) & (cache->capacity - 1);
+        cache->slots[slot] = records[i];
+    }
+}
+
+void type_cache_detach(mole_type_cache_t* cache)
+{
+    if(cache->owned) return;
+
+    mole_type_record_t* slots = malloc((cache->capacity + 1) * sizeof(mole_type_record_t));
+    if(NULL == slots) ERROR("malloc");
+    memcpy(slots, cache->slots, cache->capacity * sizeof(mole_type_record_t));
+
+    cache->slots = slots;
+    cache->owned = true;
+}
+
+bool type_cache_find(const mole_type_cache_t* cache, const struct stat* stat, uint32_t* file_type)
+{
+    if(cache->capacity == 0) return false;
+
+    mole_type_record_t key;
+    type_record_fill(&key, stat, 0);
+
+    size_t slot = type_cache_hash(key.device, key.inode) & (cache->capacity - 1);
+    for(; cache->slots[slot].occupied; slot = (slot + 1) & (cache->capacity - 1))
+    {
+        const mole_type_record_t* record = &cache->slots[slot];
+        if(record->device != key.device || record->inode != key.inode) continue;
+
+        if(record->modification_time != key.modification_time || record->size != key.size) return false;
+        *file_type = record->file_type;
+        return true;
+    }
+
+    return false;
+}
+
+void type_record_fill(mole_type_record_t* record, const struct stat* stat, uint32_t file_type)
+{
+    record->device = stat->st_dev;
+    record->inode = stat->st_ino;
+    record->modification_time = stat->st_mtim.tv_sec * 1000000000LL + stat->st_mtim.tv_nsec;
+    record->size = stat->st_size;
+    record->file_type = file_type;
+    record->occupied = 1;
+}
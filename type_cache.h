@@ -0,0 +1,49 @@
+#pragma once
+
+#include "common.h"
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+// Type of file detected during previous indexing, together with what identified the file.
+typedef struct mole_type_record
+{
+    uint64_t device;            // Id of device containing the file
+    uint64_t inode;             // File's inode number
+    int64_t modification_time;  // Time of last modification (in nanoseconds)
+    uint64_t size;              // Size of file (in bytes)
+    uint32_t file_type;         // Detected type (`file_type_t`, including Unrecognized)
+    uint32_t occupied;          // 1 for occupied slots, 0 for empty ones
+} mole_type_record_t;
+
+// Hash table mapping identity of every regular file seen during indexing (device, inode,
+// modification time and size) to its detected type. It is saved together with the index,
+// so that even full traversal can find out type of an unmodified file with `stat()` alone,
+// without opening it. Unlike the index, it also remembers unrecognized files and it doesn't
+// depend on paths, so moved or renamed files are not opened again either.
+//
+// Table uses linear probing and is stored as it is, so it can be used directly from mapping.
+typedef struct mole_type_cache
+{
+    size_t capacity;                // Number of slots (power of two, 0 if cache is empty)
+    mole_type_record_t* slots;      // Array of slots
+    bool owned;                     // Flag telling whether array was allocated (or is mapped)
+} mole_type_cache_t;
+
+// Initializes empty cache.
+void type_cache_init(mole_type_cache_t* cache);
+
+// Frees memory used by the cache.
+void type_cache_free(mole_type_cache_t* cache);
+
+// Builds cache out of `count` records, replacing its contents.
+void type_cache_build(mole_type_cache_t* cache, const mole_type_record_t* records, size_t count);
+
+// Copies mapped array into cache's own memory.
+void type_cache_detach(mole_type_cache_t* cache);
+
+// Looks up file described by `stat`. Returns false if its type is not known.
+bool type_cache_find(const mole_type_cache_t* cache, const struct stat* stat, uint32_t* file_type);
+
+// Fills record describing file `stat` of type `file_type`.
+void type_record_fill(mole_type_record_t* record, const struct stat* stat, uint32_t file_type);
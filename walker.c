@@ -0,0 +1,524 @@
+#include "walker.h"
+#include "indexer.h"
+#include "stats.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <time.h>
+
+// Thread's argument: shared walker state and thread's own number.
+typedef struct walker_thread_args
+{
+    walker_t* walker;
+    int id;
+} walker_thread_args_t;
+
+static walker_dir_t* walker_dir_new(const char* path, const char* real_path, const struct stat* stat,
+                                    uint64_t previous_id, walker_dir_t* parent)
+{
+    walker_dir_t* dir = malloc(sizeof(walker_dir_t));
+    if(NULL == dir) ERROR("malloc");
+
+    dir->path = strdup(path);
+    dir->real_path = strdup(real_path);
+    if(NULL == dir->path || NULL == dir->real_path) ERROR("strdup");
+    dir->stat = *stat;
+    dir->id = MOLE_NO_ENTRY;
+    dir->previous_id = previous_id;
+    dir->parent = parent;
+    atomic_init(&dir->references, 1);
+    if(NULL != parent) atomic_fetch_add(&parent->references, 1);
+
+    return dir;
+}
+
+// Drops one reference to directory, freeing it (and possibly its ancestors) when unused.
+static void walker_dir_release(walker_dir_t* dir)
+{
+    while(NULL != dir && atomic_fetch_sub(&dir->references, 1) == 1)
+    {
+        walker_dir_t* parent = dir->parent;
+        free(dir->path);
+        free(dir->real_path);
+        free(dir);
+        dir = parent;
+    }
+}
+
+// Checks whether directory described by `stat` is `dir` or one of its ancestors.
+static bool walker_dir_is_cycle(const walker_dir_t* dir, const struct stat* stat)
+{
+    for(; NULL != dir; dir = dir->parent)
+        if(dir->stat.st_dev == stat->st_dev && dir->stat.st_ino == stat->st_ino)
+            return true;
+
+    return false;
+}
+
+static void walker_queue_init(walker_queue_t* queue)
+{
+    queue->head = 0;
+    queue->size = 0;
+    queue->capacity = WALKER_QUEUE_CAPACITY;
+    queue->elements = malloc(queue->capacity * sizeof(walker_dir_t*));
+    if(NULL == queue->elements) ERROR("malloc");
+    if(pthread_mutex_init(&queue->mutex, NULL)) ERROR("pthread_mutex_init");
+}
+
+static void walker_queue_free(walker_queue_t* queue)
+{
+    // Queue may still hold directories, if traversal was interrupted.
+    for(size_t i = 0; i < queue->size; ++i)
+        walker_dir_release(queue->elements[(queue->head + i) % queue->capacity]);
+
+    free(queue->elements);
+    queue->elements = NULL;
+    pthread_mutex_destroy(&queue->mutex);
+}
+
+static void walker_queue_push_back(walker_queue_t* queue, walker_dir_t* dir)
+{
+    pthread_mutex_lock(&queue->mutex);
+    if(queue->size == queue->capacity)
+    {
+        walker_dir_t** new_elements = malloc(2 * queue->capacity * sizeof(walker_dir_t*));
+        if(NULL == new_elements) ERROR("malloc");
+        for(size_t i = 0; i < queue->size; ++i)
+            new_elements[i] = queue->elements[(queue->head + i) % queue->capacity];
+        free(queue->elements);
+        queue->elements = new_elements;
+        queue->head = 0;
+        queue->capacity *= 2;
+    }
+
+    queue->elements[(queue->head + queue->size) % queue->capacity] = dir;
+    queue->size++;
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+static walker_dir_t* walker_queue_pop_back(walker_queue_t* queue)
+{
+    walker_dir_t* dir = NULL;
+    pthread_mutex_lock(&queue->mutex);
+    if(queue->size > 0)
+    {
+        queue->size--;
+        dir = queue->elements[(queue->head + queue->size) % queue->capacity];
+    }
+    pthread_mutex_unlock(&queue->mutex);
+
+    return dir;
+}
+
+static walker_dir_t* walker_queue_pop_front(walker_queue_t* queue)
+{
+    walker_dir_t* dir = NULL;
+    pthread_mutex_lock(&queue->mutex);
+    if(queue->size > 0)
+    {
+        dir = queue->elements[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->size--;
+    }
+    pthread_mutex_unlock(&queue->mutex);
+
+    return dir;
+}
+
+static void walker_schedule(walker_t* walker, int id, walker_dir_t* dir)
+{
+    atomic_fetch_add(&walker->pending, 1);
+    walker_queue_push_back(&walker->queues[id], dir);
+
+    if(atomic_load(&walker->idle) > 0)
+    {
+        pthread_mutex_lock(&walker->idle_mutex);
+        pthread_cond_signal(&walker->work_available);
+        pthread_mutex_unlock(&walker->idle_mutex);
+    }
+}
+
+// Returns next directory to read: thread's own one, or stolen from other thread.
+// Returns NULL when whole tree was traversed.
+static walker_dir_t* walker_next(walker_t* walker, int id)
+{
+    for(;;)
+    {
+        walker_dir_t* dir = walker_queue_pop_back(&walker->queues[id]);
+        for(int i = 1; NULL == dir && i < walker->threads; ++i)
+            dir = walker_queue_pop_front(&walker->queues[(id + i) % walker->threads]);
+        if(NULL != dir) return dir;
+
+        pthread_mutex_lock(&walker->idle_mutex);
+        if(atomic_load(&walker->pending) == 0)
+        {
+            pthread_cond_broadcast(&walker->work_available);
+            pthread_mutex_unlock(&walker->idle_mutex);
+            return NULL;
+        }
+
+        // Some thread is still reading a directory, so it may produce more work.
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += WALKER_IDLE_WAIT_NS;
+        if(deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+
+        atomic_fetch_add(&walker->idle, 1);
+        pthread_cond_timedwait(&walker->work_available, &walker->idle_mutex, &deadline);
+        atomic_fetch_sub(&walker->idle, 1);
+        pthread_mutex_unlock(&walker->idle_mutex);
+    }
+}
+
+static bool walker_should_exit(walker_t* walker)
+{
+    if(atomic_load(&walker->interrupted)) return true;
+
+    pthread_mutex_lock(walker->context->force_exit_mutex);
+    bool force_exit = walker->context->force_exit;
+    pthread_mutex_unlock(walker->context->force_exit_mutex);
+
+    if(force_exit) atomic_store(&walker->interrupted, true);
+    return force_exit;
+}
+
+// Returns id of entry with `real_path` in previous index or MOLE_NO_ENTRY.
+static uint64_t walker_find_previous(walker_t* walker, const char* real_path)
+{
+    if(NULL == walker->previous) return MOLE_NO_ENTRY;
+
+    return path_table_find(&walker->previous_paths, walker->previous, real_path);
+}
+
+// Probes types of files collected in thread's batch and inserts recognized ones into the index.
+static void walker_flush(walker_t* walker, int id, walker_dir_t* dir, int dir_fd)
+{
+    walker_batch_t* batch = &walker->batches[id];
+
+    size_t request_count = 0;
+    for(size_t i = 0; i < batch->size; ++i)
+        if(!batch->files[i].type_known)
+            batch->requests[request_count++].name = batch->strings.data + batch->files[i].name_offset;
+    prober_run(&batch->prober, dir_fd, batch->requests, request_count);
+    stats_add(Stat_Files_Probed, request_count);
+    stats_add(Stat_Files_Known, batch->size - request_count);
+
+    // Files are inserted in the order they were found.
+    for(size_t i = 0, j = 0; i < batch->size; ++i)
+    {
+        walker_file_t* file = &batch->files[i];
+        if(!file->type_known)
+            file->file_type = batch->requests[j++].file_type;
+
+        if(batch->record_count == batch->record_capacity)
+        {
+            batch->record_capacity = batch->record_capacity == 0 ? WALKER_BATCH_SIZE : 2 * batch->record_capacity;
+            batch->records = realloc(batch->records, batch->record_capacity * sizeof(mole_type_record_t));
+            if(NULL == batch->records) ERROR("realloc");
+        }
+        type_record_fill(&batch->records[batch->record_count++], &file->stat, file->file_type);
+
+        if(file->file_type != Unrecognized)
+        {
+            index_emplace(&walker->indexes[id], batch->strings.data + file->name_offset,
+                          batch->strings.data + file->path_offset, dir->id, dir->real_path, &file->stat, file->file_type);
+            stats_add_type(file->file_type);
+        }
+    }
+
+    batch->size = 0;
+    batch->strings.size = 0;
+}
+
+// Handles single file `name` found inside directory `dir`. `type` is taken from `struct dirent`
+// (DT_UNKNOWN if not known). If directory was not modified, `previous_id` is the id of the
+// file in previous index, otherwise it is MOLE_NO_ENTRY.
+static void walker_visit(walker_t* walker, int id, walker_dir_t* dir, int dir_fd,
+                         char* child_path, size_t dir_path_length, const char* name,
+                         unsigned char type, uint64_t previous_id)
+{
+    size_t name_length = strlen(name);
+    if(dir_path_length + name_length >= PATH_MAX) return;
+    memcpy(child_path + dir_path_length, name, name_length + 1);
+
+    // Symbolic links are followed, broken ones are skipped.
+    struct stat child_stat;
+    uint64_t start = stats_now();
+    int result = fstatat(dir_fd, name, &child_stat, 0);
+    stats_record(Stat_Stat_Time, start);
+    stats_add(Stat_Files_Visited, 1);
+    if(result) return;
+    if(!S_ISDIR(child_stat.st_mode) && !S_ISREG(child_stat.st_mode)) return;
+
+    const mole_index_entry_t* previous = NULL;
+    if(previous_id != MOLE_NO_ENTRY)
+    {
+        previous = &walker->previous->elements[previous_id];
+        if(previous->device != (uint64_t) child_stat.st_dev || previous->inode != (uint64_t) child_stat.st_ino)
+            previous = NULL;
+    }
+
+    // Resolving path is expensive, so it is done only when there might be a symbolic link.
+    char real_path[PATH_MAX];
+    if(NULL != previous)
+    {
+        index_entry_path(walker->previous, previous, real_path);
+    }
+    else if(type != DT_LNK && type != DT_UNKNOWN)
+    {
+        size_t real_length = strlen(dir->real_path);
+        if(real_length + name_length + 2 > PATH_MAX) return;
+        memcpy(real_path, dir->real_path, real_length);
+        if(real_length == 0 || real_path[real_length - 1] != '/')
+            real_path[real_length++] = '/';
+        memcpy(real_path + real_length, name, name_length + 1);
+    }
+    else if(realpath(child_path, real_path) == NULL) return;
+
+    if(NULL == previous)
+    {
+        previous_id = walker_find_previous(walker, real_path);
+        previous = previous_id == MOLE_NO_ENTRY ? NULL : &walker->previous->elements[previous_id];
+    }
+
+    if(S_ISDIR(child_stat.st_mode))
+    {
+        if(!walker_dir_is_cycle(dir, &child_stat))
+        {
+            previous_id = NULL != previous ? (uint64_t) (previous - walker->previous->elements) : MOLE_NO_ENTRY;
+            walker_schedule(walker, id, walker_dir_new(child_path, real_path, &child_stat, previous_id, dir));
+        }
+        return;
+    }
+
+    previous_id = NULL != previous ? (uint64_t) (previous - walker->previous->elements) : MOLE_NO_ENTRY;
+    walker_batch_t* batch = &walker->batches[id];
+    walker_file_t* file = &batch->files[batch->size++];
+    file->name_offset = arena_append(&batch->strings, name, name_length);
+    file->path_offset = arena_append(&batch->strings, real_path, strlen(real_path));
+    file->stat = child_stat;
+    file->file_type = Unrecognized;
+    file->type_known = false;
+    if(NULL != previous && walker->previous->file_types[previous_id] != Directory
+       && walker->previous->file_types[previous_id] != Removed && index_entry_unchanged(walker->previous, previous_id, &child_stat))
+    {
+        file->file_type = walker->previous->file_types[previous_id];
+        file->type_known = true;
+    }
+    else if(NULL != walker->known_types)
+    {
+        uint32_t known_type;
+        if(type_cache_find(walker->known_types, &child_stat, &known_type))
+        {
+            file->file_type = known_type;
+            file->type_known = true;
+        }
+    }
+
+    if(batch->size == WALKER_BATCH_SIZE)
+        walker_flush(walker, id, dir, dir_fd);
+}
+
+// Indexes directory `dir` and all files inside of it. Subdirectories are scheduled
+// to be read later (by this or other thread).
+static void walker_read_dir(walker_t* walker, int id, walker_dir_t* dir)
+{
+    mole_index_t* index = &walker->indexes[id];
+
+    // Just like `fts`, root directory is named after the path it was given by.
+    const char* dir_name = NULL == dir->parent ? dir->path : strrchr(dir->path, '/') + 1;
+    uint64_t parent_id = NULL == dir->parent ? MOLE_NO_ENTRY : dir->parent->id;
+    const char* parent_path = NULL == dir->parent ? NULL : dir->parent->real_path;
+    uint64_t local_id = index_emplace(index, dir_name, dir->real_path, parent_id, parent_path, &dir->stat, Directory);
+    dir->id = ((uint64_t) id << WALKER_THREAD_SHIFT) | local_id;
+    stats_add_type(Directory);
+
+    size_t dir_path_length = strlen(dir->path);
+    char child_path[PATH_MAX];
+    memcpy(child_path, dir->path, dir_path_length);
+    if(dir_path_length > 0 && child_path[dir_path_length - 1] != '/')
+        child_path[dir_path_length++] = '/';
+
+    // Contents of unmodified directory are the same as during previous indexing.
+    const mole_index_entry_t* previous = NULL;
+    if(dir->previous_id != MOLE_NO_ENTRY)
+    {
+        previous = &walker->previous->elements[dir->previous_id];
+        if(walker->previous->file_types[dir->previous_id] != Directory
+           || !index_entry_unchanged(walker->previous, dir->previous_id, &dir->stat))
+            previous = NULL;
+    }
+
+    if(NULL != previous)
+    {
+        int dir_fd = open(dir->path, O_RDONLY | O_DIRECTORY);
+        if(dir_fd < 0) return;
+        stats_add(Stat_Dirs_Reused, 1);
+
+        const mole_children_t* children = &walker->previous_children;
+        for(uint64_t i = children->offsets[dir->previous_id]; i < children->offsets[dir->previous_id + 1]; ++i)
+        {
+            uint64_t child_id = children->ids[i];
+            const char* name = index_entry_name(walker->previous, &walker->previous->elements[child_id]);
+            walker_visit(walker, id, dir, dir_fd, child_path, dir_path_length, name, DT_UNKNOWN, child_id);
+        }
+        walker_flush(walker, id, dir, dir_fd);
+
+        if(close(dir_fd)) ERROR("close");
+        return;
+    }
+
+    DIR* stream = opendir(dir->path);
+    if(NULL == stream) return;
+    int dir_fd = dirfd(stream);
+    stats_add(Stat_Dirs_Read, 1);
+
+    struct dirent* dirent;
+    errno = 0;
+    while((dirent = readdir(stream)) != NULL)
+    {
+        const char* name = dirent->d_name;
+        if(strcmp(name, ".") != 0 && strcmp(name, "..") != 0)
+            walker_visit(walker, id, dir, dir_fd, child_path, dir_path_length, name, dirent->d_type, MOLE_NO_ENTRY);
+        errno = 0;
+    }
+    if(errno != 0) ERROR("readdir");
+    walker_flush(walker, id, dir, dir_fd);
+
+    if(closedir(stream)) ERROR("closedir");
+}
+
+static void* walker_thread(void* args)
+{
+    walker_thread_args_t* thread_args = (walker_thread_args_t*) args;
+    walker_t* walker = thread_args->walker;
+    int id = thread_args->id;
+
+    walker_dir_t* dir;
+    while((dir = walker_next(walker, id)) != NULL)
+    {
+        if(!walker_should_exit(walker))
+            walker_read_dir(walker, id, dir);
+
+        walker_dir_release(dir);
+        atomic_fetch_sub(&walker->pending, 1);
+    }
+
+    return NULL;
+}
+
+bool walker_run(mole_context_t* context, const char* root, const mole_index_t* previous,
+                const mole_type_cache_t* known_types, mole_index_t* result)
+{
+    struct stat root_stat;
+    if(stat(root, &root_stat) || !S_ISDIR(root_stat.st_mode))
+        return true;
+
+    char root_real_path[PATH_MAX];
+    if(realpath(root, root_real_path) == NULL) return true;
+
+    walker_t walker;
+    walker.context = context;
+    walker.threads = context->threads;
+    walker.previous = NULL;
+    walker.known_types = known_types;
+    if(NULL != previous && previous->size > 0)
+    {
+        walker.previous = previous;
+        path_table_build(&walker.previous_paths, previous);
+        children_build(&walker.previous_children, previous);
+    }
+    atomic_init(&walker.pending, 0);
+    atomic_init(&walker.interrupted, false);
+    atomic_init(&walker.idle, 0);
+    if(pthread_mutex_init(&walker.idle_mutex, NULL)) ERROR("pthread_mutex_init");
+    if(pthread_cond_init(&walker.work_available, NULL)) ERROR("pthread_cond_init");
+
+    walker.queues = malloc(walker.threads * sizeof(walker_queue_t));
+    walker.indexes = malloc(walker.threads * sizeof(mole_index_t));
+    walker.batches = malloc(walker.threads * sizeof(walker_batch_t));
+    walker_thread_args_t* args = malloc(walker.threads * sizeof(walker_thread_args_t));
+    pthread_t* tids = malloc(walker.threads * sizeof(pthread_t));
+    if(NULL == walker.queues || NULL == walker.indexes || NULL == walker.batches || NULL == args || NULL == tids) ERROR("malloc");
+
+    for(int i = 0; i < walker.threads; ++i)
+    {
+        walker_queue_init(&walker.queues[i]);
+        // Any thread might index the whole tree, space for it is reserved so that entries are not moved.
+        index_init_reserved(&walker.indexes[i], MOLE_DEFAULT_CAPACITY, MOLE_MAX_ENTRIES);
+        walker.batches[i].size = 0;
+        walker.batches[i].records = NULL;
+        walker.batches[i].record_count = walker.batches[i].record_capacity = 0;
+        arena_init(&walker.batches[i].strings, MOLE_ARENA_DEFAULT_CAPACITY);
+        prober_init(&walker.batches[i].prober);
+        args[i].walker = &walker;
+        args[i].id = i;
+    }
+
+    uint64_t root_previous_id = walker_find_previous(&walker, root_real_path);
+    walker_schedule(&walker, 0, walker_dir_new(root, root_real_path, &root_stat, root_previous_id, NULL));
+
+    for(int i = 0; i < walker.threads; ++i)
+        if(pthread_create(&tids[i], NULL, walker_thread, &args[i])) ERROR("pthread_create");
+    for(int i = 0; i < walker.threads; ++i)
+        if(pthread_join(tids[i], NULL)) ERROR("pthread_join");
+
+    bool completed = !atomic_load(&walker.interrupted);
+    uint64_t bases[WALKER_THREADS_MAX];
+    size_t record_count = 0;
+    for(int i = 0; i < walker.threads; ++i)
+    {
+        bases[i] = result->size;
+        if(completed) index_merge(result, &walker.indexes[i]);
+        index_free(&walker.indexes[i]);
+        arena_free(&walker.batches[i].strings);
+        prober_free(&walker.batches[i].prober);
+        record_count += walker.batches[i].record_count;
+        walker_queue_free(&walker.queues[i]);
+    }
+
+    // Translate parent ids from (thread, local id) into ids in merged index.
+    for(size_t i = 0; completed && i < result->size; ++i)
+    {
+        uint64_t parent = result->elements[i].parent;
+        if(parent != MOLE_NO_ENTRY)
+            result->elements[i].parent = bases[parent >> WALKER_THREAD_SHIFT] + (parent & WALKER_LOCAL_MASK);
+    }
+
+    // Records of all threads are gathered into a single cache.
+    if(completed)
+    {
+        mole_type_record_t* records = malloc((record_count > 0 ? record_count : 1) * sizeof(mole_type_record_t));
+        if(NULL == records) ERROR("malloc");
+        size_t offset = 0;
+        for(int i = 0; i < walker.threads; ++i)
+        {
+            memcpy(records + offset, walker.batches[i].records, walker.batches[i].record_count * sizeof(mole_type_record_t));
+            offset += walker.batches[i].record_count;
+        }
+        type_cache_build(&result->type_cache, records, record_count);
+        free(records);
+    }
+    for(int i = 0; i < walker.threads; ++i)
+        free(walker.batches[i].records);
+
+    if(NULL != walker.previous)
+    {
+        path_table_free(&walker.previous_paths);
+        children_free(&walker.previous_children);
+    }
+
+    free(tids);
+    free(args);
+    free(walker.indexes);
+    free(walker.batches);
+    free(walker.queues);
+    pthread_cond_destroy(&walker.work_available);
+    pthread_mutex_destroy(&walker.idle_mutex);
+
+    return completed;
+}
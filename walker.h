@@ -0,0 +1,103 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "mole_index.h"
+#include "probe.h"
+
+#define WALKER_THREADS_MAX 64
+#define WALKER_QUEUE_CAPACITY 64
+#define WALKER_IDLE_WAIT_NS 2000000
+#define WALKER_BATCH_SIZE PROBE_RING_ENTRIES
+
+// While traversing, entry ids are local to thread's index. Thread number is kept
+// in the highest bits of id, so that ids can be fixed after indexes are merged.
+#define WALKER_THREAD_SHIFT 48
+#define WALKER_LOCAL_MASK ((1ULL << WALKER_THREAD_SHIFT) - 1)
+
+// Directory, that was discovered but not yet read. Every directory keeps a reference
+// to its parent, so that cycles (caused by following symbolic links) can be detected
+// the same way `fts` does it: by comparing device and inode with all ancestors.
+typedef struct walker_dir
+{
+    char* path;                 // Path to directory (as seen during traversal)
+    char* real_path;            // Path to directory without symbolic links
+    struct stat stat;           // Result of `stat()` called on the directory
+    uint64_t id;                // Id of directory's entry (set when directory is read)
+    uint64_t previous_id;       // Id of directory's entry in previous index (or MOLE_NO_ENTRY)
+    struct walker_dir* parent;  // Directory containing this one (NULL for root)
+    atomic_int references;      // Number of queued children and pending work items
+} walker_dir_t;
+
+// Double-ended queue of directories owned by single thread. Owner takes directories
+// from the back (depth-first, for locality), other threads steal from the front,
+// where usually the biggest, not yet explored subtrees are.
+typedef struct walker_queue
+{
+    size_t head;                // Index of the first element
+    size_t size;                // Number of elements in the queue
+    size_t capacity;            // True size of the ring buffer
+    walker_dir_t** elements;    // Ring buffer of directories
+    pthread_mutex_t mutex;      // Mutex guarding the queue
+} walker_queue_t;
+
+// File found inside directory, waiting for its type to be probed before it is indexed.
+typedef struct walker_file
+{
+    uint64_t name_offset;       // Offset of file name in batch's arena
+    uint64_t path_offset;       // Offset of path without symbolic links in batch's arena
+    struct stat stat;           // Result of `stat()` called on the file
+    file_type_t file_type;      // Type of the file (valid if `type_known`, otherwise set by probing)
+    bool type_known;            // Flag telling that type is known from previous index or type cache
+} walker_file_t;
+
+// Files of currently read directory, collected by single thread so that they are probed
+// together (see `prober_t`). Batch is flushed when it is full and after every directory.
+typedef struct walker_batch
+{
+    size_t size;                                    // Number of collected files
+    walker_file_t files[WALKER_BATCH_SIZE];         // Collected files
+    probe_request_t requests[WALKER_BATCH_SIZE];    // Files that have to be probed
+    mole_string_arena_t strings;                    // Names and paths of collected files
+    prober_t prober;                                // Thread's own prober
+    mole_type_record_t* records;                    // Types of all files seen by the thread
+    size_t record_count;                            // Number of records
+    size_t record_capacity;                         // Number of records that fit in `records`
+} walker_batch_t;
+
+// State shared by all threads taking part in a single traversal.
+typedef struct walker
+{
+    mole_context_t* context;            // Program's context
+    int threads;                        // Number of worker threads
+    walker_queue_t* queues;             // One queue per thread
+    mole_index_t* indexes;              // One index per thread, merged at the end
+    walker_batch_t* batches;            // One batch of files per thread
+    const mole_index_t* previous;       // Result of previous indexing (NULL if not incremental)
+    const mole_type_cache_t* known_types; // Types of files seen before (NULL if not known)
+    mole_path_table_t previous_paths;   // Paths of entries in previous index
+    mole_children_t previous_children;  // Children of directories in previous index
+    atomic_size_t pending;              // Number of directories queued or being read
+    atomic_bool interrupted;            // Set when traversal was interrupted by `exit!`
+    atomic_int idle;                    // Number of threads waiting for work
+    pthread_mutex_t idle_mutex;         // Mutex guarding condition variable below
+    pthread_cond_t work_available;      // Signaled when new directory is queued
+} walker_t;
+
+// Traverses directory tree rooted at `root` using `context->threads` threads,
+// following symbolic links. Directories and recognized files are inserted into `result`.
+//
+// If `previous` index is given, traversal is incremental: directories that were not
+// modified since then are not read again (their contents are taken from `previous`)
+// and files that were not modified are not opened to determine their type.
+//
+// Files found in `known_types` cache (which may be given even if traversal is not incremental)
+// are not opened either. Types of all files seen during traversal are stored in
+// `result->type_cache`.
+//
+// Returns false if traversal was interrupted by setting `context->force_exit`.
+bool walker_run(mole_context_t* context, const char* root, const mole_index_t* previous,
+                const mole_type_cache_t* known_types, mole_index_t* result);
@@ -0,0 +1,567 @@
+#include "watcher.h"
+#include "indexer.h"
+#include "persister.h"
+#include "snapshot.h"
+#include "walker.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <time.h>
+
+#define WATCHER_POLL_MS 1000
+
+static uint64_t child_hash(uint64_t parent, const char* name)
+{
+    uint64_t hash = 0xcbf29ce484222325 ^ (parent * 0x9e3779b97f4a7c15);
+    while(*name)
+    {
+        hash ^= (unsigned char) *name++;
+        hash *= 0x100000001b3;
+    }
+
+    return hash;
+}
+
+static void child_table_place(watcher_child_table_t* table, const mole_index_t* index, uint64_t id)
+{
+    const mole_index_entry_t* entry = &index->elements[id];
+    size_t slot = child_hash(entry->parent, index_entry_name(index, entry)) & (table->capacity - 1);
+    while(table->slots[slot] != 0)
+        slot = (slot + 1) & (table->capacity - 1);
+    table->slots[slot] = id + 1;
+    table->size++;
+}
+
+static void child_table_build(watcher_child_table_t* table, const mole_index_t* index)
+{
+    table->size = 0;
+    table->capacity = 16;
+    while(table->capacity < 2 * index->size)
+        table->capacity *= 2;
+
+    table->slots = calloc(table->capacity, sizeof(uint64_t));
+    if(NULL == table->slots) ERROR("calloc");
+
+    for(size_t i = 0; i < index->size; ++i)
+        if(index->file_types[i] != Removed && index->elements[i].parent != MOLE_NO_ENTRY)
+            child_table_place(table, index, i);
+}
+
+static void child_table_free(watcher_child_table_t* table)
+{
+    table->size = 0;
+    table->capacity = 0;
+    free(table->slots);
+    table->slots = NULL;
+}
+
+static void child_table_insert(watcher_child_table_t* table, const mole_index_t* index, uint64_t id)
+{
+    if(2 * (table->size + 1) > table->capacity)
+    {
+        uint64_t* old_slots = table->slots;
+        size_t old_capacity = table->capacity;
+
+        table->size = 0;
+        table->capacity *= 2;
+        table->slots = calloc(table->capacity, sizeof(uint64_t));
+        if(NULL == table->slots) ERROR("calloc");
+
+        for(size_t i = 0; i < old_capacity; ++i)
+            if(old_slots[i] != 0)
+                child_table_place(table, index, old_slots[i] - 1);
+        free(old_slots);
+    }
+
+    child_table_place(table, index, id);
+}
+
+static uint64_t child_table_find(const watcher_child_table_t* table, const mole_index_t* index,
+                                 uint64_t parent, const char* name)
+{
+    size_t slot = child_hash(parent, name) & (table->capacity - 1);
+    for(; table->slots[slot] != 0; slot = (slot + 1) & (table->capacity - 1))
+    {
+        uint64_t id = table->slots[slot] - 1;
+        const mole_index_entry_t* entry = &index->elements[id];
+        if(index->file_types[id] != Removed && entry->parent == parent && strcmp(index_entry_name(index, entry), name) == 0)
+            return id;
+    }
+
+    return MOLE_NO_ENTRY;
+}
+
+// Starts watching directory `path`.
+static void watcher_watch(watcher_t* watcher, const char* path)
+{
+    int wd = inotify_add_watch(watcher->inotify_fd, path, WATCHER_EVENTS_MASK);
+    if(wd < 0)
+    {
+        if(errno == ENOSPC && !watcher->rescan_needed)
+            fprintf(stderr, "Watch limit reached, some directories are not watched!\n");
+        return;
+    }
+
+    if((size_t) wd >= watcher->watched_capacity)
+    {
+        size_t new_capacity = watcher->watched_capacity;
+        while((size_t) wd >= new_capacity)
+            new_capacity *= 2;
+
+        watcher->watched = realloc(watcher->watched, new_capacity * sizeof(char*));
+        watcher->watched_generation = realloc(watcher->watched_generation, new_capacity * sizeof(size_t));
+        if(NULL == watcher->watched || NULL == watcher->watched_generation) ERROR("realloc");
+
+        memset(watcher->watched + watcher->watched_capacity, 0, (new_capacity - watcher->watched_capacity) * sizeof(char*));
+        watcher->watched_capacity = new_capacity;
+    }
+
+    if(NULL == watcher->watched[wd] || strcmp(watcher->watched[wd], path) != 0)
+    {
+        free(watcher->watched[wd]);
+        watcher->watched[wd] = strdup(path);
+        if(NULL == watcher->watched[wd]) ERROR("strdup");
+    }
+    watcher->watched_generation[wd] = watcher->generation;
+}
+
+// Stops watching directory `path` and all directories inside of it.
+static void watcher_unwatch_subtree(watcher_t* watcher, const char* path)
+{
+    size_t length = strlen(path);
+    for(size_t wd = 0; wd < watcher->watched_capacity; ++wd)
+    {
+        const char* watched = watcher->watched[wd];
+        if(NULL == watched || strncmp(watched, path, length) != 0) continue;
+        if(watched[length] != '\0' && watched[length] != '/') continue;
+
+        inotify_rm_watch(watcher->inotify_fd, wd);
+        free(watcher->watched[wd]);
+        watcher->watched[wd] = NULL;
+    }
+}
+
+// Removes entry `id` from the index (together with its contents, if it is a directory).
+static void watcher_remove(watcher_t* watcher, uint64_t id)
+{
+    mole_index_t* index = &watcher->index;
+
+    if(index->file_types[id] == Directory)
+    {
+        char path[PATH_MAX];
+        index_entry_path(index, &index->elements[id], path);
+        watcher_unwatch_subtree(watcher, path);
+
+        index_remove_subtree(index, id);
+    }
+    else
+    {
+        index_remove(index, id);
+    }
+
+    watcher->removed++;
+    watcher->dirty = true;
+    watcher->changed = true;
+}
+
+// Checks whether directory described by `stat` is `dir_id` or one of its ancestors.
+static bool watcher_is_cycle(const mole_index_t* index, uint64_t dir_id, const struct stat* stat)
+{
+    for(; dir_id != MOLE_NO_ENTRY; dir_id = index->elements[dir_id].parent)
+        if(index->elements[dir_id].device == (uint64_t) stat->st_dev && index->elements[dir_id].inode == (uint64_t) stat->st_ino)
+            return true;
+
+    return false;
+}
+
+// Traverses new directory `path` and adds it (with its contents) to the index as child of `dir_id`.
+static void watcher_add_subtree(watcher_t* watcher, uint64_t dir_id, const char* path, const char* name)
+{
+    mole_index_t subtree;
+    index_init_reserved(&subtree, MOLE_DEFAULT_CAPACITY, MOLE_MAX_ENTRIES);
+    if(!walker_run(watcher->context, path, NULL, &watcher->index.type_cache, &subtree) || subtree.size == 0)
+    {
+        index_free(&subtree);
+        return;
+    }
+
+    mole_index_t* index = &watcher->index;
+    uint64_t base = index->size;
+    index_merge(index, &subtree);
+    for(size_t i = base; i < index->size; ++i)
+    {
+        mole_index_entry_t* entry = &index->elements[i];
+        if(entry->parent != MOLE_NO_ENTRY)
+        {
+            entry->parent += base;
+            continue;
+        }
+
+        // Root of traversal is named after the path, it should be named like in its parent.
+        entry->parent = dir_id;
+        entry->name_length = strlen(name);
+        entry->name_offset = arena_append(&index->strings, name, entry->name_length);
+    }
+    index_free(&subtree);
+
+    char dir_path[PATH_MAX];
+    for(size_t i = base; i < index->size; ++i)
+    {
+        path_table_insert(&watcher->paths, index, i);
+        child_table_insert(&watcher->children, index, i);
+        if(index->file_types[i] == Directory)
+        {
+            index_entry_path(index, &index->elements[i], dir_path);
+            watcher_watch(watcher, dir_path);
+        }
+    }
+
+    watcher->dirty = true;
+    watcher->changed = true;
+}
+
+// Checks file `name` inside directory `dir_path` again and updates the index accordingly.
+// Only watcher's own copy of the index is modified, queries see changes once they are published.
+static void watcher_refresh(watcher_t* watcher, const char* dir_path, const char* name)
+{
+    mole_index_t* index = &watcher->index;
+
+    uint64_t dir_id = path_table_find(&watcher->paths, index, dir_path);
+    if(dir_id == MOLE_NO_ENTRY || index->file_types[dir_id] != Directory) return;
+
+    char path[PATH_MAX];
+    if(snprintf(path, PATH_MAX, "%s/%s", dir_path, name) >= PATH_MAX) return;
+
+    uint64_t id = child_table_find(&watcher->children, index, dir_id, name);
+
+    struct stat stat_buffer;
+    if(stat(path, &stat_buffer) || (!S_ISDIR(stat_buffer.st_mode) && !S_ISREG(stat_buffer.st_mode)))
+    {
+        if(id != MOLE_NO_ENTRY) watcher_remove(watcher, id);
+        return;
+    }
+
+    if(S_ISDIR(stat_buffer.st_mode))
+    {
+        // Directory keeps its id, so that entries inside of it still refer to it.
+        if(id != MOLE_NO_ENTRY && index->file_types[id] == Directory
+           && index->elements[id].device == (uint64_t) stat_buffer.st_dev
+           && index->elements[id].inode == (uint64_t) stat_buffer.st_ino)
+        {
+            index_update(index, id, &stat_buffer);
+            watcher->dirty = true;
+            watcher->changed = true;
+            return;
+        }
+
+        if(id != MOLE_NO_ENTRY) watcher_remove(watcher, id);
+        if(!watcher_is_cycle(index, dir_id, &stat_buffer))
+            watcher_add_subtree(watcher, dir_id, path, name);
+        return;
+    }
+
+    if(id != MOLE_NO_ENTRY)
+    {
+        if(index->file_types[id] != Directory && index_entry_unchanged(index, id, &stat_buffer)
+           && index->owner_uids[id] == stat_buffer.st_uid)
+            return;
+
+        watcher_remove(watcher, id);
+    }
+
+    // File might be gone or unreadable by now, it is then skipped like an unrecognized one.
+    file_type_t type;
+    if(!try_get_file_type_at(AT_FDCWD, path, &type) || type == Unrecognized) return;
+
+    char real_path[PATH_MAX];
+    if(realpath(path, real_path) == NULL) return;
+
+    char dir_real_path[PATH_MAX];
+    index_entry_path(index, &index->elements[dir_id], dir_real_path);
+    uint64_t new_id = index_emplace(index, name, real_path, dir_id, dir_real_path, &stat_buffer, type);
+
+    path_table_insert(&watcher->paths, index, new_id);
+    child_table_insert(&watcher->children, index, new_id);
+    watcher->dirty = true;
+    watcher->changed = true;
+}
+
+static void watcher_refresh_path(watcher_t* watcher, char* path)
+{
+    char* separator = strrchr(path, '/');
+    if(NULL == separator) return;
+
+    *separator = '\0';
+    watcher_refresh(watcher, path, separator + 1);
+    *separator = '/';
+}
+
+// Rebuilds lookup tables and watches after ids of entries changed.
+static void watcher_rebuild(watcher_t* watcher)
+{
+    mole_index_t* index = &watcher->index;
+
+    path_table_free(&watcher->paths);
+    child_table_free(&watcher->children);
+    path_table_build(&watcher->paths, index);
+    child_table_build(&watcher->children, index);
+
+    char path[PATH_MAX];
+    for(size_t i = 0; i < index->size; ++i)
+    {
+        if(index->file_types[i] == Directory)
+        {
+            index_entry_path(index, &index->elements[i], path);
+            watcher_watch(watcher, path);
+        }
+    }
+
+    // Directories, that are not in the new index, are not watched anymore.
+    for(size_t wd = 0; wd < watcher->watched_capacity; ++wd)
+    {
+        if(NULL == watcher->watched[wd] || watcher->watched_generation[wd] == watcher->generation) continue;
+
+        inotify_rm_watch(watcher->inotify_fd, wd);
+        free(watcher->watched[wd]);
+        watcher->watched[wd] = NULL;
+    }
+}
+
+// Takes copy of new snapshot, rebuilds lookup tables and watches for it,
+// then applies changes that happened while it was being built.
+static void watcher_sync(watcher_t* watcher, const mole_snapshot_t* snapshot)
+{
+    index_free(&watcher->index);
+    index_copy(&watcher->index, &snapshot->index);
+    watcher->generation = snapshot->generation;
+    watcher_rebuild(watcher);
+
+    for(size_t i = 0; i < watcher->replay_size; ++i)
+    {
+        watcher_refresh_path(watcher, watcher->replay[i]);
+        free(watcher->replay[i]);
+    }
+    watcher->replay_size = 0;
+}
+
+// Handles single inotify event. `pending` tells whether indexing is in progress.
+static void watcher_handle(watcher_t* watcher, const struct inotify_event* event, bool pending)
+{
+    if(event->mask & IN_Q_OVERFLOW)
+    {
+        watcher->rescan_needed = true;
+        return;
+    }
+
+    if(event->wd < 0 || (size_t) event->wd >= watcher->watched_capacity || NULL == watcher->watched[event->wd])
+        return;
+
+    if(event->mask & IN_IGNORED)
+    {
+        free(watcher->watched[event->wd]);
+        watcher->watched[event->wd] = NULL;
+        return;
+    }
+
+    // Events about watched directory itself are also reported to its parent.
+    if(event->len == 0) return;
+
+    const char* dir_path = watcher->watched[event->wd];
+    if(!pending)
+    {
+        watcher_refresh(watcher, dir_path, event->name);
+        return;
+    }
+
+    if(watcher->replay_size >= WATCHER_REPLAY_MAX)
+    {
+        watcher->rescan_needed = true;
+        return;
+    }
+
+    char path[PATH_MAX];
+    if(snprintf(path, PATH_MAX, "%s/%s", dir_path, event->name) >= PATH_MAX) return;
+    watcher->replay[watcher->replay_size] = strdup(path);
+    if(NULL == watcher->replay[watcher->replay_size]) ERROR("strdup");
+    watcher->replay_size++;
+}
+
+// Returns number of milliseconds between `since` and `now`.
+static long watcher_elapsed_ms(const struct timespec* since, const struct timespec* now)
+{
+    return (now->tv_sec - since->tv_sec) * 1000 + (now->tv_nsec - since->tv_nsec) / 1000000;
+}
+
+// Publishes copy of modified index, so that queries can see the changes.
+// Returns pinned published snapshot.
+// Has to be called with `indexing_mutex` locked and no indexing pending.
+static mole_snapshot_t* watcher_publish(watcher_t* watcher, bool renumbered)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    mole_index_t copy;
+    index_copy(&copy, &watcher->index);
+
+    mole_snapshot_t* snapshot = snapshot_publish(watcher->context, &copy, renumbered);
+    watcher->generation = snapshot->generation;
+    watcher->changed = false;
+
+    clock_gettime(CLOCK_MONOTONIC, &watcher->published);
+    watcher->publish_ms = watcher_elapsed_ms(&start, &watcher->published);
+
+    return snapshot;
+}
+
+// Tells whether enough time passed since the last publication to publish changes again.
+static bool watcher_may_publish(const watcher_t* watcher, const struct timespec* now)
+{
+    long interval = WATCHER_PUBLISH_SHARE * watcher->publish_ms;
+    if(interval < WATCHER_PUBLISH_INTERVAL_MS) interval = WATCHER_PUBLISH_INTERVAL_MS;
+
+    return watcher_elapsed_ms(&watcher->published, now) >= interval;
+}
+
+// Schedules saving modified index into file, dropping removed entries and covering new ones
+// by auxiliary structures first. New entries are moved into subtrees of their directories.
+// Has to be called with `indexing_mutex` locked and no indexing pending.
+static void watcher_save(watcher_t* watcher)
+{
+    bool renumbered = watcher->removed > 0 || watcher->index.subtrees.indexed != watcher->index.size;
+    if(watcher->removed > 0)
+        index_compact(&watcher->index);
+    if(renumbered)
+        index_order_preorder(&watcher->index);
+    index_prepare(&watcher->index);
+
+    mole_snapshot_t* snapshot = watcher_publish(watcher, renumbered);
+    if(renumbered)
+        watcher_rebuild(watcher);
+
+    persister_request(watcher->context->persister, snapshot);
+
+    watcher->removed = 0;
+    watcher->dirty = false;
+}
+
+static void* watcher_thread(void* args)
+{
+    watcher_t* watcher = (watcher_t*) args;
+    mole_context_t* context = watcher->context;
+
+    char buffer[WATCHER_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct timespec last_event;
+    clock_gettime(CLOCK_MONOTONIC, &last_event);
+
+    for(;;)
+    {
+        struct pollfd fds[2] = {
+            { .fd = watcher->inotify_fd, .events = POLLIN },
+            { .fd = watcher->stop_pipe[0], .events = POLLIN }
+        };
+        int ready = poll(fds, 2, WATCHER_POLL_MS);
+        if(ready < 0)
+        {
+            if(errno == EINTR) continue;
+            ERROR("poll");
+        }
+        if(fds[1].revents) break;
+
+        ssize_t length = 0;
+        if(fds[0].revents & POLLIN)
+        {
+            length = read(watcher->inotify_fd, buffer, WATCHER_BUFFER_SIZE);
+            if(length < 0 && errno != EINTR && errno != EAGAIN) ERROR("read");
+            clock_gettime(CLOCK_MONOTONIC, &last_event);
+        }
+
+        pthread_mutex_lock(context->indexing_mutex);
+        bool pending = context->indexing_pending;
+        if(!pending)
+        {
+            mole_snapshot_t* snapshot = snapshot_acquire(context);
+            if(watcher->generation != snapshot->generation)
+                watcher_sync(watcher, snapshot);
+            snapshot_release(snapshot);
+        }
+
+        for(ssize_t offset = 0; offset < length;)
+        {
+            const struct inotify_event* event = (const struct inotify_event*) (buffer + offset);
+            watcher_handle(watcher, event, pending);
+            offset += sizeof(struct inotify_event) + event->len;
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long quiet_ms = watcher_elapsed_ms(&last_event, &now);
+        if(!pending && watcher->dirty && quiet_ms >= WATCHER_SAVE_DELAY_MS)
+            watcher_save(watcher);
+        else if(!pending && watcher->changed && watcher_may_publish(watcher, &now))
+            snapshot_release(watcher_publish(watcher, false));
+        pthread_mutex_unlock(context->indexing_mutex);
+
+        if(watcher->rescan_needed && !pending)
+        {
+            watcher->rescan_needed = false;
+            indexer_start_worker(context);
+        }
+    }
+
+    return NULL;
+}
+
+void watcher_start(watcher_t* watcher, mole_context_t* context)
+{
+    watcher->context = context;
+    watcher->inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if(watcher->inotify_fd < 0) ERROR("inotify_init1");
+    if(pipe(watcher->stop_pipe)) ERROR("pipe");
+
+    // Generation that can't be current one forces building tables at start.
+    watcher->generation = SIZE_MAX;
+    index_init(&watcher->index);
+    watcher->paths.slots = NULL;
+    watcher->children.slots = NULL;
+    watcher->watched_capacity = 16;
+    watcher->watched = calloc(watcher->watched_capacity, sizeof(char*));
+    watcher->watched_generation = calloc(watcher->watched_capacity, sizeof(size_t));
+    watcher->replay = malloc(WATCHER_REPLAY_MAX * sizeof(char*));
+    if(NULL == watcher->watched || NULL == watcher->watched_generation || NULL == watcher->replay) ERROR("malloc");
+    watcher->replay_size = 0;
+    watcher->rescan_needed = false;
+    watcher->dirty = false;
+    watcher->changed = false;
+    watcher->publish_ms = 0;
+    clock_gettime(CLOCK_MONOTONIC, &watcher->published);
+    watcher->removed = 0;
+
+    if(pthread_create(&watcher->tid, NULL, watcher_thread, watcher)) ERROR("pthread_create");
+}
+
+void watcher_stop(watcher_t* watcher)
+{
+    if(write(watcher->stop_pipe[1], "", 1) < 0) ERROR("write");
+    if(pthread_join(watcher->tid, NULL)) ERROR("pthread_join");
+
+    pthread_mutex_lock(watcher->context->indexing_mutex);
+    if(watcher->dirty && !watcher->context->indexing_pending)
+        watcher_save(watcher);
+    pthread_mutex_unlock(watcher->context->indexing_mutex);
+
+    for(size_t wd = 0; wd < watcher->watched_capacity; ++wd)
+        free(watcher->watched[wd]);
+    for(size_t i = 0; i < watcher->replay_size; ++i)
+        free(watcher->replay[i]);
+    free(watcher->watched);
+    free(watcher->watched_generation);
+    free(watcher->replay);
+    path_table_free(&watcher->paths);
+    child_table_free(&watcher->children);
+    index_free(&watcher->index);
+
+    close(watcher->inotify_fd);
+    close(watcher->stop_pipe[0]);
+    close(watcher->stop_pipe[1]);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <pthread.h>
+
+#include "common.h"
+#include "mole_index.h"
+
+#define WATCHER_EVENTS_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE \
+                             | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+#define WATCHER_BUFFER_SIZE 65536
+#define WATCHER_REPLAY_MAX 65536
+#define WATCHER_SAVE_DELAY_MS 5000
+#define WATCHER_PUBLISH_INTERVAL_MS 1000
+#define WATCHER_PUBLISH_SHARE 10
+
+// Hash table mapping (parent directory, file name) pairs to entry ids.
+// It lets watcher find entry that event refers to, as events only carry names.
+typedef struct watcher_child_table
+{
+    size_t size;        // Number of occupied slots
+    size_t capacity;    // Number of slots (power of two)
+    uint64_t* slots;    // Entry id + 1 for occupied slots, 0 for empty ones
+} watcher_child_table_t;
+
+// Keeps index up to date by applying filesystem events reported by inotify.
+//
+// Every directory in the index is watched. When an event arrives, the file it refers to
+// is checked again (stat) and its entry is inserted, replaced or removed. New directories
+// are traversed and watched. Watcher applies events to its own copy of the index and
+// publishes copy of it as a new snapshot (see snapshot.h). Copying large index takes a while,
+// so while events keep coming, copies are published at most every WATCHER_PUBLISH_INTERVAL_MS
+// and rarely enough to spend at most 1/WATCHER_PUBLISH_SHARE of the time copying.
+// Events can't be applied while indexing is pending (changes would be lost once the new
+// index is published), so they are remembered and replayed on the new index.
+// If the kernel event queue overflows, full reindexing is started instead.
+typedef struct watcher
+{
+    mole_context_t* context;            // Program's context
+    pthread_t tid;                      // Id of watcher's thread
+    int inotify_fd;                     // Inotify instance
+    int stop_pipe[2];                   // Pipe used to wake watcher up when it should stop
+    mole_index_t index;                 // Working copy of the index
+    size_t generation;                  // Generation of snapshot that working copy was taken from
+    mole_path_table_t paths;            // Paths of all entries
+    watcher_child_table_t children;     // (parent, name) of all entries
+    char** watched;                     // Path of directory watched by every watch descriptor
+    size_t* watched_generation;         // Generation in which watch descriptor was last added
+    size_t watched_capacity;            // Size of both arrays above
+    char** replay;                      // Paths of files changed while indexing was pending
+    size_t replay_size;                 // Number of paths to replay
+    bool rescan_needed;                 // Flag telling that events were lost
+    bool dirty;                         // Flag telling that index was modified but not saved
+    bool changed;                       // Flag telling that index was modified but not published
+    struct timespec published;          // Time of the last publication
+    long publish_ms;                    // Time the last publication took (in milliseconds)
+    size_t removed;                     // Number of entries removed since last compaction
+} watcher_t;
+
+// Starts thread watching directory tree of `context->path_d`.
+void watcher_start(watcher_t* watcher, mole_context_t* context);
+
+// Stops watcher's thread, saving the index if it was modified.
+void watcher_stop(watcher_t* watcher);